@@ -15,20 +15,29 @@
 */
 
 #include <arpa/inet.h>
+#include <errno.h>
 #include <netinet/in.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#ifdef HAVE_ENDIAN_H
+#  include <endian.h>
+#endif
+
+#include <libloc/libloc.h>
 #include <libloc/address.h>
 #include <libloc/compat.h>
+#include <libloc/private.h>
 
 #define LOC_ADDRESS_BUFFERS				6
 #define LOC_ADDRESS_BUFFER_LENGTH		INET6_ADDRSTRLEN
 
-static char __loc_address_buffers[LOC_ADDRESS_BUFFERS][LOC_ADDRESS_BUFFER_LENGTH + 1];
-static int  __loc_address_buffer_idx = 0;
+// Every thread has its own buffers so that strings cannot be overwritten concurrently
+static __thread char __loc_address_buffers[LOC_ADDRESS_BUFFERS][LOC_ADDRESS_BUFFER_LENGTH + 1];
+static __thread int  __loc_address_buffer_idx = 0;
 
 static const char* __loc_address6_str(const struct in6_addr* address, char* buffer, size_t length) {
 	return inet_ntop(AF_INET6, address, buffer, length);
@@ -42,6 +51,18 @@ static const char* __loc_address4_str(const struct in6_addr* address, char* buff
 	return inet_ntop(AF_INET, &address4, buffer, length);
 }
 
+const char* loc_address_format(const struct in6_addr* address, char* buffer, size_t length) {
+	if (!address || !buffer) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	if (IN6_IS_ADDR_V4MAPPED(address))
+		return __loc_address4_str(address, buffer, length);
+	else
+		return __loc_address6_str(address, buffer, length);
+}
+
 const char* loc_address_str(const struct in6_addr* address) {
 	if (!address)
 		return NULL;
@@ -52,110 +73,360 @@ const char* loc_address_str(const struct in6_addr* address) {
 	// Prevent index from overflow
 	__loc_address_buffer_idx %= LOC_ADDRESS_BUFFERS;
 
-	if (IN6_IS_ADDR_V4MAPPED(address))
-		return __loc_address4_str(address, buffer, LOC_ADDRESS_BUFFER_LENGTH);
-	else
-		return __loc_address6_str(address, buffer, LOC_ADDRESS_BUFFER_LENGTH);
+	return loc_address_format(address, buffer, LOC_ADDRESS_BUFFER_LENGTH);
 }
 
-static void loc_address_from_address4(struct in6_addr* address,
-		const struct in_addr* address4) {
-	address->s6_addr32[0] = 0;
-	address->s6_addr32[1] = 0;
-	address->s6_addr32[2] = htonl(0xffff);
-	address->s6_addr32[3] = address4->s_addr;
+/*
+	The parser below is a faster replacement for inet_pton() which accepts
+	exactly the same input, but does not need a terminated string and
+	therefore does not need to copy its input before parsing it.
+
+	Dotted-quad IPv4 addresses are classified eight characters at a time.
+*/
+
+#define LOC_ADDRESS_SWAR_LOW	0x7f7f7f7f7f7f7f7fULL
+#define LOC_ADDRESS_SWAR_HIGH	0x8080808080808080ULL
+
+// Sets the highest bit of every byte that is zero
+static inline uint64_t loc_address_swar_zero(const uint64_t x) {
+	return ~(((x & LOC_ADDRESS_SWAR_LOW) + LOC_ADDRESS_SWAR_LOW) | x | LOC_ADDRESS_SWAR_LOW);
 }
 
-int loc_address_parse(struct in6_addr* address, unsigned int* prefix, const char* string) {
-	char buffer[INET6_ADDRSTRLEN + 4];
-	int r;
+// Sets the highest bit of every byte that is not a digit
+static inline uint64_t loc_address_swar_nondigit(uint64_t x) {
+	// Map all digits to 0-9
+	x ^= 0x3030303030303030ULL;
 
-	if (!address || !string) {
-		errno = EINVAL;
-		return 1;
+	// Bytes that are larger than 9 will overflow into their highest bit
+	return (((x & LOC_ADDRESS_SWAR_LOW) + 0x7676767676767676ULL) | x) & LOC_ADDRESS_SWAR_HIGH;
+}
+
+// Collects the highest bit of every byte into one bit per byte
+static inline unsigned int loc_address_swar_mask(const uint64_t x) {
+	return ((x >> 7) * 0x0102040810204080ULL) >> 56;
+}
+
+/*
+	Parses one octet of up to three digits
+*/
+static inline int loc_address_parse_octet(const char* s, const int length, uint32_t* octet) {
+	switch (length) {
+		case 1:
+			*octet = s[0] - '0';
+			return 0;
+
+		case 2:
+			*octet = (s[0] - '0') * 10 + (s[1] - '0');
+			break;
+
+		case 3:
+			*octet = (s[0] - '0') * 100 + (s[1] - '0') * 10 + (s[2] - '0');
+			break;
+
+		default:
+			return 1;
 	}
 
-	// Copy the string into the buffer
-	r = snprintf(buffer, sizeof(buffer) - 1, "%s", string);
-	if (r < 0)
+	// Leading zeroes are not allowed
+	if (s[0] == '0')
 		return 1;
 
-	// Find /
-	char* p = strchr(buffer, '/');
-	if (p) {
-		// Terminate the IP address
-		*p++ = '\0';
+	return (*octet > 255);
+}
+
+/*
+	Parses a dotted-quad IPv4 address and stores it in host byte order
+*/
+static int loc_address_parse4(uint32_t* address4, const char* string, const size_t length) {
+	uint64_t block[2] = { 0, 0 };
+	uint32_t octets[4];
+
+	// The shortest address is 0.0.0.0 and the longest one 255.255.255.255
+	if (length < 7 || length > 15)
+		return 1;
+
+	// Copy the string into a zero-padded block
+	memcpy(block, string, length);
+
+	const uint64_t lo = le64toh(block[0]);
+	const uint64_t hi = le64toh(block[1]);
+
+	// Find all dots
+	const unsigned int dots =
+		loc_address_swar_mask(loc_address_swar_zero(lo ^ 0x2e2e2e2e2e2e2e2eULL))
+		| loc_address_swar_mask(loc_address_swar_zero(hi ^ 0x2e2e2e2e2e2e2e2eULL)) << 8;
+
+	// Find everything that is not a digit
+	const unsigned int nondigits =
+		loc_address_swar_mask(loc_address_swar_nondigit(lo))
+		| loc_address_swar_mask(loc_address_swar_nondigit(hi)) << 8;
+
+	// Everything must be a digit or one of exactly three dots
+	if ((nondigits & ~dots & ((1u << length) - 1)) || __builtin_popcount(dots) != 3)
+		return 1;
+
+	// Find the position of all dots
+	const int dot1 = __builtin_ctz(dots);
+	const int dot2 = __builtin_ctz(dots & (dots - 1));
+	const int dot3 = 31 - __builtin_clz(dots);
+
+	// Parse all octets (this will reject empty or too long ones)
+	if (loc_address_parse_octet(string, dot1, &octets[0])
+			|| loc_address_parse_octet(string + dot1 + 1, dot2 - dot1 - 1, &octets[1])
+			|| loc_address_parse_octet(string + dot2 + 1, dot3 - dot2 - 1, &octets[2])
+			|| loc_address_parse_octet(string + dot3 + 1, length - dot3 - 1, &octets[3]))
+		return 1;
+
+	*address4 = (octets[0] << 24) | (octets[1] << 16) | (octets[2] << 8) | octets[3];
+
+	return 0;
+}
+
+static inline int loc_address_hex_digit(unsigned char c) {
+	if ((unsigned char)(c - '0') < 10)
+		return c - '0';
+
+	// Convert to lowercase
+	c |= 0x20;
+
+	if ((unsigned char)(c - 'a') < 6)
+		return c - 'a' + 10;
+
+	return -1;
+}
+
+/*
+	Parses an IPv6 address (which might end in an IPv4 address)
+*/
+static int loc_address_parse6(struct in6_addr* address, const char* s, const size_t length) {
+	const char* end = s + length;
+	uint8_t buffer[16] = { 0 };
+	unsigned int n = 0;
+	int gap = -1;
+
+	unsigned int digits = 0;
+	unsigned int value = 0;
+	uint32_t address4;
+
+	if (!length)
+		return 1;
+
+	// A leading colon must be followed by another one
+	if (*s == ':') {
+		if (++s == end || *s != ':')
+			return 1;
 	}
 
-	int family = AF_UNSPEC;
+	// Remember where the current group started
+	const char* group = s;
 
-	// Try parsing as an IPv6 address
-	r = inet_pton(AF_INET6, buffer, address);
-	switch (r) {
-		// This is not a valid IPv6 address
-		case 0:
-			break;
+	while (s < end) {
+		const unsigned char c = *s++;
 
-		// This is a valid IPv6 address
-		case 1:
-			family = AF_INET6;
+		const int digit = loc_address_hex_digit(c);
+		if (digit >= 0) {
+			// Groups cannot have more than four digits
+			if (digits == 4)
+				return 1;
+
+			value = (value << 4) | digit;
+			digits++;
+			continue;
+		}
+
+		if (c == ':') {
+			group = s;
+
+			// Remember where :: was found (this may only happen once)
+			if (!digits) {
+				if (gap >= 0)
+					return 1;
+
+				gap = n;
+				continue;
+
+			// The address cannot end in a single colon
+			} else if (s == end) {
+				return 1;
+			}
+
+			if (n + 2 > sizeof(buffer))
+				return 1;
+
+			buffer[n++] = value >> 8;
+			buffer[n++] = value & 0xff;
+
+			digits = value = 0;
+			continue;
+		}
+
+		// Parse any trailing IPv4 address
+		if (c == '.' && n + 4 <= sizeof(buffer)) {
+			if (loc_address_parse4(&address4, group, end - group))
+				return 1;
+
+			buffer[n++] = address4 >> 24;
+			buffer[n++] = address4 >> 16;
+			buffer[n++] = address4 >> 8;
+			buffer[n++] = address4;
+
+			digits = 0;
 			break;
+		}
 
-		// Unexpected error
-		default:
+		return 1;
+	}
+
+	// Store the last group
+	if (digits) {
+		if (n + 2 > sizeof(buffer))
 			return 1;
+
+		buffer[n++] = value >> 8;
+		buffer[n++] = value & 0xff;
 	}
 
-	// Try parsing as an IPv4 address
-	if (!family) {
-		struct in_addr address4;
+	// Expand :: which must replace at least one group
+	if (gap >= 0) {
+		if (n == sizeof(buffer))
+			return 1;
 
-		r = inet_pton(AF_INET, buffer, &address4);
-		switch (r) {
-			// This was not a valid IPv4 address
-			case 0:
-				break;
+		memmove(buffer + sizeof(buffer) - (n - gap), buffer + gap, n - gap);
+		memset(buffer + gap, 0, sizeof(buffer) - n);
 
-			// This was a valid IPv4 address
-			case 1:
-				family = AF_INET;
+		n = sizeof(buffer);
+	}
 
-				// Copy the result
-				loc_address_from_address4(address, &address4);
-				break;
+	if (n != sizeof(buffer))
+		return 1;
 
-			// Unexpected error
-			default:
-				return 1;
+	memcpy(address, buffer, sizeof(buffer));
+
+	return 0;
+}
+
+/*
+	Parses an address with an optional prefix that is length bytes long
+*/
+LOC_EXPORT int loc_address_parse_buffer(struct in6_addr* address, unsigned int* prefix,
+		const char* string, size_t length) {
+	unsigned int max_prefix = 128;
+	uint32_t address4;
+	int r;
+
+	if (!address || !string) {
+		errno = EINVAL;
+		return 1;
+	}
+
+	// Find /
+	const char* p = memchr(string, '/', length);
+	const size_t address_length = (p) ? (size_t)(p - string) : length;
+
+	// IPv6 addresses always contain a colon
+	if (memchr(string, ':', address_length)) {
+		r = loc_address_parse6(address, string, address_length);
+
+	} else {
+		r = loc_address_parse4(&address4, string, address_length);
+		if (!r) {
+			address->s6_addr32[0] = 0;
+			address->s6_addr32[1] = 0;
+			address->s6_addr32[2] = htonl(0xffff);
+			address->s6_addr32[3] = htonl(address4);
+
+			max_prefix = 32;
 		}
 	}
 
 	// Invalid input
-	if (family == AF_UNSPEC) {
+	if (r) {
 		errno = EINVAL;
 		return 1;
 	}
 
 	// Did the user request a prefix?
 	if (prefix) {
-		// Set the prefix to the default value
-		const unsigned int max_prefix = loc_address_family_bit_length(family);
+		// If the string didn't contain a prefix, we set the maximum
+		*prefix = max_prefix;
 
-		// Parse the actual string
+		// Parse the actual prefix
 		if (p) {
-			*prefix = strtol(p, NULL, 10);
+			const char* end = string + length;
+			unsigned int value = 0;
+
+			// Skip /
+			p++;
+
+			// The prefix must have one to three digits
+			if (p == end || end - p > 3) {
+				errno = EINVAL;
+				return 1;
+			}
+
+			for (; p < end; p++) {
+				if ((unsigned char)(*p - '0') >= 10) {
+					errno = EINVAL;
+					return 1;
+				}
+
+				value = value * 10 + (*p - '0');
+			}
 
 			// Check if prefix is within bounds
-			if (*prefix > max_prefix) {
+			if (value > max_prefix) {
 				errno = EINVAL;
 				return 1;
 			}
 
-		// If the string didn't contain a prefix, we set the maximum
-		} else {
-			*prefix = max_prefix;
+			*prefix = value;
 		}
 	}
 
 	return 0;
 }
+
+int loc_address_parse(struct in6_addr* address, unsigned int* prefix, const char* string) {
+	if (!string) {
+		errno = EINVAL;
+		return 1;
+	}
+
+	return loc_address_parse_buffer(address, prefix, string, strlen(string));
+}
+
+LOC_EXPORT size_t loc_address_parse_lines(struct in6_addr* addresses, size_t max,
+		const char* buffer, size_t length, size_t* consumed) {
+	const char* end = buffer + length;
+	const char* line = buffer;
+	size_t count = 0;
+
+	while (count < max && line < end) {
+		// Find the end of the line
+		const char* eol = memchr(line, '\n', end - line);
+		const char* next = (eol) ? eol + 1 : end;
+
+		if (!eol)
+			eol = end;
+
+		// Ignore any carriage return
+		if (eol > line && *(eol - 1) == '\r')
+			eol--;
+
+		// Skip empty lines
+		if (eol > line) {
+			// Stop at the first line that isn't a valid address
+			if (loc_address_parse_buffer(&addresses[count], NULL, line, eol - line))
+				break;
+
+			count++;
+		}
+
+		line = next;
+	}
+
+	if (consumed)
+		*consumed = line - buffer;
+
+	return count;
+}
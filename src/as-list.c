@@ -66,7 +66,7 @@ LOC_EXPORT int loc_as_list_new(struct loc_ctx* ctx,
 }
 
 LOC_EXPORT struct loc_as_list* loc_as_list_ref(struct loc_as_list* list) {
-	list->refcount++;
+	loc_refcount_inc(&list->refcount);
 
 	return list;
 }
@@ -84,7 +84,7 @@ LOC_EXPORT struct loc_as_list* loc_as_list_unref(struct loc_as_list* list) {
 	if (!list)
 		return NULL;
 
-	if (--list->refcount > 0)
+	if (loc_refcount_dec(&list->refcount) > 0)
 		return list;
 
 	loc_as_list_free(list);
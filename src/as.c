@@ -57,7 +57,7 @@ LOC_EXPORT int loc_as_new(struct loc_ctx* ctx, struct loc_as** as, uint32_t numb
 }
 
 LOC_EXPORT struct loc_as* loc_as_ref(struct loc_as* as) {
-	as->refcount++;
+	loc_refcount_inc(&as->refcount);
 
 	return as;
 }
@@ -73,7 +73,7 @@ static void loc_as_free(struct loc_as* as) {
 }
 
 LOC_EXPORT struct loc_as* loc_as_unref(struct loc_as* as) {
-	if (--as->refcount > 0)
+	if (loc_refcount_dec(&as->refcount) > 0)
 		return NULL;
 
 	loc_as_free(as);
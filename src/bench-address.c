@@ -0,0 +1,347 @@
+/*
+	libloc - A library to determine the location of someone on the Internet
+
+	Copyright (C) 2022 IPFire Development Team <info@ipfire.org>
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libloc/libloc.h>
+#include <libloc/address.h>
+
+/*
+	This benchmark compares the address helpers and the address parser
+	with their previous implementations.
+
+	Usage: bench-address
+*/
+
+/*
+	These are the previous implementations of the arithmetic helpers which
+	worked on one octet at a time.
+*/
+#define foreach_octet_in_address(octet, address) \
+	for (octet = (IN6_IS_ADDR_V4MAPPED(address) ? 12 : 0); octet <= 15; octet++)
+
+#define foreach_octet_in_address_reverse(octet, address) \
+	for (octet = 15; octet >= (IN6_IS_ADDR_V4MAPPED(address) ? 12 : 0); octet--)
+
+static int old_address_cmp(const struct in6_addr* a1, const struct in6_addr* a2) {
+	for (unsigned int i = 0; i < 16; i++) {
+		if (a1->s6_addr[i] > a2->s6_addr[i])
+			return 1;
+
+		else if (a1->s6_addr[i] < a2->s6_addr[i])
+			return -1;
+	}
+
+	return 0;
+}
+
+static int old_address_all_ones(const struct in6_addr* address) {
+	int octet = 0;
+
+	foreach_octet_in_address(octet, address) {
+		if (address->s6_addr[octet] < 255)
+			return 0;
+	}
+
+	return 1;
+}
+
+static int old_address_sub(struct in6_addr* result,
+		const struct in6_addr* address1, const struct in6_addr* address2) {
+	int family1 = loc_address_family(address1);
+	int family2 = loc_address_family(address2);
+
+	// Address family must match
+	if (family1 != family2) {
+		errno = EINVAL;
+		return 1;
+	}
+
+	// Clear result
+	int r = loc_address_reset(result, family1);
+	if (r)
+		return r;
+
+	int octet = 0;
+	int remainder = 0;
+
+	foreach_octet_in_address_reverse(octet, address1) {
+		int x = address1->s6_addr[octet] - address2->s6_addr[octet] + remainder;
+
+		// Store remainder for the next iteration
+		remainder = (x >> 8);
+
+		result->s6_addr[octet] = x & 0xff;
+	}
+
+	return 0;
+}
+
+static void old_address_increment(struct in6_addr* address) {
+	// Prevent overflow when everything is ones
+	if (old_address_all_ones(address))
+		return;
+
+	int octet = 0;
+	foreach_octet_in_address_reverse(octet, address) {
+		if (address->s6_addr[octet] < 255) {
+			address->s6_addr[octet]++;
+			break;
+		} else {
+			address->s6_addr[octet] = 0;
+		}
+	}
+}
+
+static int old_address_count_trailing_zero_bits(const struct in6_addr* address) {
+	int zeroes = 0;
+
+	int octet = 0;
+	foreach_octet_in_address_reverse(octet, address) {
+		if (address->s6_addr[octet]) {
+			zeroes += __builtin_ctz(address->s6_addr[octet]);
+			break;
+		} else
+			zeroes += 8;
+	}
+
+	return zeroes;
+}
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+#define BENCHMARK_OPERATIONS 10000000
+
+static void bench_arithmetic(void) {
+	struct in6_addr addresses[1024];
+	struct in6_addr result;
+	volatile int sink = 0;
+	double t1, t2;
+
+	for (unsigned int i = 0; i < 1024; i++) {
+		for (unsigned int j = 0; j < 16; j++)
+			addresses[i].s6_addr[j] = random();
+
+		// Share some leading bits like addresses in the same network would
+		addresses[i].s6_addr32[0] = htonl(0x20010db8);
+	}
+
+	t1 = now();
+	for (unsigned int i = 0; i < BENCHMARK_OPERATIONS; i++)
+		sink += old_address_cmp(&addresses[i % 1024], &addresses[(i + 1) % 1024]);
+	t1 = now() - t1;
+
+	t2 = now();
+	for (unsigned int i = 0; i < BENCHMARK_OPERATIONS; i++)
+		sink += loc_address_cmp(&addresses[i % 1024], &addresses[(i + 1) % 1024]);
+	t2 = now() - t2;
+
+	printf("loc_address_cmp:                       %6.2f ns -> %6.2f ns\n",
+		t1 * 1e9 / BENCHMARK_OPERATIONS, t2 * 1e9 / BENCHMARK_OPERATIONS);
+
+	t1 = now();
+	for (unsigned int i = 0; i < BENCHMARK_OPERATIONS; i++) {
+		old_address_sub(&result, &addresses[i % 1024], &addresses[(i + 1) % 1024]);
+		sink += result.s6_addr[15];
+	}
+	t1 = now() - t1;
+
+	t2 = now();
+	for (unsigned int i = 0; i < BENCHMARK_OPERATIONS; i++) {
+		loc_address_sub(&result, &addresses[i % 1024], &addresses[(i + 1) % 1024]);
+		sink += result.s6_addr[15];
+	}
+	t2 = now() - t2;
+
+	printf("loc_address_sub:                       %6.2f ns -> %6.2f ns\n",
+		t1 * 1e9 / BENCHMARK_OPERATIONS, t2 * 1e9 / BENCHMARK_OPERATIONS);
+
+	loc_address_reset(&result, AF_INET6);
+
+	t1 = now();
+	for (unsigned int i = 0; i < BENCHMARK_OPERATIONS; i++) {
+		old_address_increment(&result);
+		sink += result.s6_addr[15];
+	}
+	t1 = now() - t1;
+
+	loc_address_reset(&result, AF_INET6);
+
+	t2 = now();
+	for (unsigned int i = 0; i < BENCHMARK_OPERATIONS; i++) {
+		loc_address_increment(&result);
+		sink += result.s6_addr[15];
+	}
+	t2 = now() - t2;
+
+	printf("loc_address_increment:                 %6.2f ns -> %6.2f ns\n",
+		t1 * 1e9 / BENCHMARK_OPERATIONS, t2 * 1e9 / BENCHMARK_OPERATIONS);
+
+	t1 = now();
+	for (unsigned int i = 0; i < BENCHMARK_OPERATIONS; i++)
+		sink += old_address_count_trailing_zero_bits(&addresses[i % 1024]);
+	t1 = now() - t1;
+
+	t2 = now();
+	for (unsigned int i = 0; i < BENCHMARK_OPERATIONS; i++)
+		sink += loc_address_count_trailing_zero_bits(&addresses[i % 1024]);
+	t2 = now() - t2;
+
+	printf("loc_address_count_trailing_zero_bits:  %6.2f ns -> %6.2f ns\n",
+		t1 * 1e9 / BENCHMARK_OPERATIONS, t2 * 1e9 / BENCHMARK_OPERATIONS);
+}
+
+/*
+	This is how addresses used to be parsed before loc_address_parse()
+	had its own parser.
+*/
+static int parse_inet_pton(struct in6_addr* address, const char* string) {
+	char buffer[INET6_ADDRSTRLEN + 4];
+	struct in_addr address4;
+
+	// Copy the string into the buffer
+	snprintf(buffer, sizeof(buffer) - 1, "%s", string);
+
+	if (inet_pton(AF_INET6, buffer, address) == 1)
+		return 0;
+
+	if (inet_pton(AF_INET, buffer, &address4) == 1) {
+		address->s6_addr32[0] = 0;
+		address->s6_addr32[1] = 0;
+		address->s6_addr32[2] = htonl(0xffff);
+		address->s6_addr32[3] = address4.s_addr;
+
+		return 0;
+	}
+
+	return 1;
+}
+
+#define BENCHMARK_ADDRESSES 1000000
+
+static int bench_parse(void) {
+	const size_t length = BENCHMARK_ADDRESSES * (INET6_ADDRSTRLEN + 1);
+	struct in6_addr* addresses = NULL;
+	size_t consumed;
+	size_t count;
+	double t;
+	int r = 1;
+
+	char* buffer = malloc(length);
+	if (!buffer)
+		goto ERROR;
+
+	addresses = calloc(BENCHMARK_ADDRESSES, sizeof(*addresses));
+	if (!addresses)
+		goto ERROR;
+
+	// Write plenty of random addresses into a buffer, one per line
+	char* p = buffer;
+	for (unsigned int i = 0; i < BENCHMARK_ADDRESSES; i++) {
+		for (unsigned int j = 0; j < 16; j++)
+			addresses[i].s6_addr[j] = random();
+
+		// Make three out of four addresses IPv4
+		if (i % 4) {
+			addresses[i].s6_addr32[0] = addresses[i].s6_addr32[1] = 0;
+			addresses[i].s6_addr32[2] = htonl(0xffff);
+		}
+
+		loc_address_format(&addresses[i], p, INET6_ADDRSTRLEN);
+		p += strlen(p);
+		*p++ = '\n';
+	}
+
+	// inet_pton() needs terminated strings
+	p[-1] = '\0';
+
+	t = now();
+	for (char* s = buffer; s; ) {
+		char* eol = strchr(s, '\n');
+		if (eol)
+			*eol = '\0';
+
+		if (parse_inet_pton(&addresses[0], s))
+			goto ERROR;
+
+		if (eol)
+			*eol++ = '\n';
+
+		s = eol;
+	}
+	t = now() - t;
+
+	printf("inet_pton:                 %6.2f M addresses/s\n", BENCHMARK_ADDRESSES / t / 1e6);
+
+	t = now();
+	for (char* s = buffer; s; ) {
+		char* eol = strchr(s, '\n');
+		if (eol)
+			*eol = '\0';
+
+		if (loc_address_parse(&addresses[0], NULL, s))
+			goto ERROR;
+
+		if (eol)
+			*eol++ = '\n';
+
+		s = eol;
+	}
+	t = now() - t;
+
+	printf("loc_address_parse:         %6.2f M addresses/s\n", BENCHMARK_ADDRESSES / t / 1e6);
+
+	t = now();
+	count = loc_address_parse_lines(addresses, BENCHMARK_ADDRESSES, buffer, p - buffer - 1, &consumed);
+	t = now() - t;
+
+	if (count != BENCHMARK_ADDRESSES) {
+		fprintf(stderr, "Could only parse %zu addresses\n", count);
+		goto ERROR;
+	}
+
+	printf("loc_address_parse_lines:   %6.2f M addresses/s\n", BENCHMARK_ADDRESSES / t / 1e6);
+
+	r = 0;
+
+ERROR:
+	if (addresses)
+		free(addresses);
+	if (buffer)
+		free(buffer);
+
+	return r;
+}
+
+int main(int argc, char** argv) {
+	bench_arithmetic();
+
+	if (bench_parse())
+		return EXIT_FAILURE;
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,848 @@
+/*
+	libloc - A library to determine the location of someone on the Internet
+
+	Copyright (C) 2017 IPFire Development Team <info@ipfire.org>
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <errno.h>
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <libloc/libloc.h>
+#include <libloc/address.h>
+#include <libloc/database.h>
+#include <libloc/format.h>
+#include <libloc/lookup-cache.h>
+#include <libloc/network.h>
+#include <libloc/writer.h>
+
+/*
+	This benchmark measures how many lookups per second we can perform.
+
+	It either uses the database given on the command line, or generates
+	a synthetic one with many networks that is large enough to not fit
+	into the CPU caches.
+
+	All results are compared with the results of walking the tree, so that
+	this also checks all accelerators with many more lookups than the tests.
+
+	Usage: bench-lookup [DATABASE]
+*/
+
+#define NETWORKS	200000
+#define LOOKUPS		2000000
+
+// The number of distinct addresses in the Zipf-distributed stream
+#define ZIPF_ADDRESSES	100000
+#define ZIPF_EXPONENT	1.0
+
+#define CACHE_SIZE		4096
+
+// The number of lookups with cold CPU caches
+#define COLD_LOOKUPS	500
+
+// This must be larger than the last level cache
+#define EVICT_SIZE		(64 * 1024 * 1024)
+
+#define MAX_THREADS		64
+
+static uint64_t seed = 0x2545f4914f6cdd1d;
+
+// A small xorshift generator so that all runs are comparable
+static uint64_t next_random(void) {
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+
+	return seed;
+}
+
+static void random_address(struct in6_addr* address) {
+	uint64_t r = next_random();
+
+	memset(address, 0, sizeof(*address));
+
+	// Generate an IPv4 address for three out of four lookups
+	if (r & 3) {
+		address->s6_addr[10] = 0xff;
+		address->s6_addr[11] = 0xff;
+
+		for (unsigned int i = 12; i < 16; i++)
+			address->s6_addr[i] = next_random();
+
+	// Otherwise generate an address in 2000::/3
+	} else {
+		for (unsigned int i = 0; i < 16; i++)
+			address->s6_addr[i] = next_random();
+
+		address->s6_addr[0] = 0x20 | (address->s6_addr[0] & 0x1f);
+	}
+}
+
+/*
+	Fills addresses with a stream in which the n-th most popular
+	address is being looked up with a probability proportional to 1/n^s.
+*/
+static int zipf_addresses(struct in6_addr* addresses, size_t count) {
+	struct in6_addr* popular = NULL;
+	double* cdf = NULL;
+	double sum = 0;
+	int r = 1;
+
+	popular = calloc(ZIPF_ADDRESSES, sizeof(*popular));
+	cdf = calloc(ZIPF_ADDRESSES, sizeof(*cdf));
+	if (!popular || !cdf)
+		goto ERROR;
+
+	for (unsigned int i = 0; i < ZIPF_ADDRESSES; i++) {
+		random_address(&popular[i]);
+
+		sum += 1.0 / pow(i + 1, ZIPF_EXPONENT);
+		cdf[i] = sum;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		double p = (double)next_random() / UINT64_MAX * sum;
+
+		// Find the first address whose cumulated probability is larger than p
+		size_t lo = 0, hi = ZIPF_ADDRESSES - 1;
+
+		while (lo < hi) {
+			size_t mid = (lo + hi) / 2;
+
+			if (cdf[mid] < p)
+				lo = mid + 1;
+			else
+				hi = mid;
+		}
+
+		addresses[i] = popular[lo];
+	}
+
+	r = 0;
+
+ERROR:
+	if (popular)
+		free(popular);
+	if (cdf)
+		free(cdf);
+
+	return r;
+}
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static struct loc_writer* create_writer(struct loc_ctx* ctx) {
+	struct loc_writer* writer = NULL;
+	struct loc_network* network = NULL;
+	struct loc_network* added = NULL;
+	struct in6_addr address;
+	char country_code[3];
+	int r;
+
+	r = loc_writer_new(ctx, &writer, NULL, NULL);
+	if (r)
+		return NULL;
+
+	for (unsigned int i = 0; i < NETWORKS; i++) {
+		uint64_t n = next_random();
+
+		random_address(&address);
+
+		// Pick a realistic prefix
+		unsigned int prefix;
+		if (IN6_IS_ADDR_V4MAPPED(&address))
+			prefix = 12 + (n % 13);
+		else
+			prefix = 24 + (n % 25);
+
+		r = loc_network_new(ctx, &network, &address, prefix);
+		if (r)
+			goto ERROR;
+
+		r = loc_writer_add_network(writer, &added, loc_network_str(network));
+		loc_network_unref(network);
+
+		// Networks might have been generated more than once
+		if (r == -EBUSY) {
+			loc_network_unref(added);
+			continue;
+		} else if (r)
+			goto ERROR;
+
+		country_code[0] = 'A' + (n >> 8) % 26;
+		country_code[1] = 'A' + (n >> 16) % 26;
+		country_code[2] = '\0';
+
+		loc_network_set_country_code(added, country_code);
+		loc_network_set_asn(added, n >> 32);
+
+		loc_network_unref(added);
+	}
+
+	return writer;
+
+ERROR:
+	loc_writer_unref(writer);
+
+	return NULL;
+}
+
+static FILE* write_database(struct loc_writer* writer, enum loc_database_version version) {
+	FILE* f = tmpfile();
+	if (!f)
+		return NULL;
+
+	int r = loc_writer_write(writer, f, version);
+	if (r) {
+		fclose(f);
+		return NULL;
+	}
+
+	return f;
+}
+
+static const char* mode = NULL;
+
+// The results of walking the tree that all other results are compared with
+static struct loc_database_lookup_result* reference = NULL;
+
+static void report(const char* name, unsigned int lookups, unsigned int matches, double t) {
+	char buffer[128];
+
+	snprintf(buffer, sizeof(buffer), "%s, %s", mode, name);
+
+	printf("%-32s %8.2f M lookups/s (%u matches)\n", buffer, lookups / t / 1e6, matches);
+}
+
+/*
+	Compares results with the reference results, ignoring everything that may
+	differ between database versions and accelerators
+*/
+static int verify(const char* name, const struct in6_addr* addresses,
+		const struct loc_database_lookup_result* results) {
+	for (unsigned int i = 0; i < LOOKUPS; i++) {
+		const struct loc_database_lookup_result* r1 = &reference[i];
+		const struct loc_database_lookup_result* r2 = &results[i];
+
+		if (r1->family != r2->family || r1->prefix != r2->prefix
+				|| r1->asn != r2->asn || r1->flags != r2->flags
+				|| strcmp(r1->country_code, r2->country_code) != 0
+				|| memcmp(&r1->first_address, &r2->first_address, sizeof(r1->first_address)) != 0
+				|| memcmp(&r1->last_address, &r2->last_address, sizeof(r1->last_address)) != 0) {
+			fprintf(stderr, "%s, %s: Lookup results for %s differ\n",
+				mode, name, loc_address_str(&addresses[i]));
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int bench_single(struct loc_database* db, const struct in6_addr* addresses,
+		struct loc_database_lookup_result* results) {
+	unsigned int matches = 0;
+	int r;
+
+	double t = now();
+
+	for (unsigned int i = 0; i < LOOKUPS; i++) {
+		r = loc_database_lookup_result(db, &addresses[i], &results[i]);
+		if (r < 0)
+			return r;
+
+		if (r == 0)
+			matches++;
+	}
+
+	report("single", LOOKUPS, matches, now() - t);
+
+	return verify("single", addresses, results);
+}
+
+static int bench_batch(struct loc_database* db, const struct in6_addr* addresses,
+		struct loc_database_lookup_result* results, size_t batch_size) {
+	unsigned int matches = 0;
+	size_t found = 0;
+	char name[32];
+	int r;
+
+	double t = now();
+
+	for (size_t i = 0; i < LOOKUPS; i += batch_size) {
+		size_t count = batch_size;
+		if (i + count > LOOKUPS)
+			count = LOOKUPS - i;
+
+		r = loc_database_lookup_batch(db, &addresses[i], count, &results[i], &found);
+		if (r)
+			return r;
+
+		matches += found;
+	}
+
+	snprintf(name, sizeof(name), "batch (%zu)", batch_size);
+	report(name, LOOKUPS, matches, now() - t);
+
+	return verify(name, addresses, results);
+}
+
+static int bench_cache(struct loc_ctx* ctx, struct loc_database* db,
+		const struct in6_addr* addresses, struct loc_database_lookup_result* results) {
+	struct loc_lookup_cache* cache = NULL;
+	unsigned int matches = 0;
+	char name[64];
+	int r;
+
+	r = loc_lookup_cache_new(ctx, &cache, db, CACHE_SIZE);
+	if (r)
+		return r;
+
+	double t = now();
+
+	for (unsigned int i = 0; i < LOOKUPS; i++) {
+		r = loc_lookup_cache_lookup(cache, &addresses[i], &results[i]);
+		if (r < 0)
+			goto ERROR;
+
+		if (r == 0)
+			matches++;
+	}
+
+	t = now() - t;
+
+	snprintf(name, sizeof(name), "cache (%.1f%% hits)",
+		100.0 * loc_lookup_cache_get_hits(cache) / LOOKUPS);
+	report(name, LOOKUPS, matches, t);
+
+	r = 0;
+
+ERROR:
+	loc_lookup_cache_unref(cache);
+
+	return r;
+}
+
+static int reference_results(struct loc_ctx* ctx, FILE* f, const struct in6_addr* addresses) {
+	struct loc_database* db = NULL;
+	int r;
+
+	r = loc_database_new(ctx, &db, f);
+	if (r) {
+		fprintf(stderr, "Could not open database: %m\n");
+		return r;
+	}
+
+	for (unsigned int i = 0; i < LOOKUPS; i++) {
+		r = loc_database_lookup_result(db, &addresses[i], &reference[i]);
+		if (r < 0)
+			goto ERROR;
+	}
+
+	r = 0;
+
+ERROR:
+	loc_database_unref(db);
+
+	return r;
+}
+
+static int bench(struct loc_ctx* ctx, FILE* f, int flags, const struct in6_addr* addresses,
+		struct loc_database_lookup_result* results) {
+	struct loc_database* db = NULL;
+	int r;
+
+	r = loc_database_new_with_flags(ctx, &db, f, flags);
+	if (r) {
+		fprintf(stderr, "Could not open database: %m\n");
+		return r;
+	}
+
+	r = bench_single(db, addresses, results);
+	if (r)
+		goto ERROR;
+
+	for (size_t batch_size = 8; batch_size <= 256; batch_size *= 4) {
+		r = bench_batch(db, addresses, results, batch_size);
+		if (r)
+			goto ERROR;
+	}
+
+ERROR:
+	loc_database_unref(db);
+
+	return r;
+}
+
+struct bench_thread {
+	pthread_t thread;
+
+	struct loc_database* db;
+	const struct in6_addr* addresses;
+
+	unsigned int matches;
+	int r;
+};
+
+static void* bench_thread(void* data) {
+	struct bench_thread* thread = data;
+	struct loc_database_lookup_result result;
+	int r;
+
+	for (unsigned int i = 0; i < LOOKUPS; i++) {
+		r = loc_database_lookup_result(thread->db, &thread->addresses[i], &result);
+		if (r < 0) {
+			thread->r = r;
+			break;
+		}
+
+		if (r == 0)
+			thread->matches++;
+	}
+
+	return NULL;
+}
+
+static int bench_threads_run(struct loc_database* db, unsigned int count,
+		const struct in6_addr* addresses) {
+	struct bench_thread threads[MAX_THREADS];
+	unsigned int matches = 0;
+	unsigned int started;
+	char name[32];
+	int r = 0;
+
+	double t = now();
+
+	for (started = 0; started < count; started++) {
+		threads[started] = (struct bench_thread){
+			.db        = db,
+			.addresses = addresses,
+		};
+
+		r = pthread_create(&threads[started].thread, NULL, bench_thread, &threads[started]);
+		if (r) {
+			fprintf(stderr, "Could not create thread: %s\n", strerror(r));
+			break;
+		}
+	}
+
+	for (unsigned int i = 0; i < started; i++) {
+		pthread_join(threads[i].thread, NULL);
+
+		if (threads[i].r)
+			r = threads[i].r;
+
+		matches += threads[i].matches;
+	}
+
+	t = now() - t;
+
+	if (r)
+		return r;
+
+	snprintf(name, sizeof(name), "%u thread(s)", count);
+	report(name, LOOKUPS * count, matches, t);
+
+	return 0;
+}
+
+/*
+	Measures how well lookups scale when all threads share the same database
+*/
+static int bench_threads(struct loc_ctx* ctx, FILE* f, int flags,
+		const struct in6_addr* addresses) {
+	struct loc_database* db = NULL;
+	int r;
+
+	// Use one thread per CPU
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 1)
+		threads = 1;
+	else if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+
+	r = loc_database_new_with_flags(ctx, &db, f, flags);
+	if (r) {
+		fprintf(stderr, "Could not open database: %m\n");
+		return r;
+	}
+
+	r = bench_threads_run(db, 1, addresses);
+	if (r)
+		goto ERROR;
+
+	if (threads > 1) {
+		r = bench_threads_run(db, threads, addresses);
+		if (r)
+			goto ERROR;
+	}
+
+ERROR:
+	loc_database_unref(db);
+
+	return r;
+}
+
+/*
+	Counts how many different cache lines and pages of the network tree
+	each lookup touches on average
+*/
+static int bench_layout(struct loc_ctx* ctx, FILE* f, size_t node_size,
+		const struct in6_addr* addresses) {
+	struct loc_database_tree_position position;
+	struct loc_database* db = NULL;
+	size_t lines[129], pages[129];
+	size_t total_lines = 0;
+	size_t total_pages = 0;
+	int r;
+
+	r = loc_database_new(ctx, &db, f);
+	if (r) {
+		fprintf(stderr, "Could not open database: %m\n");
+		return r;
+	}
+
+	for (unsigned int i = 0; i < COLD_LOOKUPS * 100; i++) {
+		unsigned int num_lines = 0, num_pages = 0;
+		uint32_t node = 0xffffffff;
+
+		r = loc_database_tree_root(db, &position);
+		if (r)
+			goto ERROR;
+
+		for (unsigned int level = 0; level <= 128; level++) {
+			// Count every node only once
+			if (position.node != node) {
+				const size_t offset = position.node * node_size;
+
+				node = position.node;
+
+				unsigned int j = 0;
+				while (j < num_lines && lines[j] != offset / 64)
+					j++;
+				if (j == num_lines)
+					lines[num_lines++] = offset / 64;
+
+				j = 0;
+				while (j < num_pages && pages[j] != offset / 4096)
+					j++;
+				if (j == num_pages)
+					pages[num_pages++] = offset / 4096;
+			}
+
+			if (level == 128)
+				break;
+
+			r = loc_database_tree_child(db, &position,
+				loc_address_get_bit(&addresses[i], level), &position);
+			if (r < 0)
+				goto ERROR;
+			else if (r)
+				break;
+		}
+
+		total_lines += num_lines;
+		total_pages += num_pages;
+	}
+
+	printf("%-32s %8.2f cache lines, %.2f pages per lookup\n", mode,
+		(double)total_lines / (COLD_LOOKUPS * 100), (double)total_pages / (COLD_LOOKUPS * 100));
+
+	r = 0;
+
+ERROR:
+	loc_database_unref(db);
+
+	return r;
+}
+
+/*
+	Performs lookups after evicting everything from the CPU caches
+*/
+static int bench_cold(struct loc_ctx* ctx, FILE* f, const struct in6_addr* addresses,
+		struct loc_database_lookup_result* results) {
+	struct loc_database* db = NULL;
+	unsigned int matches = 0;
+	double t = 0;
+	int r;
+
+	volatile char* evict = malloc(EVICT_SIZE);
+	if (!evict)
+		return 1;
+
+	r = loc_database_new(ctx, &db, f);
+	if (r) {
+		fprintf(stderr, "Could not open database: %m\n");
+		goto ERROR;
+	}
+
+	for (unsigned int i = 0; i < COLD_LOOKUPS; i++) {
+		// Replace everything in the caches
+		for (size_t j = 0; j < EVICT_SIZE; j += 64)
+			evict[j] = i;
+
+		double start = now();
+
+		r = loc_database_lookup_result(db, &addresses[i], &results[i]);
+		if (r < 0)
+			goto ERROR;
+
+		t += now() - start;
+
+		if (r == 0)
+			matches++;
+	}
+
+	report("cold", COLD_LOOKUPS, matches, t);
+
+	r = 0;
+
+ERROR:
+	if (db)
+		loc_database_unref(db);
+	free((char*)evict);
+
+	return r;
+}
+
+static int bench_zipf(struct loc_ctx* ctx, FILE* f, const struct in6_addr* addresses,
+		struct loc_database_lookup_result* results) {
+	struct loc_database* db = NULL;
+	int r;
+
+	r = loc_database_new(ctx, &db, f);
+	if (r) {
+		fprintf(stderr, "Could not open database: %m\n");
+		return r;
+	}
+
+	r = bench_single(db, addresses, results);
+	if (r)
+		goto ERROR;
+
+	r = bench_cache(ctx, db, addresses, results);
+	if (r)
+		goto ERROR;
+
+ERROR:
+	loc_database_unref(db);
+
+	return r;
+}
+
+int main(int argc, char** argv) {
+	struct loc_ctx* ctx = NULL;
+	struct in6_addr* addresses = NULL;
+	struct loc_database_lookup_result* results = NULL;
+	struct loc_writer* writer = NULL;
+	FILE* f = NULL;
+	FILE* f2 = NULL;
+	FILE* f3 = NULL;
+	FILE* f4 = NULL;
+	FILE* f5 = NULL;
+	int r = EXIT_FAILURE;
+
+	if (loc_new(&ctx) < 0)
+		return EXIT_FAILURE;
+
+	if (argc > 1) {
+		f = fopen(argv[1], "r");
+		if (!f) {
+			fprintf(stderr, "Could not open %s: %m\n", argv[1]);
+			goto ERROR;
+		}
+	} else {
+		writer = create_writer(ctx);
+		if (!writer) {
+			fprintf(stderr, "Could not create database: %m\n");
+			goto ERROR;
+		}
+
+		f = write_database(writer, LOC_DATABASE_VERSION_1);
+		f2 = write_database(writer, LOC_DATABASE_VERSION_2);
+		if (!f || !f2) {
+			fprintf(stderr, "Could not write database: %m\n");
+			goto ERROR;
+		}
+
+		// Write both again with the tree clustered in subtrees
+		loc_writer_set_flags(writer, LOC_WRITER_FLAGS_CLUSTER_TREE);
+
+		f3 = write_database(writer, LOC_DATABASE_VERSION_1);
+		f4 = write_database(writer, LOC_DATABASE_VERSION_2);
+		if (!f3 || !f4) {
+			fprintf(stderr, "Could not write clustered database: %m\n");
+			goto ERROR;
+		}
+
+		// Write another one with all networks pushed into the leaves
+		loc_writer_set_flags(writer, LOC_WRITER_FLAGS_PUSH_LEAVES);
+
+		f5 = write_database(writer, LOC_DATABASE_VERSION_2);
+		if (!f5) {
+			fprintf(stderr, "Could not write leaf-pushed database: %m\n");
+			goto ERROR;
+		}
+	}
+
+	addresses = calloc(LOOKUPS, sizeof(*addresses));
+	results = calloc(LOOKUPS, sizeof(*results));
+	reference = calloc(LOOKUPS, sizeof(*reference));
+	if (!addresses || !results || !reference)
+		goto ERROR;
+
+	for (unsigned int i = 0; i < LOOKUPS; i++)
+		random_address(&addresses[i]);
+
+	// Walk the tree once to have something to compare with
+	if (reference_results(ctx, f, addresses))
+		goto ERROR;
+
+	mode = "tree";
+	if (bench(ctx, f, 0, addresses, results))
+		goto ERROR;
+
+	mode = "tree (validated)";
+	if (bench(ctx, f, LOC_DB_FLAGS_VALIDATE, addresses, results))
+		goto ERROR;
+
+	mode = "tree (copy)";
+	if (bench(ctx, f, LOC_DB_FLAGS_COPY_TREE, addresses, results))
+		goto ERROR;
+
+	mode = "poptrie";
+	if (bench(ctx, f, LOC_DB_FLAGS_POPTRIE, addresses, results))
+		goto ERROR;
+
+	mode = "dir24-8";
+	if (bench(ctx, f, LOC_DB_FLAGS_DIR24_8, addresses, results))
+		goto ERROR;
+
+	mode = "poptrie+dir24-8";
+	if (bench(ctx, f, LOC_DB_FLAGS_POPTRIE|LOC_DB_FLAGS_DIR24_8, addresses, results))
+		goto ERROR;
+
+	// Compare with the path-compressed tree
+	if (f2) {
+		mode = "tree (v2)";
+		if (bench(ctx, f2, 0, addresses, results))
+			goto ERROR;
+
+		mode = "tree (v2, validated)";
+		if (bench(ctx, f2, LOC_DB_FLAGS_VALIDATE, addresses, results))
+			goto ERROR;
+
+		mode = "tree (v2, copy)";
+		if (bench(ctx, f2, LOC_DB_FLAGS_COPY_TREE, addresses, results))
+			goto ERROR;
+
+		mode = "poptrie+dir24-8 (v2)";
+		if (bench(ctx, f2, LOC_DB_FLAGS_POPTRIE|LOC_DB_FLAGS_DIR24_8, addresses, results))
+			goto ERROR;
+	}
+
+	// Compare with the leaf-pushed tree
+	if (f5) {
+		mode = "tree (leaf-pushed)";
+		if (bench(ctx, f5, 0, addresses, results))
+			goto ERROR;
+	}
+
+	// Compare the layout of the tree
+	if (f3 && f4) {
+		const struct layout {
+			const char* mode;
+			FILE* f;
+			size_t node_size;
+		} layouts[] = {
+			{ "tree",                 f,  sizeof(struct loc_database_network_node_v1) },
+			{ "tree (clustered)",     f3, sizeof(struct loc_database_network_node_v1) },
+			{ "tree (v2)",            f2, sizeof(struct loc_database_network_node_v2) },
+			{ "tree (v2, clustered)", f4, sizeof(struct loc_database_network_node_v2) },
+			{ NULL },
+		};
+
+		for (const struct layout* layout = layouts; layout->mode; layout++) {
+			mode = layout->mode;
+
+			if (bench_layout(ctx, layout->f, layout->node_size, addresses))
+				goto ERROR;
+
+			if (bench_cold(ctx, layout->f, addresses, results))
+				goto ERROR;
+
+			// The unclustered trees have been benchmarked above
+			if (layout->f == f3 || layout->f == f4) {
+				if (bench(ctx, layout->f, 0, addresses, results))
+					goto ERROR;
+			}
+		}
+	}
+
+	// Look up from all cores at the same time
+	mode = "tree";
+	if (bench_threads(ctx, f, 0, addresses))
+		goto ERROR;
+
+	mode = "poptrie+dir24-8";
+	if (bench_threads(ctx, f, LOC_DB_FLAGS_POPTRIE|LOC_DB_FLAGS_DIR24_8, addresses))
+		goto ERROR;
+
+	// Look up a Zipf-distributed stream with and without the cache
+	if (zipf_addresses(addresses, LOOKUPS))
+		goto ERROR;
+
+	if (reference_results(ctx, f, addresses))
+		goto ERROR;
+
+	mode = "zipf";
+	if (bench_zipf(ctx, f, addresses, results))
+		goto ERROR;
+
+	r = EXIT_SUCCESS;
+
+ERROR:
+	if (writer)
+		loc_writer_unref(writer);
+	if (f)
+		fclose(f);
+	if (f2)
+		fclose(f2);
+	if (f3)
+		fclose(f3);
+	if (f4)
+		fclose(f4);
+	if (f5)
+		fclose(f5);
+	if (addresses)
+		free(addresses);
+	if (results)
+		free(results);
+	if (reference)
+		free(reference);
+	loc_unref(ctx);
+
+	return r;
+}
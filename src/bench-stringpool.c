@@ -0,0 +1,174 @@
+/*
+	libloc - A library to determine the location of someone on the Internet
+
+	Copyright (C) 2017 IPFire Development Team <info@ipfire.org>
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libloc/libloc.h>
+#include <libloc/as.h>
+#include <libloc/stringpool.h>
+#include <libloc/writer.h>
+
+/*
+	This benchmark measures how fast strings can be added to a string pool
+	and how long it takes to write a database with many named ASes.
+
+	Usage: bench-stringpool
+*/
+
+#define STRINGS		1000000
+
+// Every n-th string is one that has been added before
+#define REPEATED	4
+
+#define ASES		100000
+
+static uint64_t seed = 0x6a09e667f3bcc909;
+
+static uint64_t next_random(void) {
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+
+	return seed;
+}
+
+static double now(void) {
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static int bench_stringpool(struct loc_ctx* ctx) {
+	struct loc_stringpool* pool = NULL;
+	char string[64];
+	unsigned int distinct = 0;
+	int r = 1;
+
+	r = loc_stringpool_new(ctx, &pool);
+	if (r)
+		return r;
+
+	double t_start = now();
+
+	for (unsigned int i = 0; i < STRINGS; i++) {
+		// Repeat a string that we have added before
+		if (distinct && i % REPEATED == 0)
+			snprintf(string, sizeof(string), "Example Network %u",
+				(unsigned int)(next_random() % distinct));
+
+		// Add a new string
+		else
+			snprintf(string, sizeof(string), "Example Network %u", distinct++);
+
+		if (loc_stringpool_add(pool, string) < 0) {
+			fprintf(stderr, "Could not add string: %m\n");
+			goto ERROR;
+		}
+	}
+
+	double t_end = now();
+
+	printf("  %-24s %8.3fs  %8.2f M strings/s  (%u distinct, %zu bytes)\n",
+		"stringpool", t_end - t_start, STRINGS / (t_end - t_start) / 1e6,
+		distinct, loc_stringpool_get_size(pool));
+
+	r = 0;
+
+ERROR:
+	loc_stringpool_unref(pool);
+
+	return r;
+}
+
+static int bench_writer(struct loc_ctx* ctx) {
+	struct loc_writer* writer = NULL;
+	struct loc_as* as = NULL;
+	char name[64];
+	FILE* f = NULL;
+	int r = 1;
+
+	r = loc_writer_new(ctx, &writer, NULL, NULL);
+	if (r)
+		return r;
+
+	for (unsigned int i = 1; i <= ASES; i++) {
+		r = loc_writer_add_as(writer, &as, i);
+		if (r)
+			goto ERROR;
+
+		// Give a couple of ASes the same name
+		snprintf(name, sizeof(name), "Example Organisation %u", i / 2);
+
+		r = loc_as_set_name(as, name);
+		loc_as_unref(as);
+		if (r)
+			goto ERROR;
+	}
+
+	f = tmpfile();
+	if (!f)
+		goto ERROR;
+
+	double t_start = now();
+
+	r = loc_writer_write(writer, f, LOC_DATABASE_VERSION_UNSET);
+	if (r) {
+		fprintf(stderr, "Could not write database: %m\n");
+		goto ERROR;
+	}
+
+	double t_end = now();
+
+	printf("  %-24s %8.3fs  (%u ASes)\n", "writer", t_end - t_start, ASES);
+
+ERROR:
+	if (f)
+		fclose(f);
+	loc_writer_unref(writer);
+
+	return r;
+}
+
+int main(int argc, char** argv) {
+	struct loc_ctx* ctx = NULL;
+	int r = EXIT_FAILURE;
+
+	if (loc_new(&ctx) < 0)
+		return EXIT_FAILURE;
+
+	printf("Adding %u strings (every %u. has been added before):\n", STRINGS, REPEATED);
+
+	if (bench_stringpool(ctx))
+		goto ERROR;
+
+	printf("Writing a database with %u named ASes:\n", ASES);
+
+	if (bench_writer(ctx))
+		goto ERROR;
+
+	r = EXIT_SUCCESS;
+
+ERROR:
+	loc_unref(ctx);
+
+	return r;
+}
@@ -67,7 +67,7 @@ LOC_EXPORT int loc_country_list_new(struct loc_ctx* ctx,
 }
 
 LOC_EXPORT struct loc_country_list* loc_country_list_ref(struct loc_country_list* list) {
-	list->refcount++;
+	loc_refcount_inc(&list->refcount);
 
 	return list;
 }
@@ -82,7 +82,7 @@ static void loc_country_list_free(struct loc_country_list* list) {
 }
 
 LOC_EXPORT struct loc_country_list* loc_country_list_unref(struct loc_country_list* list) {
-	if (--list->refcount > 0)
+	if (loc_refcount_dec(&list->refcount) > 0)
 		return list;
 
 	loc_country_list_free(list);
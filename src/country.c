@@ -71,7 +71,7 @@ LOC_EXPORT int loc_country_new(struct loc_ctx* ctx, struct loc_country** country
 }
 
 LOC_EXPORT struct loc_country* loc_country_ref(struct loc_country* country) {
-	country->refcount++;
+	loc_refcount_inc(&country->refcount);
 
 	return country;
 }
@@ -87,7 +87,7 @@ static void loc_country_free(struct loc_country* country) {
 }
 
 LOC_EXPORT struct loc_country* loc_country_unref(struct loc_country* country) {
-	if (--country->refcount > 0)
+	if (loc_refcount_dec(&country->refcount) > 0)
 		return NULL;
 
 	loc_country_free(country);
@@ -0,0 +1,372 @@
+/*
+	libloc - A library to determine the location of someone on the Internet
+
+	Copyright (C) 2017 IPFire Development Team <info@ipfire.org>
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <libgen.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#ifdef HAVE_SYS_INOTIFY_H
+#  include <sys/inotify.h>
+#endif
+
+#include <libloc/libloc.h>
+#include <libloc/database.h>
+#include <libloc/database-handle.h>
+#include <libloc/private.h>
+
+/*
+	A handle holds the currently opened database and can replace it with
+	a new one at any time without blocking any readers.
+
+	Readers announce themselves in one of two counters (selected by the epoch)
+	while they take a reference to the database. After the database has been
+	replaced, the writer waits until both counters have been empty once so that
+	nobody can still be taking a reference to the old database. The old database
+	is then released as soon as the last reader gives back its reference.
+*/
+struct loc_database_handle {
+	struct loc_ctx* ctx;
+	int refcount;
+
+	// Where to find the database and the key to verify it
+	char* path;
+	char* public_key;
+	int flags;
+
+	// The current database
+	struct loc_database* db;
+
+	// Readers that are currently taking a reference
+	unsigned int epoch;
+	int readers[2];
+
+	// Set while the database is being reloaded
+	int reloading;
+
+	// inotify
+	int watch_fd;
+};
+
+/*
+	Opens (and verifies) the database at path
+*/
+static int loc_database_handle_open(struct loc_database_handle* handle,
+		struct loc_database** db) {
+	FILE* f = NULL;
+	int fd = -1;
+	int r;
+
+	clock_t start = clock();
+
+	fd = open(handle->path, O_RDONLY|O_CLOEXEC);
+	if (fd < 0) {
+		ERROR(handle->ctx, "Could not open %s: %m\n", handle->path);
+		return 1;
+	}
+
+	r = loc_database_new_from_fd(handle->ctx, db, fd, handle->flags);
+	close(fd);
+	if (r) {
+		ERROR(handle->ctx, "Could not open database %s: %m\n", handle->path);
+		return r;
+	}
+
+	// Verify the database
+	if (handle->public_key) {
+		f = fopen(handle->public_key, "r");
+		if (!f) {
+			ERROR(handle->ctx, "Could not open public key %s: %m\n", handle->public_key);
+			r = 1;
+			goto ERROR;
+		}
+
+		r = loc_database_verify(*db, f);
+		fclose(f);
+		if (r) {
+			ERROR(handle->ctx, "Could not verify database %s\n", handle->path);
+			errno = EBADMSG;
+			r = 1;
+			goto ERROR;
+		}
+	}
+
+	clock_t end = clock();
+
+	INFO(handle->ctx, "Loaded database %s in %.4fms\n", handle->path,
+		(double)(end - start) / CLOCKS_PER_SEC * 1000);
+
+	return 0;
+
+ERROR:
+	loc_database_unref(*db);
+	*db = NULL;
+
+	return r;
+}
+
+static void loc_database_handle_free(struct loc_database_handle* handle) {
+	DEBUG(handle->ctx, "Releasing database handle %p\n", handle);
+
+	if (handle->db)
+		loc_database_unref(handle->db);
+
+	if (handle->watch_fd >= 0)
+		close(handle->watch_fd);
+
+	if (handle->path)
+		free(handle->path);
+	if (handle->public_key)
+		free(handle->public_key);
+
+	loc_unref(handle->ctx);
+	free(handle);
+}
+
+LOC_EXPORT int loc_database_handle_new(struct loc_ctx* ctx, struct loc_database_handle** handle,
+		const char* path, const char* public_key, int flags) {
+	int r;
+
+	if (!path) {
+		errno = EINVAL;
+		return 1;
+	}
+
+	struct loc_database_handle* h = calloc(1, sizeof(*h));
+	if (!h)
+		return 1;
+
+	h->ctx = loc_ref(ctx);
+	h->refcount = 1;
+	h->flags = flags;
+	h->watch_fd = -1;
+
+	h->path = strdup(path);
+	if (!h->path)
+		goto ERROR;
+
+	if (public_key) {
+		h->public_key = strdup(public_key);
+		if (!h->public_key)
+			goto ERROR;
+	}
+
+	// Open the database for the first time
+	r = loc_database_handle_open(h, &h->db);
+	if (r)
+		goto ERROR;
+
+	DEBUG(ctx, "Database handle allocated at %p\n", h);
+
+	*handle = h;
+	return 0;
+
+ERROR:
+	loc_database_handle_free(h);
+
+	return 1;
+}
+
+LOC_EXPORT struct loc_database_handle* loc_database_handle_ref(struct loc_database_handle* handle) {
+	loc_refcount_inc(&handle->refcount);
+
+	return handle;
+}
+
+LOC_EXPORT struct loc_database_handle* loc_database_handle_unref(struct loc_database_handle* handle) {
+	if (loc_refcount_dec(&handle->refcount) > 0)
+		return handle;
+
+	loc_database_handle_free(handle);
+
+	return NULL;
+}
+
+/*
+	Returns a reference to the current database which has to be given back
+	with loc_database_unref() after use.
+
+	This never blocks and can be called from any thread.
+*/
+LOC_EXPORT struct loc_database* loc_database_handle_get(struct loc_database_handle* handle) {
+	struct loc_database* db;
+
+	// Announce that we are reading
+	const unsigned int epoch = __atomic_load_n(&handle->epoch, __ATOMIC_SEQ_CST) & 1;
+	__atomic_add_fetch(&handle->readers[epoch], 1, __ATOMIC_SEQ_CST);
+
+	db = loc_database_ref(__atomic_load_n(&handle->db, __ATOMIC_SEQ_CST));
+
+	// We are done
+	__atomic_sub_fetch(&handle->readers[epoch], 1, __ATOMIC_RELEASE);
+
+	return db;
+}
+
+/*
+	Waits until no reader can still be taking a reference to the previous database
+*/
+static void loc_database_handle_synchronize(struct loc_database_handle* handle) {
+	for (unsigned int i = 0; i < 2; i++) {
+		// Send any new readers to the other counter
+		const unsigned int epoch = __atomic_fetch_add(&handle->epoch, 1, __ATOMIC_SEQ_CST) & 1;
+
+		// Wait for all readers in this one to finish
+		while (__atomic_load_n(&handle->readers[epoch], __ATOMIC_SEQ_CST))
+			sched_yield();
+	}
+}
+
+/*
+	Opens the database again and replaces the current one if that was successful.
+	Otherwise, the current database remains in place.
+*/
+LOC_EXPORT int loc_database_handle_reload(struct loc_database_handle* handle) {
+	struct loc_database* db = NULL;
+	int r;
+
+	// Only reload once at a time
+	while (__atomic_exchange_n(&handle->reloading, 1, __ATOMIC_ACQUIRE))
+		sched_yield();
+
+	r = loc_database_handle_open(handle, &db);
+	if (r)
+		goto ERROR;
+
+	// Replace the database
+	db = __atomic_exchange_n(&handle->db, db, __ATOMIC_SEQ_CST);
+
+	loc_database_handle_synchronize(handle);
+
+	// Drop our reference to the old database which will be freed by its last reader
+	loc_database_unref(db);
+
+ERROR:
+	__atomic_store_n(&handle->reloading, 0, __ATOMIC_RELEASE);
+
+	return r;
+}
+
+/*
+	Starts watching the database file and returns a file descriptor that becomes
+	readable when it has changed. loc_database_handle_process() has to be called then.
+*/
+LOC_EXPORT int loc_database_handle_watch(struct loc_database_handle* handle) {
+#ifdef HAVE_SYS_INOTIFY_H
+	char* path = NULL;
+	int fd = -1;
+	int r;
+
+	// We are already watching
+	if (handle->watch_fd >= 0)
+		return handle->watch_fd;
+
+	fd = inotify_init1(IN_NONBLOCK|IN_CLOEXEC);
+	if (fd < 0) {
+		ERROR(handle->ctx, "Could not initialize inotify: %m\n");
+		return -1;
+	}
+
+	path = strdup(handle->path);
+	if (!path)
+		goto ERROR;
+
+	// Watch the directory because updates replace the file
+	r = inotify_add_watch(fd, dirname(path), IN_CLOSE_WRITE|IN_MOVED_TO);
+	if (r < 0) {
+		ERROR(handle->ctx, "Could not watch %s: %m\n", handle->path);
+		goto ERROR;
+	}
+
+	free(path);
+
+	handle->watch_fd = fd;
+
+	return fd;
+
+ERROR:
+	if (path)
+		free(path);
+	close(fd);
+
+	return -1;
+#else
+	errno = ENOTSUP;
+	return -1;
+#endif
+}
+
+/*
+	Reads all pending events and reloads the database if it has been replaced
+
+	Returns 0 if nothing has changed or the database has been reloaded successfully.
+*/
+LOC_EXPORT int loc_database_handle_process(struct loc_database_handle* handle) {
+#ifdef HAVE_SYS_INOTIFY_H
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	const struct inotify_event* event = NULL;
+	char* path = NULL;
+	int changed = 0;
+	ssize_t length;
+
+	if (handle->watch_fd < 0) {
+		errno = EBADF;
+		return 1;
+	}
+
+	path = strdup(handle->path);
+	if (!path)
+		return 1;
+
+	const char* filename = basename(path);
+
+	for (;;) {
+		length = read(handle->watch_fd, buffer, sizeof(buffer));
+		if (length < 0) {
+			if (errno == EAGAIN)
+				break;
+
+			ERROR(handle->ctx, "Could not read inotify events: %m\n");
+			free(path);
+			return 1;
+		}
+
+		for (char* p = buffer; p < buffer + length; p += sizeof(*event) + event->len) {
+			event = (const struct inotify_event*)p;
+
+			if (event->len && strcmp(event->name, filename) == 0)
+				changed = 1;
+		}
+	}
+
+	free(path);
+
+	if (!changed)
+		return 0;
+
+	DEBUG(handle->ctx, "Database %s has changed\n", handle->path);
+
+	return loc_database_handle_reload(handle);
+#else
+	errno = ENOTSUP;
+	return 1;
+#endif
+}
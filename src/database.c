@@ -24,6 +24,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/mman.h>
+#include <sys/stat.h>
 #include <sys/types.h>
 #include <time.h>
 #include <unistd.h>
@@ -44,9 +45,11 @@
 #include <libloc/country.h>
 #include <libloc/country-list.h>
 #include <libloc/database.h>
+#include <libloc/dir24.h>
 #include <libloc/format.h>
 #include <libloc/network.h>
 #include <libloc/network-list.h>
+#include <libloc/poptrie.h>
 #include <libloc/private.h>
 #include <libloc/stringpool.h>
 
@@ -61,11 +64,53 @@ struct loc_database_signature {
 	size_t length;
 };
 
+/*
+	A node of the copy of the network tree in host byte order
+
+	The network and the number of skipped bits share one word so that
+	each node is 16 bytes long and four of them fit into one cache line.
+*/
+struct loc_database_tree_node {
+	uint32_t zero;
+	uint32_t one;
+	uint32_t bits;
+	uint32_t network;
+};
+
+#define LOC_DATABASE_HUGE_PAGE_SIZE		(2 * 1024 * 1024)
+
+#define LOC_DATABASE_TREE_NODE_NETWORK_BITS	26
+#define LOC_DATABASE_TREE_NODE_NO_NETWORK	((1U << LOC_DATABASE_TREE_NODE_NETWORK_BITS) - 1)
+
+/*
+	How nodes of the network tree are being read
+*/
+enum loc_database_node_access {
+	// Check everything
+	LOC_DATABASE_NODE_CHECKED,
+
+	// Check nothing (if the database has been validated)
+	LOC_DATABASE_NODE_UNCHECKED,
+
+	// Read from the copy of the tree
+	LOC_DATABASE_NODE_COPY,
+};
+
+// All valid country codes consist of two letters from A-Z
+#define LOC_DATABASE_COUNTRY_INDEX_SIZE (26 * 26)
+
+struct loc_database_as_index_entry {
+	uint32_t number;
+
+	// The position of the AS plus one (or zero if this entry is empty)
+	uint32_t pos;
+};
+
 struct loc_database {
 	struct loc_ctx* ctx;
 	int refcount;
 
-	FILE* f;
+	int flags;
 
 	enum loc_database_version version;
 	time_t created_at;
@@ -73,6 +118,9 @@ struct loc_database {
 	off_t description;
 	off_t license;
 
+	// Flags from the header
+	uint32_t header_flags;
+
 	// Signatures
 	struct loc_database_signature signature1;
 	struct loc_database_signature signature2;
@@ -81,6 +129,12 @@ struct loc_database {
 	char* data;
 	off_t length;
 
+	// Set if we have mapped the data ourselves
+	int mapped;
+
+	// Releases data that has been handed to us
+	void (*destroy)(void* data, size_t length);
+
 	struct loc_stringpool* pool;
 
 	// ASes in the database
@@ -94,6 +148,36 @@ struct loc_database {
 
 	// Countries
 	struct loc_database_objects country_objects;
+
+	// AS search index
+	struct loc_database_objects as_trigram_objects;
+	struct loc_database_objects as_posting_objects;
+
+	// Network index
+	struct loc_database_objects network_index_countries;
+	struct loc_database_objects network_index_asns;
+	struct loc_database_objects network_index_refs;
+
+	// Lookup accelerators
+	struct loc_poptrie* poptrie;
+	struct loc_dir24* dir24;
+
+	// Set if the structure has been validated and lookups can skip all checks
+	int validated;
+
+	// A copy of the network tree
+	struct loc_database_tree_node* tree;
+
+	// The length of the copy if it has been mapped
+	size_t tree_mapped;
+
+	// A hash table to find ASes by their number
+	struct loc_database_as_index_entry* as_index;
+	size_t as_index_mask;
+
+	// The position of each country (plus one) by its code
+	uint16_t country_index[LOC_DATABASE_COUNTRY_INDEX_SIZE];
+	int country_indexed;
 };
 
 #define MAX_STACK_DEPTH 256
@@ -102,6 +186,7 @@ struct loc_node_stack {
 	off_t offset;
 	int i; // Is this node 0 or 1?
 	int depth;
+	off_t network; // The closest network above this node (or -1)
 };
 
 struct loc_database_enumerator {
@@ -117,20 +202,51 @@ struct loc_database_enumerator {
 	enum loc_network_flags flags;
 	int family;
 
+	// The filters above compiled into something that is faster to match
+	int filter_compiled;
+	uint8_t filter_countries[(LOC_DATABASE_COUNTRY_INDEX_SIZE + 7) / 8];
+	uint32_t* filter_asns;
+	size_t filter_asns_count;
+
 	// Flatten output?
 	int flatten;
 
 	// Index of the AS we are looking at
 	unsigned int as_index;
 
+	// Candidates from the AS search index
+	const uint32_t* as_candidates;
+	size_t as_candidates_count;
+
+	// Set once we know whether to search through the candidates or all ASes
+	enum {
+		LOC_DATABASE_AS_SEARCH_NONE = 0,
+		LOC_DATABASE_AS_SEARCH_ALL,
+		LOC_DATABASE_AS_SEARCH_CANDIDATES,
+	} as_search;
+
 	// Index of the country we are looking at
 	unsigned int country_index;
 
+	// Set once we know whether to walk through the tree or the network index
+	enum {
+		LOC_DATABASE_NETWORK_SEARCH_NONE = 0,
+		LOC_DATABASE_NETWORK_SEARCH_TREE,
+		LOC_DATABASE_NETWORK_SEARCH_INDEX,
+	} network_search;
+
+	// The lists of networks from the network index
+	struct loc_database_enumerator_index_list {
+		const struct loc_database_network_index_ref_v1* refs;
+		size_t count;
+		size_t pos;
+	}* index_lists;
+	size_t index_lists_count;
+
 	// Network state
 	struct in6_addr network_address;
 	struct loc_node_stack network_stack[MAX_STACK_DEPTH];
 	int network_stack_depth;
-	unsigned int* networks_visited;
 
 	// For subnet search and bogons
 	struct loc_network_list* stack;
@@ -152,7 +268,7 @@ static inline int __loc_database_check_boundaries(struct loc_database* db,
 	size_t offset = p - db->data;
 
 	// Return if everything is within the boundary
-	if (offset <= db->length - length)
+	if (length <= (size_t)db->length && offset <= db->length - length)
 		return 1;
 
 	DEBUG(db->ctx, "Database read check failed at %p for %zu byte(s)\n", p, length);
@@ -188,6 +304,7 @@ static int loc_database_version_supported(struct loc_database* db, uint8_t versi
 	switch (version) {
 		// Supported versions
 		case LOC_DATABASE_VERSION_1:
+		case LOC_DATABASE_VERSION_2:
 			return 1;
 
 		default:
@@ -198,28 +315,25 @@ static int loc_database_version_supported(struct loc_database* db, uint8_t versi
 }
 
 static int loc_database_check_magic(struct loc_database* db) {
-	struct loc_database_magic magic;
-
-	// Read from file
-	size_t bytes_read = fread(&magic, 1, sizeof(magic), db->f);
+	const struct loc_database_magic* magic = (const struct loc_database_magic*)db->data;
 
 	// Check if we have been able to read enough data
-	if (bytes_read < sizeof(magic)) {
+	if ((size_t)db->length < sizeof(*magic)) {
 		ERROR(db->ctx, "Could not read enough data to validate magic bytes\n");
-		DEBUG(db->ctx, "Read %zu bytes, but needed %zu\n", bytes_read, sizeof(magic));
+		DEBUG(db->ctx, "Read %jd bytes, but needed %zu\n", (intmax_t)db->length, sizeof(*magic));
 		goto ERROR;
 	}
 
 	// Compare magic bytes
-	if (memcmp(magic.magic, LOC_DATABASE_MAGIC, sizeof(magic.magic)) == 0) {
+	if (memcmp(magic->magic, LOC_DATABASE_MAGIC, sizeof(magic->magic)) == 0) {
 		DEBUG(db->ctx, "Magic value matches\n");
 
 		// Do we support this version?
-		if (!loc_database_version_supported(db, magic.version))
+		if (!loc_database_version_supported(db, magic->version))
 			return 1;
 
 		// Parse version
-		db->version = magic.version;
+		db->version = magic->version;
 
 		return 0;
 	}
@@ -235,29 +349,41 @@ ERROR:
 /*
 	Maps the entire database into memory
 */
-static int loc_database_mmap(struct loc_database* db) {
+static int loc_database_mmap(struct loc_database* db, int fd) {
+	struct stat st;
 	int r;
 
-	// Get file descriptor
-	int fd = fileno(db->f);
-
 	// Determine the length of the database
-	db->length = lseek(fd, 0, SEEK_END);
-	if (db->length < 0) {
+	r = fstat(fd, &st);
+	if (r) {
 		ERROR(db->ctx, "Could not determine the length of the database: %m\n");
 		return 1;
 	}
 
-	rewind(db->f);
+	db->length = st.st_size;
+
+	// An empty file cannot be mapped (and is not a database)
+	if (!db->length)
+		return 0;
+
+	int flags = MAP_SHARED;
+
+#ifdef MAP_POPULATE
+	// Read everything now so that the first lookups won't have to wait
+	if (db->flags & LOC_DB_FLAGS_POPULATE)
+		flags |= MAP_POPULATE;
+#endif
 
 	// Map all data
-	db->data = mmap(NULL, db->length, PROT_READ, MAP_SHARED, fd, 0);
+	db->data = mmap(NULL, db->length, PROT_READ, flags, fd, 0);
 	if (db->data == MAP_FAILED) {
 		ERROR(db->ctx, "Could not map the database: %m\n");
 		db->data = NULL;
 		return 1;
 	}
 
+	db->mapped = 1;
+
 	DEBUG(db->ctx, "Mapped database of %zu byte(s) at %p\n", db->length, db->data);
 
 	// Tell the system that we expect to read data randomly
@@ -267,7 +393,96 @@ static int loc_database_mmap(struct loc_database* db) {
 		return r;
 	}
 
+#ifndef MAP_POPULATE
+	// Otherwise ask the system to read everything in the background
+	if (db->flags & LOC_DB_FLAGS_POPULATE) {
+		r = madvise(db->data, db->length, MADV_WILLNEED);
+		if (r) {
+			ERROR(db->ctx, "madvise() failed: %m\n");
+			return r;
+		}
+	}
+#endif
+
+	return 0;
+}
+
+/*
+	Gives advice for a part of the mapped database which does not need to start on a page
+*/
+static int loc_database_madvise(struct loc_database* db,
+		const char* p, size_t length, int advice) {
+	const uintptr_t page_size = sysconf(_SC_PAGESIZE);
+	int r;
+
+	// Nothing to do
+	if (!length)
+		return 0;
+
+	// Align to the start of the page
+	const uintptr_t start = (uintptr_t)p & ~(page_size - 1);
+
+	r = madvise((void*)start, length + ((uintptr_t)p - start), advice);
+	if (r) {
+		ERROR(db->ctx, "madvise() failed: %m\n");
+		return r;
+	}
+
+	return 0;
+}
+
+/*
+	Tells the system how the sections of the database are going to be read
+*/
+static int loc_database_advise(struct loc_database* db) {
+	int r;
+
+	// We cannot give any advice for memory that somebody else owns
+	if (!db->mapped)
+		return 0;
+
+	if (db->flags & LOC_DB_FLAGS_SEQUENTIAL) {
+		// Read ahead everything
+		r = loc_database_madvise(db, db->data, db->length, MADV_SEQUENTIAL);
+		if (r)
+			return r;
+
+		// Except for the network tree which is always walked randomly
+		r = loc_database_madvise(db, db->network_node_objects.data,
+			db->network_node_objects.length, MADV_RANDOM);
+		if (r)
+			return r;
+	}
+
+	return 0;
+}
+
+/*
+	Locks everything that lookups read into memory, so that it won't be evicted
+*/
+static int loc_database_lock(struct loc_database* db) {
+	int r;
+
+	// Lock the copy of the tree if we have one
+	if (db->tree)
+		r = mlock(db->tree, db->network_node_objects.count * sizeof(*db->tree));
+	else
+		r = mlock(db->network_node_objects.data, db->network_node_objects.length);
+	if (r)
+		goto ERROR;
+
+	r = mlock(db->network_objects.data, db->network_objects.length);
+	if (r)
+		goto ERROR;
+
+	DEBUG(db->ctx, "Locked the network tree and all networks into memory\n");
+
 	return 0;
+
+ERROR:
+	ERROR(db->ctx, "Could not lock the database into memory: %m\n");
+
+	return r;
 }
 
 /*
@@ -283,6 +498,88 @@ static int loc_database_map_objects(struct loc_database* db, struct loc_database
 	return 0;
 }
 
+static int loc_database_map_as_search(struct loc_database* db,
+		const off_t offset, const size_t length) {
+	const struct loc_database_as_search_v1* search =
+		(const struct loc_database_as_search_v1*)(db->data + offset);
+
+	// Check if the entire section is part of the mapped area
+	if (length < sizeof(*search) || !__loc_database_check_boundaries(db, (const char*)search, length)) {
+		ERROR(db->ctx, "AS search index is out of bounds\n");
+		errno = EBADMSG;
+		return 1;
+	}
+
+	const size_t trigrams = be32toh(search->trigrams);
+	const size_t trigrams_length = trigrams * sizeof(struct loc_database_as_trigram_v1);
+
+	if (trigrams_length > length - sizeof(*search)) {
+		ERROR(db->ctx, "AS search index is truncated\n");
+		errno = EBADMSG;
+		return 1;
+	}
+
+	// Map trigrams
+	loc_database_map_objects(db, &db->as_trigram_objects,
+		sizeof(struct loc_database_as_trigram_v1),
+		offset + sizeof(*search), trigrams_length);
+
+	// Map all AS positions
+	loc_database_map_objects(db, &db->as_posting_objects, sizeof(uint32_t),
+		offset + sizeof(*search) + trigrams_length,
+		length - sizeof(*search) - trigrams_length);
+
+	DEBUG(db->ctx, "Mapped AS search index with %zu trigram(s)\n", trigrams);
+
+	return 0;
+}
+
+static int loc_database_map_network_index(struct loc_database* db,
+		const off_t offset, const size_t length) {
+	const struct loc_database_network_index_v1* index =
+		(const struct loc_database_network_index_v1*)(db->data + offset);
+
+	// Check if the entire section is part of the mapped area
+	if (length < sizeof(*index) || !__loc_database_check_boundaries(db, (const char*)index, length)) {
+		ERROR(db->ctx, "Network index is out of bounds\n");
+		errno = EBADMSG;
+		return 1;
+	}
+
+	const size_t countries = be32toh(index->countries);
+	const size_t asns = be32toh(index->asns);
+
+	const size_t countries_length = countries * sizeof(struct loc_database_network_index_key_v1);
+	const size_t asns_length = asns * sizeof(struct loc_database_network_index_key_v1);
+
+	if (countries_length > length - sizeof(*index)
+			|| asns_length > length - sizeof(*index) - countries_length) {
+		ERROR(db->ctx, "Network index is truncated\n");
+		errno = EBADMSG;
+		return 1;
+	}
+
+	off_t pos = offset + sizeof(*index);
+
+	// Map countries
+	loc_database_map_objects(db, &db->network_index_countries,
+		sizeof(struct loc_database_network_index_key_v1), pos, countries_length);
+	pos += countries_length;
+
+	// Map ASes
+	loc_database_map_objects(db, &db->network_index_asns,
+		sizeof(struct loc_database_network_index_key_v1), pos, asns_length);
+	pos += asns_length;
+
+	// Map all networks
+	loc_database_map_objects(db, &db->network_index_refs,
+		sizeof(struct loc_database_network_index_ref_v1), pos, offset + length - pos);
+
+	DEBUG(db->ctx, "Mapped network index with %zu countries and %zu ASes\n", countries, asns);
+
+	return 0;
+}
+
 static int loc_database_read_signature(struct loc_database* db,
 		struct loc_database_signature* signature, const char* data, const size_t length) {
 	// Check for a plausible signature length
@@ -304,6 +601,16 @@ static int loc_database_read_signature(struct loc_database* db,
 	return 0;
 }
 
+static size_t loc_database_node_size(struct loc_database* db) {
+	switch (db->version) {
+		case LOC_DATABASE_VERSION_2:
+			return sizeof(struct loc_database_network_node_v2);
+
+		default:
+			return sizeof(struct loc_database_network_node_v1);
+	}
+}
+
 static int loc_database_read_header_v1(struct loc_database* db) {
 	const struct loc_database_header_v1* header =
 		(const struct loc_database_header_v1*)(db->data + LOC_DATABASE_MAGIC_SIZE);
@@ -325,6 +632,7 @@ static int loc_database_read_header_v1(struct loc_database* db) {
 	db->vendor      = be32toh(header->vendor);
 	db->description = be32toh(header->description);
 	db->license     = be32toh(header->license);
+	db->header_flags = be32toh(header->flags);
 
 	// Read signatures
 	r = loc_database_read_signature(db, &db->signature1,
@@ -359,7 +667,7 @@ static int loc_database_read_header_v1(struct loc_database* db) {
 
 	// Map Network Nodes
 	r = loc_database_map_objects(db, &db->network_node_objects,
-		sizeof(struct loc_database_network_node_v1),
+		loc_database_node_size(db),
 		be32toh(header->network_tree_offset),
 		be32toh(header->network_tree_length));
 	if (r)
@@ -381,6 +689,22 @@ static int loc_database_read_header_v1(struct loc_database* db) {
 	if (r)
 		return r;
 
+	// Map the AS search index
+	if (header->as_search_length) {
+		r = loc_database_map_as_search(db,
+			be32toh(header->as_search_offset), be32toh(header->as_search_length));
+		if (r)
+			return r;
+	}
+
+	// Map the network index
+	if (header->network_index_length) {
+		r = loc_database_map_network_index(db,
+			be32toh(header->network_index_offset), be32toh(header->network_index_length));
+		if (r)
+			return r;
+	}
+
 	return 0;
 }
 
@@ -388,7 +712,9 @@ static int loc_database_read_header(struct loc_database* db) {
 	DEBUG(db->ctx, "Database version is %u\n", db->version);
 
 	switch (db->version) {
+		// Version 2 uses the same header
 		case LOC_DATABASE_VERSION_1:
+		case LOC_DATABASE_VERSION_2:
 			return loc_database_read_header_v1(db);
 
 		default:
@@ -397,52 +723,79 @@ static int loc_database_read_header(struct loc_database* db) {
 	}
 }
 
-static int loc_database_clone_handle(struct loc_database* db, FILE* f) {
-	// Fetch the FD of the original handle
-	int fd = fileno(f);
-
-	// Clone file descriptor
-	fd = dup(fd);
-	if (!fd) {
-		ERROR(db->ctx, "Could not duplicate file descriptor\n");
-		return 1;
-	}
-
-	// Reopen the file so that we can keep our own file handle
-	db->f = fdopen(fd, "r");
-	if (!db->f) {
-		ERROR(db->ctx, "Could not re-open database file\n");
-		return 1;
-	}
-
-	// Rewind to the start of the file
-	rewind(db->f);
-
-	return 0;
-}
+static int loc_database_validate(struct loc_database* db);
+static int loc_database_copy_tree(struct loc_database* db);
+static int loc_database_build_as_index(struct loc_database* db);
+static int loc_database_build_country_index(struct loc_database* db);
+static void loc_database_free_tree(struct loc_database* db, struct loc_database_tree_node* tree);
 
-static int loc_database_open(struct loc_database* db, FILE* f) {
+/*
+	Opens the database after its data has been mapped into memory
+*/
+static int loc_database_open(struct loc_database* db) {
 	int r;
 
 	clock_t start = clock();
 
-	// Clone the file handle
-	r = loc_database_clone_handle(db, f);
+	// Check the magic bytes
+	r = loc_database_check_magic(db);
 	if (r)
 		return r;
 
-	// Read magic bytes
-	r = loc_database_check_magic(db);
+	// Read the header
+	r = loc_database_read_header(db);
 	if (r)
 		return r;
 
-	// Map the database into memory
-	r = loc_database_mmap(db);
+	// Give advice for each section
+	r = loc_database_advise(db);
 	if (r)
 		return r;
 
-	// Read the header
-	r = loc_database_read_header(db);
+	// Validate the structure
+	if (db->flags & LOC_DB_FLAGS_VALIDATE) {
+		r = loc_database_validate(db);
+		if (r)
+			return r;
+	}
+
+	// Copy the network tree
+	if (db->flags & (LOC_DB_FLAGS_COPY_TREE|LOC_DB_FLAGS_HUGEPAGES)) {
+		r = loc_database_copy_tree(db);
+		if (r)
+			return r;
+	}
+
+	// Lock the tree and networks into memory
+	if (db->flags & LOC_DB_FLAGS_MLOCK) {
+		r = loc_database_lock(db);
+		if (r)
+			return r;
+	}
+
+	// Build the poptrie
+	if (db->flags & LOC_DB_FLAGS_POPTRIE) {
+		r = loc_poptrie_new(db->ctx, &db->poptrie, db);
+		if (r)
+			return r;
+	}
+
+	// Build the DIR-24-8 table
+	if (db->flags & LOC_DB_FLAGS_DIR24_8) {
+		r = loc_dir24_new(db->ctx, &db->dir24, db);
+		if (r)
+			return r;
+	}
+
+	// Build the AS index
+	if (db->flags & LOC_DB_FLAGS_AS_INDEX) {
+		r = loc_database_build_as_index(db);
+		if (r)
+			return r;
+	}
+
+	// Build the country index
+	r = loc_database_build_country_index(db);
 	if (r)
 		return r;
 
@@ -460,68 +813,153 @@ static void loc_database_free(struct loc_database* db) {
 	DEBUG(db->ctx, "Releasing database %p\n", db);
 
 	// Unmap the entire database
-	if (db->data) {
+	if (db->mapped) {
 		r = munmap(db->data, db->length);
 		if (r)
 			ERROR(db->ctx, "Could not unmap the database: %m\n");
+
+	// Or release the buffer we have been given
+	} else if (db->destroy) {
+		db->destroy(db->data, db->length);
 	}
 
 	// Free the stringpool
 	if (db->pool)
 		loc_stringpool_unref(db->pool);
 
-	// Close database file
-	if (db->f)
-		fclose(db->f);
+	// Free the lookup accelerators
+	if (db->poptrie)
+		loc_poptrie_unref(db->poptrie);
+	if (db->dir24)
+		loc_dir24_unref(db->dir24);
+	if (db->tree)
+		loc_database_free_tree(db, db->tree);
+	if (db->as_index)
+		free(db->as_index);
 
 	loc_unref(db->ctx);
 	free(db);
 }
 
 LOC_EXPORT int loc_database_new(struct loc_ctx* ctx, struct loc_database** database, FILE* f) {
-	struct loc_database* db = NULL;
-	int r = 1;
+	return loc_database_new_with_flags(ctx, database, f, 0);
+}
 
+LOC_EXPORT int loc_database_new_with_flags(struct loc_ctx* ctx,
+		struct loc_database** database, FILE* f, int flags) {
 	// Fail on invalid file handle
 	if (!f) {
 		errno = EINVAL;
 		return 1;
 	}
 
-	// Allocate the database object
-	db = calloc(1, sizeof(*db));
+	return loc_database_new_from_fd(ctx, database, fileno(f), flags);
+}
+
+static struct loc_database* loc_database_create(struct loc_ctx* ctx, int flags) {
+	struct loc_database* db = calloc(1, sizeof(*db));
 	if (!db)
-		goto ERROR;
+		return NULL;
 
 	// Reference context
 	db->ctx = loc_ref(ctx);
 	db->refcount = 1;
+	db->flags = flags;
 
 	DEBUG(db->ctx, "Database object allocated at %p\n", db);
 
+	return db;
+}
+
+/*
+	Opens the database by mapping the file behind fd into memory
+
+	The mapping does not need the file descriptor, so it can be closed right away.
+*/
+LOC_EXPORT int loc_database_new_from_fd(struct loc_ctx* ctx,
+		struct loc_database** database, int fd, int flags) {
+	struct loc_database* db = NULL;
+	int r;
+
+	// Fail on invalid file descriptor
+	if (fd < 0) {
+		errno = EBADF;
+		return 1;
+	}
+
+	db = loc_database_create(ctx, flags);
+	if (!db)
+		return 1;
+
+	// Map the database into memory
+	r = loc_database_mmap(db, fd);
+	if (r)
+		goto ERROR;
+
+	// Try to open the database
+	r = loc_database_open(db);
+	if (r)
+		goto ERROR;
+
+	*database = db;
+	return 0;
+
+ERROR:
+	loc_database_free(db);
+
+	return r;
+}
+
+/*
+	Opens the database from memory without copying it
+
+	If destroy is set, it will be called to release the buffer with the database.
+	If the database cannot be opened, the buffer remains with the caller.
+*/
+LOC_EXPORT int loc_database_new_from_buffer(struct loc_ctx* ctx,
+		struct loc_database** database, const void* buffer, size_t length, int flags,
+		void (*destroy)(void* buffer, size_t length)) {
+	struct loc_database* db = NULL;
+	int r;
+
+	// The buffer must be aligned like anything that has been allocated
+	if (!buffer || (uintptr_t)buffer % sizeof(uint64_t)) {
+		errno = EINVAL;
+		return 1;
+	}
+
+	db = loc_database_create(ctx, flags);
+	if (!db)
+		return 1;
+
+	db->data   = (char*)buffer;
+	db->length = length;
+
 	// Try to open the database
-	r = loc_database_open(db, f);
+	r = loc_database_open(db);
 	if (r)
 		goto ERROR;
 
+	// We now own the buffer
+	db->destroy = destroy;
+
 	*database = db;
 	return 0;
 
 ERROR:
-	if (db)
-		loc_database_free(db);
+	loc_database_free(db);
 
 	return r;
 }
 
 LOC_EXPORT struct loc_database* loc_database_ref(struct loc_database* db) {
-	db->refcount++;
+	loc_refcount_inc(&db->refcount);
 
 	return db;
 }
 
 LOC_EXPORT struct loc_database* loc_database_unref(struct loc_database* db) {
-	if (--db->refcount > 0)
+	if (loc_refcount_dec(&db->refcount) > 0)
 		return NULL;
 
 	loc_database_free(db);
@@ -529,7 +967,7 @@ LOC_EXPORT struct loc_database* loc_database_unref(struct loc_database* db) {
 }
 
 LOC_EXPORT int loc_database_verify(struct loc_database* db, FILE* f) {
-	size_t bytes_read = 0;
+	size_t offset = 0;
 
 	// Cannot do this when no signature is available
 	if (!db->signature1.data && !db->signature2.data) {
@@ -563,22 +1001,13 @@ LOC_EXPORT int loc_database_verify(struct loc_database* db, FILE* f) {
 		goto CLEANUP;
 	}
 
-	// Reset file to start
-	rewind(db->f);
-
 	// Read magic
-	struct loc_database_magic magic;
-	bytes_read = fread(&magic, 1, sizeof(magic), db->f);
-	if (bytes_read < sizeof(magic)) {
-		ERROR(db->ctx, "Could not read header: %m\n");
-		r = 1;
-		goto CLEANUP;
-	}
+	const struct loc_database_magic* magic = (const struct loc_database_magic*)db->data;
 
-	hexdump(db->ctx, &magic, sizeof(magic));
+	hexdump(db->ctx, magic, sizeof(*magic));
 
 	// Feed magic into the hash
-	r = EVP_DigestVerifyUpdate(mdctx, &magic, sizeof(magic));
+	r = EVP_DigestVerifyUpdate(mdctx, magic, sizeof(*magic));
 	if (r != 1) {
 		ERROR(db->ctx, "%s\n", ERR_error_string(ERR_get_error(), NULL));
 		r = 1;
@@ -591,13 +1020,10 @@ LOC_EXPORT int loc_database_verify(struct loc_database* db, FILE* f) {
 
 	switch (db->version) {
 		case LOC_DATABASE_VERSION_1:
-			bytes_read = fread(&header_v1, 1, sizeof(header_v1), db->f);
-			if (bytes_read < sizeof(header_v1)) {
-				ERROR(db->ctx, "Could not read header\n");
-				r = 1;
-
-				goto CLEANUP;
-			}
+		case LOC_DATABASE_VERSION_2:
+			// The header has been checked when the database was opened
+			memcpy(&header_v1, db->data + sizeof(*magic), sizeof(header_v1));
+			offset = sizeof(*magic) + sizeof(header_v1);
 
 			// Clear signatures
 			memset(header_v1.signature1, '\0', sizeof(header_v1.signature1));
@@ -624,22 +1050,14 @@ LOC_EXPORT int loc_database_verify(struct loc_database* db, FILE* f) {
 			goto CLEANUP;
 	}
 
-	// Walk through the file in chunks of 64kB
-	char buffer[64 * 1024];
-
-	while (!feof(db->f)) {
-		bytes_read = fread(buffer, 1, sizeof(buffer), db->f);
+	// Feed the rest of the database into the hash
+	r = EVP_DigestVerifyUpdate(mdctx, db->data + offset, db->length - offset);
+	if (r != 1) {
+		ERROR(db->ctx, "%s\n", ERR_error_string(ERR_get_error(), NULL));
+		r = 1;
 
-		hexdump(db->ctx, buffer, bytes_read);
-
-		r = EVP_DigestVerifyUpdate(mdctx, buffer, bytes_read);
-		if (r != 1) {
-			ERROR(db->ctx, "%s\n", ERR_error_string(ERR_get_error(), NULL));
-			r = 1;
-
-			goto CLEANUP;
-		}
-	}
+		goto CLEANUP;
+	}
 
 	// Check first signature
 	if (db->signature1.data) {
@@ -727,6 +1145,7 @@ static int loc_database_fetch_as(struct loc_database* db, struct loc_as** as, of
 
 	switch (db->version) {
 		case LOC_DATABASE_VERSION_1:
+		case LOC_DATABASE_VERSION_2:
 			// Find the object
 			as_v1 = (struct loc_database_as_v1*)loc_database_object(db,
 				&db->as_objects, sizeof(*as_v1), pos);
@@ -747,52 +1166,179 @@ static int loc_database_fetch_as(struct loc_database* db, struct loc_as** as, of
 	return r;
 }
 
-// Performs a binary search to find the AS in the list
-LOC_EXPORT int loc_database_get_as(struct loc_database* db, struct loc_as** as, uint32_t number) {
-	off_t lo = 0;
-	off_t hi = db->as_objects.count - 1;
+static inline size_t loc_database_as_index_hash(struct loc_database* db, uint32_t number) {
+	return (((uint64_t)number * 0x9e3779b97f4a7c15ULL) >> 32) & db->as_index_mask;
+}
+
+/*
+	Builds a hash table that maps all AS numbers to their position
+*/
+static int loc_database_build_as_index(struct loc_database* db) {
+	const struct loc_database_as_v1* as_v1 = NULL;
+	size_t size = 1;
 
-#ifdef ENABLE_DEBUG
-	// Save start time
 	clock_t start = clock();
-#endif
 
+	if (db->as_objects.count >= UINT32_MAX) {
+		errno = ERANGE;
+		return 1;
+	}
+
+	// Keep the table at most half full
+	while (size < db->as_objects.count * 2)
+		size <<= 1;
+
+	db->as_index = calloc(size, sizeof(*db->as_index));
+	if (!db->as_index)
+		return 1;
+
+	db->as_index_mask = size - 1;
+
+	for (size_t pos = 0; pos < db->as_objects.count; pos++) {
+		as_v1 = (const struct loc_database_as_v1*)loc_database_object(db,
+			&db->as_objects, sizeof(*as_v1), pos);
+		if (!as_v1)
+			return 1;
+
+		const uint32_t number = be32toh(as_v1->number);
+
+		size_t i = loc_database_as_index_hash(db, number);
+
+		// Find the next free entry (keeping the first AS if there are duplicates)
+		while (db->as_index[i].pos && db->as_index[i].number != number)
+			i = (i + 1) & db->as_index_mask;
+
+		if (!db->as_index[i].pos) {
+			db->as_index[i].number = number;
+			db->as_index[i].pos = pos + 1;
+		}
+	}
+
+	clock_t end = clock();
+
+	DEBUG(db->ctx, "Built AS index with %zu entries in %.4fms\n", size,
+		(double)(end - start) / CLOCKS_PER_SEC * 1000);
+
+	return 0;
+}
+
+/*
+	Finds the position of an AS without creating any objects
+
+	Returns 0 if the AS was found, otherwise 1.
+*/
+static int loc_database_find_as(struct loc_database* db, uint32_t number, off_t* pos) {
+	const struct loc_database_as_v1* as_v1 = NULL;
+
+	// Use the index if we have one
+	if (db->as_index) {
+		for (size_t i = loc_database_as_index_hash(db, number); db->as_index[i].pos;
+				i = (i + 1) & db->as_index_mask) {
+			if (db->as_index[i].number == number) {
+				*pos = db->as_index[i].pos - 1;
+				return 0;
+			}
+		}
+
+		return 1;
+	}
+
+	off_t lo = 0;
+	off_t hi = db->as_objects.count - 1;
+
+	// Otherwise perform a binary search and compare the numbers in place
 	while (lo <= hi) {
 		off_t i = (lo + hi) / 2;
 
-		// Fetch AS in the middle between lo and hi
-		int r = loc_database_fetch_as(db, as, i);
-		if (r)
-			return r;
+		as_v1 = (const struct loc_database_as_v1*)loc_database_object(db,
+			&db->as_objects, sizeof(*as_v1), i);
+		if (!as_v1)
+			return 1;
+
+		const uint32_t as_number = be32toh(as_v1->number);
 
 		// Check if this is a match
-		uint32_t as_number = loc_as_get_number(*as);
 		if (as_number == number) {
-#ifdef ENABLE_DEBUG
-			clock_t end = clock();
-
-			// Log how fast this has been
-			DEBUG(db->ctx, "Found AS%u in %.4fms\n", as_number,
-				(double)(end - start) / CLOCKS_PER_SEC * 1000);
-#endif
-
+			*pos = i;
 			return 0;
 		}
 
-		// If it wasn't, we release the AS and
-		// adjust our search pointers
-		loc_as_unref(*as);
-
-		if (as_number < number) {
+		if (as_number < number)
 			lo = i + 1;
-		} else
+		else
 			hi = i - 1;
 	}
 
+	return 1;
+}
+
+LOC_EXPORT int loc_database_get_as(struct loc_database* db, struct loc_as** as, uint32_t number) {
+	off_t pos = 0;
+	int r;
+
 	// Nothing found
 	*as = NULL;
 
-	return 1;
+#ifdef ENABLE_DEBUG
+	// Save start time
+	clock_t start = clock();
+#endif
+
+	r = loc_database_find_as(db, number, &pos);
+	if (r)
+		return r;
+
+	// Only fetch the AS that we have found
+	r = loc_database_fetch_as(db, as, pos);
+	if (r)
+		return r;
+
+#ifdef ENABLE_DEBUG
+	clock_t end = clock();
+
+	// Log how fast this has been
+	DEBUG(db->ctx, "Found AS%u in %.4fms\n", number,
+		(double)(end - start) / CLOCKS_PER_SEC * 1000);
+#endif
+
+	return 0;
+}
+
+/*
+	Works like loc_database_get_as() but does not allocate anything.
+	The name points into the database.
+*/
+LOC_EXPORT int loc_database_get_as_view(struct loc_database* db,
+		uint32_t number, struct loc_database_as_view* view) {
+	const struct loc_database_as_v1* as_v1 = NULL;
+	off_t pos = 0;
+	int r;
+
+	r = loc_database_find_as(db, number, &pos);
+	if (r)
+		return r;
+
+	switch (db->version) {
+		case LOC_DATABASE_VERSION_1:
+		case LOC_DATABASE_VERSION_2:
+			as_v1 = (const struct loc_database_as_v1*)loc_database_object(db,
+				&db->as_objects, sizeof(*as_v1), pos);
+			if (!as_v1)
+				return 1;
+
+			view->number = be32toh(as_v1->number);
+
+			view->name = loc_stringpool_get(db->pool, be32toh(as_v1->name));
+			if (!view->name)
+				return 1;
+			break;
+
+		default:
+			errno = ENOTSUP;
+			return 1;
+	}
+
+	return 0;
 }
 
 // Returns the network at position pos
@@ -812,6 +1358,7 @@ static int loc_database_fetch_network(struct loc_database* db, struct loc_networ
 
 	switch (db->version) {
 		case LOC_DATABASE_VERSION_1:
+		case LOC_DATABASE_VERSION_2:
 			// Read the object
 			network_v1 = (struct loc_database_network_v1*)loc_database_object(db,
 				&db->network_objects, sizeof(*network_v1), pos);
@@ -832,222 +1379,1551 @@ static int loc_database_fetch_network(struct loc_database* db, struct loc_networ
 	return r;
 }
 
-static int __loc_database_node_is_leaf(const struct loc_database_network_node_v1* node) {
-	return (node->network != htobe32(0xffffffff));
-}
+/*
+	A node of the network tree in host byte order
+*/
+struct loc_database_node {
+	uint32_t zero;
+	uint32_t one;
+	uint32_t network;
+
+	// Any bits that have been skipped before this node
+	uint32_t bits;
+	unsigned int skip;
+};
 
-static int __loc_database_lookup_handle_leaf(struct loc_database* db, const struct in6_addr* address,
-		struct loc_network** network, struct in6_addr* network_address, unsigned int prefix,
-		const struct loc_database_network_node_v1* node) {
-	off_t network_index = be32toh(node->network);
+/*
+	Reads the node at index from any version of the network tree
 
-	DEBUG(db->ctx, "Handling leaf node at %jd\n", (intmax_t)network_index);
+	Unless access is LOC_DATABASE_NODE_CHECKED, the node is read without
+	checking anything which is only safe after the database has been validated
+	or the tree has been copied.
+*/
+static inline int __loc_database_read_node(struct loc_database* db,
+		off_t index, struct loc_database_node* node, const enum loc_database_node_access access) {
+	const struct loc_database_network_node_v1* node_v1 = NULL;
+	const struct loc_database_network_node_v2* node_v2 = NULL;
+	const struct loc_database_tree_node* tree_node = NULL;
+	const int checked = (access == LOC_DATABASE_NODE_CHECKED);
 
-	// Fetch the network
-	int r = loc_database_fetch_network(db, network, network_address, prefix, network_index);
-	if (r) {
-		ERROR(db->ctx, "Could not fetch network %jd from database: %m\n",
-			(intmax_t)network_index);
-		return r;
+	// The copy looks the same for all versions
+	if (access == LOC_DATABASE_NODE_COPY) {
+		tree_node = &db->tree[index];
+
+		const uint32_t network = tree_node->network & LOC_DATABASE_TREE_NODE_NO_NETWORK;
+
+		node->zero    = tree_node->zero;
+		node->one     = tree_node->one;
+		node->network = (network == LOC_DATABASE_TREE_NODE_NO_NETWORK) ? 0xffffffff : network;
+		node->bits    = tree_node->bits;
+		node->skip    = tree_node->network >> LOC_DATABASE_TREE_NODE_NETWORK_BITS;
+
+		return 0;
 	}
 
-	// Check if the given IP address is inside the network
-	if (!loc_network_matches_address(*network, address)) {
-		DEBUG(db->ctx, "Searched address is not part of the network\n");
+	switch (db->version) {
+		case LOC_DATABASE_VERSION_1:
+			if (checked)
+				node_v1 = (const struct loc_database_network_node_v1*)loc_database_object(db,
+					&db->network_node_objects, sizeof(*node_v1), index);
+			else
+				node_v1 = (const struct loc_database_network_node_v1*)
+					db->network_node_objects.data + index;
+			if (!node_v1)
+				return -1;
+
+			node->zero    = be32toh(node_v1->zero);
+			node->one     = be32toh(node_v1->one);
+			node->network = be32toh(node_v1->network);
+			node->bits    = 0;
+			node->skip    = 0;
+			break;
+
+		case LOC_DATABASE_VERSION_2:
+			if (checked)
+				node_v2 = (const struct loc_database_network_node_v2*)loc_database_object(db,
+					&db->network_node_objects, sizeof(*node_v2), index);
+			else
+				node_v2 = (const struct loc_database_network_node_v2*)
+					db->network_node_objects.data + index;
+			if (!node_v2)
+				return -1;
+
+			node->zero    = be32toh(node_v2->zero);
+			node->one     = be32toh(node_v2->one);
+			node->network = be32toh(node_v2->network);
+			node->bits    = be32toh(node_v2->bits);
+			node->skip    = node_v2->skip;
+
+			// Check if we can handle this many bits
+			if (checked && node->skip > LOC_DATABASE_NODE_V2_MAX_SKIP) {
+				errno = EBADMSG;
+				return -1;
+			}
+			break;
 
-		loc_network_unref(*network);
-		*network = NULL;
-		return 1;
+		default:
+			errno = ENOTSUP;
+			return -1;
 	}
 
-	// A network was found and the IP address matches
 	return 0;
 }
 
-// Searches for an exact match along the path
-static int __loc_database_lookup(struct loc_database* db, const struct in6_addr* address,
-		struct loc_network** network, struct in6_addr* network_address,
-		off_t node_index, unsigned int level) {
-	struct loc_database_network_node_v1* node_v1 = NULL;
+static inline int loc_database_read_node(struct loc_database* db,
+		off_t index, struct loc_database_node* node) {
+	if (db->tree)
+		return __loc_database_read_node(db, index, node, LOC_DATABASE_NODE_COPY);
 
-	int r;
+	return __loc_database_read_node(db, index, node, LOC_DATABASE_NODE_CHECKED);
+}
+
+static inline int __loc_database_node_is_leaf(const struct loc_database_node* node) {
+	return (node->network != 0xffffffff);
+}
+
+size_t loc_database_count_networks(struct loc_database* db) {
+	return db->network_objects.count;
+}
 
-	// Fetch the next node
-	node_v1 = (struct loc_database_network_node_v1*)loc_database_object(db,
-		&db->network_node_objects, sizeof(*node_v1), node_index);
-	if (!node_v1)
+/*
+	These functions allow to walk through the network tree one bit at a time,
+	regardless of how it has been stored in the database.
+*/
+int loc_database_tree_root(struct loc_database* db, struct loc_database_tree_position* position) {
+	// The tree is empty
+	if (!db->network_node_objects.count)
 		return 1;
 
-	// Follow the path
-	int bit = loc_address_get_bit(address, level);
-	loc_address_set_bit(network_address, level, bit);
+	position->node = 0;
+	position->offset = 0;
 
-	if (bit == 0)
-		node_index = be32toh(node_v1->zero);
-	else
-		node_index = be32toh(node_v1->one);
+	return 0;
+}
 
-	// If the node index is zero, the tree ends here
-	// and we cannot descend any further
-	if (node_index > 0) {
-		// Check boundaries
-		if ((size_t)node_index >= db->network_node_objects.count) {
-			errno = ERANGE;
-			return 1;
-		}
+/*
+	Moves to the child of position that is reached by bit.
 
-		// Move on to the next node
-		r = __loc_database_lookup(db, address, network, network_address, node_index, level + 1);
+	Returns 0 on success, 1 if there is no such child and -1 on error.
+*/
+int loc_database_tree_child(struct loc_database* db,
+		const struct loc_database_tree_position* position, int bit,
+		struct loc_database_tree_position* child) {
+	struct loc_database_node node;
+	int r;
 
-		// End here if a result was found
-		if (r == 0)
-			return r;
+	r = loc_database_read_node(db, position->node, &node);
+	if (r)
+		return r;
 
-		// Raise any errors
-		else if (r < 0)
-			return r;
+	// We are still on the path to the node
+	if (position->offset < node.skip) {
+		if (((node.bits >> (31 - position->offset)) & 1) != !!bit)
+			return 1;
 
-		DEBUG(db->ctx, "No match found below level %u\n", level);
-	} else {
-		DEBUG(db->ctx, "Tree ended at level %u\n", level);
-	}
+		child->node = position->node;
+		child->offset = position->offset + 1;
 
-	// If this node has a leaf, we will check if it matches
-	if (__loc_database_node_is_leaf(node_v1)) {
-		r = __loc_database_lookup_handle_leaf(db, address, network, network_address, level, node_v1);
-		if (r <= 0)
-			return r;
+		return 0;
 	}
 
-	return 1;
-}
+	child->node = (bit) ? node.one : node.zero;
+	child->offset = 0;
 
-LOC_EXPORT int loc_database_lookup(struct loc_database* db,
-		const struct in6_addr* address, struct loc_network** network) {
-	struct in6_addr network_address;
-	memset(&network_address, 0, sizeof(network_address));
+	// The tree ends here
+	if (!child->node)
+		return 1;
 
-	*network = NULL;
+	// Check boundaries
+	if (child->node >= db->network_node_objects.count) {
+		errno = ERANGE;
+		return -1;
+	}
 
-#ifdef ENABLE_DEBUG
-	// Save start time
-	clock_t start = clock();
-#endif
+	return 0;
+}
 
-	int r = __loc_database_lookup(db, address, network, &network_address, 0, 0);
+/*
+	Returns 0 and the index of the network if there is one at position, otherwise 1.
+*/
+int loc_database_tree_network(struct loc_database* db,
+		const struct loc_database_tree_position* position, uint32_t* network) {
+	struct loc_database_node node;
+	int r;
 
-#ifdef ENABLE_DEBUG
-	clock_t end = clock();
+	r = loc_database_read_node(db, position->node, &node);
+	if (r)
+		return r;
 
-	// Log how fast this has been
-	DEBUG(db->ctx, "Executed network search in %.4fms\n",
-		(double)(end - start) / CLOCKS_PER_SEC * 1000);
-#endif
+	if (position->offset < node.skip || !__loc_database_node_is_leaf(&node))
+		return 1;
 
-	return r;
+	*network = node.network;
+
+	return 0;
 }
 
-LOC_EXPORT int loc_database_lookup_from_string(struct loc_database* db,
-		const char* string, struct loc_network** network) {
-	struct in6_addr address;
+int loc_database_tree_has_children(struct loc_database* db,
+		const struct loc_database_tree_position* position) {
+	struct loc_database_node node;
+	int r;
 
-	int r = loc_address_parse(&address, NULL, string);
+	r = loc_database_read_node(db, position->node, &node);
 	if (r)
 		return r;
 
-	return loc_database_lookup(db, &address, network);
+	if (position->offset < node.skip)
+		return 1;
+
+	return (node.zero || node.one);
 }
 
-// Returns the country at position pos
-static int loc_database_fetch_country(struct loc_database* db,
-		struct loc_country** country, off_t pos) {
-	struct loc_database_country_v1* country_v1 = NULL;
-	int r;
+/*
+	Checks that the string at offset is entirely inside the string pool
+*/
+static int loc_database_validate_string(struct loc_database* db, off_t offset) {
+	const size_t length = loc_stringpool_get_size(db->pool);
 
-	// Check if the country is within range
-	if ((size_t)pos >= db->country_objects.count) {
-		errno = ERANGE;
+	const char* string = loc_stringpool_get(db->pool, offset);
+	if (!string)
+		return 1;
+
+	// The string must be terminated before the end of the pool
+	if (!memchr(string, '\0', length - offset)) {
+		errno = EBADMSG;
 		return 1;
 	}
 
-	DEBUG(db->ctx, "Fetching country at position %jd\n", (intmax_t)pos);
+	return 0;
+}
 
-	switch (db->version) {
-		case LOC_DATABASE_VERSION_1:
-			// Read the object
-			country_v1 = (struct loc_database_country_v1*)loc_database_object(db,
-				&db->country_objects, sizeof(*country_v1), pos);
-			if (!country_v1)
-				return 1;
+/*
+	Checks that every node of the network tree can only be reached once,
+	that all children and networks exist and that no path is longer than 128 bits
+*/
+static int loc_database_validate_tree(struct loc_database* db) {
+	const size_t count = db->network_node_objects.count;
+	struct loc_database_node node;
+	int r = 1;
 
-			r = loc_country_new_from_database_v1(db->ctx, db->pool, country, country_v1);
-			break;
+	struct loc_database_validate_position {
+		uint32_t node;
+		unsigned int level;
+	} stack[2 * 129];
+	unsigned int depth = 0;
 
-		default:
-			errno = ENOTSUP;
-			return 1;
-	}
+	// Remember all nodes that we have seen
+	uint8_t* visited = calloc((count + 7) / 8, 1);
+	if (!visited)
+		return 1;
 
-	if (r == 0)
-		DEBUG(db->ctx, "Got country %s\n", loc_country_get_code(*country));
+	// Start at the root
+	stack[depth++] = (struct loc_database_validate_position){ 0, 0 };
 
-	return r;
-}
+	while (depth) {
+		struct loc_database_validate_position position = stack[--depth];
 
-// Performs a binary search to find the country in the list
-LOC_EXPORT int loc_database_get_country(struct loc_database* db,
-		struct loc_country** country, const char* code) {
-	off_t lo = 0;
-	off_t hi = db->country_objects.count - 1;
+		// Fail if we have been here before
+		if (visited[position.node / 8] & (1 << (position.node % 8))) {
+			ERROR(db->ctx, "Network node %u can be reached more than once\n", position.node);
+			errno = EBADMSG;
+			goto ERROR;
+		}
 
-	// Check if the country code is valid
-	if (!loc_country_code_is_valid(code)) {
-		errno = EINVAL;
-		return 1;
-	}
+		visited[position.node / 8] |= (1 << (position.node % 8));
 
-#ifdef ENABLE_DEBUG
-	// Save start time
+		if (loc_database_read_node(db, position.node, &node))
+			goto ERROR;
+
+		position.level += node.skip;
+
+		if (position.level > 128) {
+			ERROR(db->ctx, "Network node %u is too deep\n", position.node);
+			errno = EBADMSG;
+			goto ERROR;
+		}
+
+		if (__loc_database_node_is_leaf(&node) && node.network >= db->network_objects.count) {
+			ERROR(db->ctx, "Network node %u points to a non-existent network\n", position.node);
+			errno = EBADMSG;
+			goto ERROR;
+		}
+
+		if (!node.zero && !node.one)
+			continue;
+
+		if (position.level == 128 || depth + 2 > sizeof(stack) / sizeof(*stack)) {
+			ERROR(db->ctx, "Network node %u is too deep\n", position.node);
+			errno = EBADMSG;
+			goto ERROR;
+		}
+
+		const uint32_t children[] = { node.one, node.zero };
+
+		for (unsigned int i = 0; i < 2; i++) {
+			if (!children[i])
+				continue;
+
+			if (children[i] >= count) {
+				ERROR(db->ctx, "Network node %u points to a non-existent node\n", position.node);
+				errno = EBADMSG;
+				goto ERROR;
+			}
+
+			stack[depth++] = (struct loc_database_validate_position){
+				children[i], position.level + 1 };
+		}
+	}
+
+	r = 0;
+
+ERROR:
+	free(visited);
+
+	return r;
+}
+
+/*
+	Validates the structure of the entire database once.
+
+	After this has passed, lookups can walk the tree without checking anything.
+*/
+static int loc_database_validate(struct loc_database* db) {
+	const struct loc_database_as_v1* as_v1 = NULL;
+	const struct loc_database_country_v1* country_v1 = NULL;
+	int r;
+
+	clock_t start = clock();
+
+	// Check meta data (if there are any strings at all)
+	if (loc_stringpool_get_size(db->pool)) {
+		if (loc_database_validate_string(db, db->vendor)
+				|| loc_database_validate_string(db, db->description)
+				|| loc_database_validate_string(db, db->license)) {
+			ERROR(db->ctx, "Invalid meta data\n");
+			goto ERROR;
+		}
+	}
+
+	// Check the names of all ASes
+	for (unsigned int i = 0; i < db->as_objects.count; i++) {
+		as_v1 = (const struct loc_database_as_v1*)loc_database_object(db,
+			&db->as_objects, sizeof(*as_v1), i);
+		if (!as_v1)
+			goto ERROR;
+
+		if (loc_database_validate_string(db, be32toh(as_v1->name))) {
+			ERROR(db->ctx, "Invalid name of AS%u\n", be32toh(as_v1->number));
+			goto ERROR;
+		}
+	}
+
+	// Check the names of all countries
+	for (unsigned int i = 0; i < db->country_objects.count; i++) {
+		country_v1 = (const struct loc_database_country_v1*)loc_database_object(db,
+			&db->country_objects, sizeof(*country_v1), i);
+		if (!country_v1)
+			goto ERROR;
+
+		if (loc_database_validate_string(db, be32toh(country_v1->name))) {
+			ERROR(db->ctx, "Invalid name of country %u\n", i);
+			goto ERROR;
+		}
+	}
+
+	// Check the network tree (an empty tree will be checked on every lookup)
+	if (db->network_node_objects.count) {
+		r = loc_database_validate_tree(db);
+		if (r)
+			goto ERROR;
+
+		db->validated = 1;
+	}
+
+	clock_t end = clock();
+
+	INFO(db->ctx, "Validated database in %.4fms\n",
+		(double)(end - start) / CLOCKS_PER_SEC * 1000);
+
+	return 0;
+
+ERROR:
+	ERROR(db->ctx, "Database validation failed: %m\n");
+
+	// Always report invalid data
+	if (errno != ENOMEM)
+		errno = EBADMSG;
+
+	return 1;
+}
+
+/*
+	Allocates memory for the copy of the tree which is aligned to cache lines
+
+	If requested, it will be backed by huge pages so that walking the tree does not
+	miss the TLB all the time. If none have been reserved, we fall back to transparent
+	huge pages.
+*/
+static struct loc_database_tree_node* loc_database_alloc_tree(
+		struct loc_database* db, size_t length) {
+	void* tree = NULL;
+	int r;
+
+	if (!(db->flags & LOC_DB_FLAGS_HUGEPAGES)) {
+		r = posix_memalign(&tree, 64, length);
+		if (r) {
+			errno = r;
+			return NULL;
+		}
+
+		return tree;
+	}
+
+	// Round up to entire huge pages
+	length = (length + LOC_DATABASE_HUGE_PAGE_SIZE - 1) & ~(LOC_DATABASE_HUGE_PAGE_SIZE - 1);
+
+#ifdef MAP_HUGETLB
+	tree = mmap(NULL, length, PROT_READ|PROT_WRITE,
+		MAP_PRIVATE|MAP_ANONYMOUS|MAP_HUGETLB, -1, 0);
+	if (tree != MAP_FAILED) {
+		db->tree_mapped = length;
+		return tree;
+	}
+
+	DEBUG(db->ctx, "Could not allocate huge pages: %m\n");
+#endif
+
+	r = posix_memalign(&tree, LOC_DATABASE_HUGE_PAGE_SIZE, length);
+	if (r) {
+		errno = r;
+		return NULL;
+	}
+
+#ifdef MADV_HUGEPAGE
+	// Transparent huge pages might be disabled which is fine
+	r = madvise(tree, length, MADV_HUGEPAGE);
+	if (r)
+		DEBUG(db->ctx, "Could not use transparent huge pages: %m\n");
+#endif
+
+	return tree;
+}
+
+static void loc_database_free_tree(struct loc_database* db, struct loc_database_tree_node* tree) {
+	if (db->tree_mapped)
+		munmap(tree, db->tree_mapped);
+	else
+		free(tree);
+
+	db->tree_mapped = 0;
+}
+
+/*
+	Copies the network tree into memory so that lookups do not have to convert
+	anything and do not have to check any boundaries.
+*/
+static int loc_database_copy_tree(struct loc_database* db) {
+	const size_t count = db->network_node_objects.count;
+	struct loc_database_tree_node* tree = NULL;
+	struct loc_database_node node;
+	int r;
+
+	clock_t start = clock();
+
+	// Nothing to do for an empty tree
+	if (!count)
+		return 0;
+
+	// Fall back to the mapped tree if the network index does not fit
+	if (db->network_objects.count >= LOC_DATABASE_TREE_NODE_NO_NETWORK) {
+		INFO(db->ctx, "Too many networks to copy the network tree\n");
+		return 0;
+	}
+
+	tree = loc_database_alloc_tree(db, count * sizeof(*tree));
+	if (!tree)
+		return 1;
+
+	for (size_t i = 0; i < count; i++) {
+		r = loc_database_read_node(db, i, &node);
+		if (r)
+			goto ERROR;
+
+		// Check if all children exist so that we won't have to check this later
+		if (node.zero >= count || node.one >= count) {
+			ERROR(db->ctx, "Network node %zu points to a non-existent node\n", i);
+			errno = EBADMSG;
+			goto ERROR;
+		}
+
+		if (__loc_database_node_is_leaf(&node) && node.network >= db->network_objects.count) {
+			ERROR(db->ctx, "Network node %zu points to a non-existent network\n", i);
+			errno = EBADMSG;
+			goto ERROR;
+		}
+
+		tree[i].zero    = node.zero;
+		tree[i].one     = node.one;
+		tree[i].bits    = node.bits;
+		tree[i].network = (node.skip << LOC_DATABASE_TREE_NODE_NETWORK_BITS)
+			| (__loc_database_node_is_leaf(&node) ? node.network : LOC_DATABASE_TREE_NODE_NO_NETWORK);
+	}
+
+	db->tree = tree;
+
+	clock_t end = clock();
+
+	INFO(db->ctx, "Copied network tree with %zu node(s) (%zu bytes%s) in %.4fms\n",
+		count, count * sizeof(*tree), (db->tree_mapped) ? " in huge pages" : "",
+		(double)(end - start) / CLOCKS_PER_SEC * 1000);
+
+	return 0;
+
+ERROR:
+	loc_database_free_tree(db, tree);
+
+	return 1;
+}
+
+// Returns a pointer to the network at position pos
+static int loc_database_fetch_network_v1(struct loc_database* db,
+		off_t pos, const struct loc_database_network_v1** network_v1) {
+	if ((size_t)pos >= db->network_objects.count) {
+		DEBUG(db->ctx, "Network ID out of range: %jd/%jd\n",
+			(intmax_t)pos, (intmax_t)db->network_objects.count);
+		errno = ERANGE;
+		return -1;
+	}
+
+	switch (db->version) {
+		case LOC_DATABASE_VERSION_1:
+		case LOC_DATABASE_VERSION_2:
+			*network_v1 = (const struct loc_database_network_v1*)loc_database_object(db,
+				&db->network_objects, sizeof(**network_v1), pos);
+			if (!*network_v1)
+				return -1;
+			break;
+
+		default:
+			errno = ENOTSUP;
+			return -1;
+	}
+
+	return 0;
+}
+
+/*
+	Fills the result with everything we know about the network at position pos
+*/
+static int loc_database_fetch_result(struct loc_database* db, const struct in6_addr* address,
+		unsigned int prefix, off_t pos, struct loc_database_lookup_result* result) {
+	const struct loc_database_network_v1* network_v1 = NULL;
+	int r;
+
+	r = loc_database_fetch_network_v1(db, pos, &network_v1);
+	if (r)
+		return r;
+
+	// Compute the first and last address of the network
+	const struct in6_addr bitmask = loc_prefix_to_bitmask(prefix);
+
+	result->first_address = loc_address_and(address, &bitmask);
+	result->last_address  = loc_address_or(&result->first_address, &bitmask);
+
+	// Store family and prefix
+	result->family = loc_address_family(&result->first_address);
+
+	if (result->family == AF_INET)
+		result->prefix = prefix - 96;
+	else
+		result->prefix = prefix;
+
+	// Copy the country code
+	loc_country_code_copy(result->country_code, network_v1->country_code);
+	result->country_code[2] = '\0';
+
+	// Copy ASN & flags
+	result->asn   = be32toh(network_v1->asn);
+	result->flags = be16toh(network_v1->flags);
+
+	result->network_index = pos;
+
+	return 0;
+}
+
+/*
+	A subtree next to the path of a lookup
+*/
+struct loc_database_lookup_branch {
+	// The first node of the subtree (or -1 if there is none)
+	off_t node_index;
+
+	// The level at which the subtree starts
+	unsigned int level;
+
+	// The bit at which the subtree leaves the path of the address
+	unsigned int bit;
+};
+
+/*
+	State of a single lookup while it is walking down the tree
+*/
+struct loc_database_lookup_state {
+	const struct in6_addr* address;
+
+	// The node we are looking at and its level
+	off_t node_index;
+	unsigned int level;
+
+	// The most specific network that we have found so far
+	off_t network_index;
+	unsigned int prefix;
+
+	// Set to 0 as soon as a network has been found
+	int r;
+
+	// The number of leading bits that all addresses with the same path share
+	unsigned int end;
+
+	// The closest subtrees on either side of the path
+	struct loc_database_lookup_branch left;
+	struct loc_database_lookup_branch right;
+};
+
+static inline void loc_database_lookup_branch_set(struct loc_database_lookup_branch* branch,
+		off_t node_index, unsigned int level, unsigned int bit) {
+	branch->node_index = node_index;
+	branch->level = level;
+	branch->bit = bit;
+}
+
+static inline void loc_database_lookup_state_init(
+		struct loc_database_lookup_state* state, const struct in6_addr* address) {
+	state->address = address;
+	state->node_index = 0;
+	state->level = 0;
+	state->network_index = 0;
+	state->prefix = 0;
+	state->r = 1;
+	state->end = 128;
+	state->left.node_index = -1;
+	state->right.node_index = -1;
+}
+
+/*
+	Tells the CPU that we are going to read the node soon
+*/
+static inline void loc_database_prefetch_node(struct loc_database* db, off_t node_index) {
+	if (db->tree)
+		__builtin_prefetch(&db->tree[node_index]);
+	else
+		__builtin_prefetch(db->network_node_objects.data
+			+ node_index * loc_database_node_size(db));
+}
+
+/*
+	Returns true if the node is a pushed copy of the network that the lookup has found
+*/
+static inline int loc_database_lookup_is_pushed(struct loc_database* db,
+		const struct loc_database_lookup_state* state, off_t node_index,
+		const enum loc_database_node_access access) {
+	struct loc_database_node node;
+
+	if (!(db->header_flags & LOC_DATABASE_HEADER_FLAG_LEAF_PUSHED) || state->r)
+		return 0;
+
+	// Any errors will be found when the subtree is being searched
+	if (__loc_database_read_node(db, node_index, &node, access))
+		return 0;
+
+	return (node.network == state->network_index && !node.zero && !node.one);
+}
+
+/*
+	Looks at the current node, remembers any network on it and moves
+	on to the next node along the path of the address.
+
+	If branches is set, the closest subtrees next to the path are being remembered.
+
+	Returns 1 if the walk has to continue, 0 if it has ended and -1 on error.
+*/
+static inline int __loc_database_lookup_step(struct loc_database* db,
+		struct loc_database_lookup_state* state, const int branches,
+		const enum loc_database_node_access access) {
+	struct loc_database_node node;
+	unsigned int bit;
+	int r;
+
+	// Fetch the node
+	r = __loc_database_read_node(db, state->node_index, &node, access);
+	if (r)
+		return r;
+
+	// The address must match all bits that have been skipped to get here
+	if (node.skip) {
+		if (state->level + node.skip > 128)
+			return 0;
+
+		const uint32_t bits = loc_address_get_bits(state->address, state->level, node.skip);
+
+		if (bits != node.bits) {
+			const unsigned int diverge = state->level + __builtin_clz(bits ^ node.bits);
+
+			// The entire subtree is either left or right of the address
+			if (branches)
+				loc_database_lookup_branch_set((bits > node.bits) ? &state->left : &state->right,
+					state->node_index, state->level, diverge);
+
+			state->end = diverge + 1;
+
+			return 0;
+		}
+
+		state->level += node.skip;
+	}
+
+	// Remember the most specific network on the path
+	// (leaf-pushed trees repeat it further down which must not change the prefix)
+	if (__loc_database_node_is_leaf(&node)
+			&& (state->r || node.network != state->network_index)) {
+		state->network_index = node.network;
+		state->prefix = state->level;
+		state->r = 0;
+	}
+
+	// We cannot descend any further than the length of the address
+	if (state->level == 128)
+		return 0;
+
+	// All addresses that reach a node without children have the same result
+	if (!node.zero && !node.one) {
+		state->end = state->level;
+		return 0;
+	}
+
+	// Follow the path
+	bit = loc_address_get_bit(state->address, state->level);
+
+	// Remember the subtree on the other side
+	if (branches) {
+		const off_t other = (bit) ? node.zero : node.one;
+
+		if (other && !loc_database_lookup_is_pushed(db, state, other, access))
+			loc_database_lookup_branch_set((bit) ? &state->left : &state->right,
+				other, state->level + 1, state->level);
+	}
+
+	state->node_index = (bit) ? node.one : node.zero;
+
+	// If the node index is zero, the tree ends here
+	// and we cannot descend any further
+	if (!state->node_index) {
+		DEBUG(db->ctx, "Tree ended at level %u\n", state->level);
+
+		state->end = state->level + 1;
+		return 0;
+	}
+
+	// Check boundaries
+	if (access == LOC_DATABASE_NODE_CHECKED
+			&& (size_t)state->node_index >= db->network_node_objects.count) {
+		errno = ERANGE;
+		return -1;
+	}
+
+	state->level++;
+
+	return 1;
+}
+
+/*
+	Finds the first (or last) address that is covered by any network in the subtree
+
+	In leaf-pushed trees, the subtree might contain copies of the network that
+	the lookup has found (pushed), which are being skipped.
+*/
+static int loc_database_lookup_branch_edge(struct loc_database* db,
+		const struct loc_database_lookup_branch* branch, const struct in6_addr* address,
+		int last, off_t pushed, struct in6_addr* edge) {
+	struct loc_database_node node;
+	off_t node_index = branch->node_index;
+	unsigned int level = branch->level;
+	int bit;
+	int r;
+
+	// The inner children that we have passed on the way down
+	struct {
+		off_t node_index;
+		unsigned int level;
+	} stack[128];
+	unsigned int depth = 0;
+
+	// Follow the subtree instead of the address
+	*edge = *address;
+	loc_address_set_bit(edge, branch->bit, !loc_address_get_bit(address, branch->bit));
+
+	for (;;) {
+		r = loc_database_read_node(db, node_index, &node);
+		if (r)
+			return r;
+
+		if (level + node.skip > 128) {
+			errno = EBADMSG;
+			return -1;
+		}
+
+		// Apply all skipped bits
+		for (unsigned int i = 0; i < node.skip; i++)
+			loc_address_set_bit(edge, level + i, (node.bits >> (31 - i)) & 1);
+
+		level += node.skip;
+
+		if (__loc_database_node_is_leaf(&node)) {
+			// The first network that we find covers everything below it
+			if (node.network != pushed)
+				break;
+
+			// Go back to the closest inner child if this was a copy
+			if (!node.zero && !node.one) {
+				// Every subtree must end in a network
+				if (!depth) {
+					errno = EBADMSG;
+					return -1;
+				}
+
+				depth--;
+
+				node_index = stack[depth].node_index;
+				level = stack[depth].level;
+
+				loc_address_set_bit(edge, level++, !last);
+				continue;
+			}
+		}
+
+		// Otherwise follow the outermost child
+		if (last)
+			bit = (node.one) ? 1 : 0;
+		else
+			bit = (node.zero) ? 0 : 1;
+
+		node_index = (bit) ? node.one : node.zero;
+
+		// Every subtree must end in a network
+		if (!node_index || level >= 128) {
+			errno = EBADMSG;
+			return -1;
+		}
+
+		// Check boundaries
+		if ((size_t)node_index >= db->network_node_objects.count) {
+			errno = ERANGE;
+			return -1;
+		}
+
+		// Remember the inner child in case the outer one only has copies
+		if (pushed >= 0 && bit == last && (node.zero && node.one)) {
+			stack[depth].node_index = (last) ? node.zero : node.one;
+			stack[depth].level = level;
+			depth++;
+		}
+
+		loc_address_set_bit(edge, level++, bit);
+	}
+
+	const struct in6_addr bitmask = loc_prefix_to_bitmask(level);
+
+	if (last)
+		*edge = loc_address_or(edge, &bitmask);
+	else
+		*edge = loc_address_and(edge, &bitmask);
+
+	return 0;
+}
+
+/*
+	Returns the range of addresses that would have taken the same path through
+	the tree as the address of a finished lookup. This costs nothing extra.
+*/
+static void loc_database_lookup_block(const struct loc_database_lookup_state* state,
+		struct in6_addr* first, struct in6_addr* last) {
+	const struct in6_addr bitmask = loc_prefix_to_bitmask(state->end);
+
+	*first = loc_address_and(state->address, &bitmask);
+	*last  = loc_address_or(first, &bitmask);
+}
+
+/*
+	Computes the largest range of addresses around the address of a finished lookup
+	that has the same result, i.e. the network that has been found without any
+	more specific networks, or the gap between the closest networks if there was
+	no match.
+
+	This needs to walk down the closest subtrees on both sides of the path.
+*/
+static int loc_database_lookup_maximal_range(struct loc_database* db,
+		const struct loc_database_lookup_state* state, struct in6_addr* first, struct in6_addr* last) {
+	const unsigned int prefix = (state->r) ? 0 : state->prefix;
+	int r;
+
+	// Start with the entire network
+	const struct in6_addr bitmask = loc_prefix_to_bitmask(prefix);
+
+	*first = loc_address_and(state->address, &bitmask);
+	*last  = loc_address_or(first, &bitmask);
+
+	// Leaf-pushed trees contain copies of the network that has been found
+	const off_t pushed = (!state->r && (db->header_flags & LOC_DATABASE_HEADER_FLAG_LEAF_PUSHED))
+		? state->network_index : -1;
+
+	// The closest subtrees contain the closest more specific networks
+	if (state->left.node_index >= 0 && state->left.bit >= prefix) {
+		r = loc_database_lookup_branch_edge(db, &state->left, state->address, 1, pushed, first);
+		if (r)
+			return r;
+
+		// The edge might be the last IPv4 address even if the lookup was not for one
+		__loc_address_increment(first);
+	}
+
+	if (state->right.node_index >= 0 && state->right.bit >= prefix) {
+		r = loc_database_lookup_branch_edge(db, &state->right, state->address, 0, pushed, last);
+		if (r)
+			return r;
+
+		__loc_address_decrement(last);
+	}
+
+	// Do not leave the IPv4 address space
+	if (IN6_IS_ADDR_V4MAPPED(state->address)) {
+		struct in6_addr edge;
+
+		loc_address_reset(&edge, AF_INET);
+		if (loc_address_cmp(first, &edge) < 0)
+			*first = edge;
+
+		loc_address_reset_last(&edge, AF_INET);
+		if (loc_address_cmp(last, &edge) > 0)
+			*last = edge;
+	}
+
+	return 0;
+}
+
+static inline void loc_database_address4(struct in6_addr* address, uint32_t address4) {
+	loc_address_reset(address, AF_INET);
+
+	address->s6_addr32[3] = htonl(address4);
+}
+
+/*
+	Walks down the tree along the path of the address and returns the position
+	and prefix of the most specific network that was found on the way, as well
+	as the range of addresses around the address that has the same result.
+
+	The range is the block of addresses that share the same path in the tree
+	(or the same slot of an accelerator) and might not be the largest possible.
+
+	Returns 0 if a network was found, 1 if there was no match and -1 on error.
+*/
+static int __loc_database_lookup(struct loc_database* db, const struct in6_addr* address,
+		off_t* network_index, unsigned int* prefix, struct in6_addr* first, struct in6_addr* last) {
+	struct loc_database_lookup_state state;
+	uint32_t first4, last4;
+	uint32_t index;
+	int r;
+
+	// Use the DIR-24-8 table for IPv4 addresses
+	if (db->dir24 && IN6_IS_ADDR_V4MAPPED(address)) {
+		r = loc_dir24_lookup(db->dir24, ntohl(address->s6_addr32[3]),
+			&index, prefix, &first4, &last4);
+		if (r == 0)
+			*network_index = index;
+
+		loc_database_address4(first, first4);
+		loc_database_address4(last, last4);
+
+		return r;
+	}
+
+	// Use the poptrie if we have one
+	if (db->poptrie) {
+		r = loc_poptrie_lookup(db->poptrie, address, &index, prefix, first, last);
+		if (r == 0)
+			*network_index = index;
+
+		return r;
+	}
+
+	loc_database_lookup_state_init(&state, address);
+
+	// Walk without any checks if we have a copy of the tree or it has been validated
+	if (db->tree) {
+		while (__loc_database_lookup_step(db, &state, 0, LOC_DATABASE_NODE_COPY) > 0)
+			continue;
+
+	} else if (db->validated) {
+		while (__loc_database_lookup_step(db, &state, 0, LOC_DATABASE_NODE_UNCHECKED) > 0)
+			continue;
+
+	} else {
+		do {
+			r = __loc_database_lookup_step(db, &state, 0, LOC_DATABASE_NODE_CHECKED);
+			if (r < 0)
+				return r;
+		} while (r);
+	}
+
+	loc_database_lookup_block(&state, first, last);
+
+	*network_index = state.network_index;
+	*prefix = state.prefix;
+
+	return state.r;
+}
+
+LOC_EXPORT int loc_database_lookup_result(struct loc_database* db,
+		const struct in6_addr* address, struct loc_database_lookup_result* result) {
+	struct in6_addr first, last;
+	off_t network_index = 0;
+	unsigned int prefix = 0;
+
+	// Reset the result
+	memset(result, 0, sizeof(*result));
+
+#ifdef ENABLE_DEBUG
+	// Save start time
 	clock_t start = clock();
 #endif
 
-	while (lo <= hi) {
-		off_t i = (lo + hi) / 2;
+	int r = __loc_database_lookup(db, address, &network_index, &prefix, &first, &last);
+	if (r < 0)
+		return r;
+
+	// Fill the result
+	if (r == 0) {
+		r = loc_database_fetch_result(db, address, prefix, network_index, result);
+		if (r)
+			return r;
+	}
+
+	result->range_first_address = first;
+	result->range_last_address  = last;
+
+#ifdef ENABLE_DEBUG
+	clock_t end = clock();
+
+	// Log how fast this has been
+	DEBUG(db->ctx, "Executed network search in %.4fms\n",
+		(double)(end - start) / CLOCKS_PER_SEC * 1000);
+#endif
+
+	return r;
+}
+
+/*
+	Works like loc_database_lookup_result() but returns the largest range
+	of addresses around the address that has the same result.
+
+	This always walks the tree.
+*/
+LOC_EXPORT int loc_database_lookup_range(struct loc_database* db,
+		const struct in6_addr* address, struct loc_database_lookup_result* result) {
+	struct loc_database_lookup_state state;
+	int r;
+
+	// Reset the result
+	memset(result, 0, sizeof(*result));
+
+	loc_database_lookup_state_init(&state, address);
+
+	do {
+		r = __loc_database_lookup_step(db, &state, 1,
+			(db->tree) ? LOC_DATABASE_NODE_COPY : LOC_DATABASE_NODE_CHECKED);
+		if (r < 0)
+			return r;
+	} while (r);
+
+	// Fill the result
+	if (state.r == 0) {
+		r = loc_database_fetch_result(db, address, state.prefix, state.network_index, result);
+		if (r)
+			return r;
+	}
+
+	r = loc_database_lookup_maximal_range(db, &state,
+		&result->range_first_address, &result->range_last_address);
+	if (r)
+		return r;
+
+	return state.r;
+}
+
+LOC_EXPORT int loc_database_lookup(struct loc_database* db,
+		const struct in6_addr* address, struct loc_network** network) {
+	struct loc_database_lookup_result result;
+	int r;
+
+	*network = NULL;
+
+	// Perform the lookup
+	r = loc_database_lookup_result(db, address, &result);
+	if (r)
+		return r;
+
+	// Create a network object from the result
+	r = loc_network_new(db->ctx, network, &result.first_address, result.prefix);
+	if (r)
+		return r;
+
+	r = loc_network_set_country_code(*network, result.country_code);
+	if (r)
+		goto ERROR;
+
+	r = loc_network_set_asn(*network, result.asn);
+	if (r)
+		goto ERROR;
+
+	r = loc_network_set_flag(*network, result.flags);
+	if (r)
+		goto ERROR;
+
+	DEBUG(db->ctx, "Got network %s\n", loc_network_str(*network));
+
+	return 0;
+
+ERROR:
+	loc_network_unref(*network);
+	*network = NULL;
+
+	return r;
+}
+
+LOC_EXPORT int loc_database_lookup_from_string(struct loc_database* db,
+		const char* string, struct loc_network** network) {
+	struct in6_addr address;
+
+	int r = loc_address_parse(&address, NULL, string);
+	if (r)
+		return r;
+
+	return loc_database_lookup(db, &address, network);
+}
+
+/*
+	Finds the network an address belongs to and returns its record
+	without creating a network object
+*/
+static int loc_database_lookup_network_v1(struct loc_database* db,
+		const struct in6_addr* address, const struct loc_database_network_v1** network_v1) {
+	struct in6_addr first, last;
+	off_t network_index = 0;
+	unsigned int prefix = 0;
+	int r;
+
+	r = __loc_database_lookup(db, address, &network_index, &prefix, &first, &last);
+	if (r)
+		return r;
+
+	return loc_database_fetch_network_v1(db, network_index, network_v1);
+}
+
+LOC_EXPORT int loc_database_lookup_asn(struct loc_database* db,
+		const struct in6_addr* address, uint32_t* asn) {
+	const struct loc_database_network_v1* network_v1 = NULL;
+
+	*asn = 0;
+
+	int r = loc_database_lookup_network_v1(db, address, &network_v1);
+	if (r)
+		return r;
+
+	*asn = be32toh(network_v1->asn);
+
+	return 0;
+}
+
+LOC_EXPORT int loc_database_lookup_country_code(struct loc_database* db,
+		const struct in6_addr* address, char* country_code) {
+	const struct loc_database_network_v1* network_v1 = NULL;
+
+	*country_code = '\0';
+
+	int r = loc_database_lookup_network_v1(db, address, &network_v1);
+	if (r)
+		return r;
+
+	loc_country_code_copy(country_code, network_v1->country_code);
+	country_code[2] = '\0';
+
+	return 0;
+}
+
+LOC_EXPORT int loc_database_lookup_flags(struct loc_database* db,
+		const struct in6_addr* address, enum loc_network_flags* flags) {
+	const struct loc_database_network_v1* network_v1 = NULL;
+
+	*flags = 0;
+
+	int r = loc_database_lookup_network_v1(db, address, &network_v1);
+	if (r)
+		return r;
+
+	*flags = be16toh(network_v1->flags);
+
+	return 0;
+}
+
+LOC_EXPORT int loc_database_lookup4(struct loc_database* db,
+		uint32_t address, struct loc_database_lookup_result* result) {
+	struct in6_addr mapped = IN6ADDR_ANY_INIT;
+
+	// Convert into a mapped IPv4 address
+	mapped.s6_addr32[2] = htonl(0xffff);
+	mapped.s6_addr32[3] = htonl(address);
+
+	return loc_database_lookup_result(db, &mapped, result);
+}
+
+/*
+	The number of lookups that are being performed at the same time.
+
+	While one lookup is waiting for its next node to arrive from memory,
+	we can make progress on all the others.
+*/
+#define LOC_DATABASE_LOOKUP_BATCH_LANES 32
+
+/*
+	Performs all lookups starting at next that can be answered by an accelerator
+	until we find an address for which we have to walk the tree.
+
+	Returns zero on success or -1 on error.
+*/
+static int loc_database_lookup_batch_accelerated(struct loc_database* db,
+		const struct in6_addr* addresses, size_t count, struct loc_database_lookup_result* results,
+		size_t* next, size_t* matches) {
+	int r;
+
+	for (; *next < count; (*next)++) {
+		const struct in6_addr* address = &addresses[*next];
+
+		// The accelerators only need a few memory accesses, so there is nothing to interleave
+		if (!db->poptrie && !(db->dir24 && IN6_IS_ADDR_V4MAPPED(address)))
+			break;
+
+		r = loc_database_lookup_result(db, address, &results[*next]);
+		if (r < 0)
+			return -1;
+
+		if (r == 0)
+			(*matches)++;
+	}
+
+	return 0;
+}
 
-		// Fetch country in the middle between lo and hi
-		int r = loc_database_fetch_country(db, country, i);
+LOC_EXPORT int loc_database_lookup_batch(struct loc_database* db,
+		const struct in6_addr* addresses, size_t count, struct loc_database_lookup_result* results,
+		size_t* matches) {
+	struct loc_database_lookup_state lanes[LOC_DATABASE_LOOKUP_BATCH_LANES];
+	size_t lane_index[LOC_DATABASE_LOOKUP_BATCH_LANES];
+	unsigned int active = 0;
+	size_t next = 0;
+	size_t found = 0;
+	int r;
+
+	// Fill all lanes with the first addresses
+	while (active < LOC_DATABASE_LOOKUP_BATCH_LANES) {
+		r = loc_database_lookup_batch_accelerated(db, addresses, count, results, &next, &found);
 		if (r)
-			return r;
+			return -1;
 
-		// Check if this is a match
-		const char* cc = loc_country_get_code(*country);
-		int result = strcmp(code, cc);
+		if (next >= count)
+			break;
 
-		if (result == 0) {
-#ifdef ENABLE_DEBUG
-			clock_t end = clock();
+		loc_database_lookup_state_init(&lanes[active], &addresses[next]);
+		loc_database_prefetch_node(db, 0);
 
-			// Log how fast this has been
-			DEBUG(db->ctx, "Found country %s in %.4fms\n", cc,
-				(double)(end - start) / CLOCKS_PER_SEC * 1000);
-#endif
+		lane_index[active++] = next++;
+	}
 
-			return 0;
+	while (active) {
+		for (unsigned int i = 0; i < active;) {
+			struct loc_database_lookup_state* lane = &lanes[i];
+
+			// Advance the lookup by one step
+			if (db->tree)
+				r = __loc_database_lookup_step(db, lane, 0, LOC_DATABASE_NODE_COPY);
+			else if (db->validated)
+				r = __loc_database_lookup_step(db, lane, 0, LOC_DATABASE_NODE_UNCHECKED);
+			else
+				r = __loc_database_lookup_step(db, lane, 0, LOC_DATABASE_NODE_CHECKED);
+			if (r < 0)
+				return -1;
+
+			// The lookup will continue, so we ask for the next node to be loaded
+			if (r) {
+				loc_database_prefetch_node(db, lane->node_index);
+				i++;
+				continue;
+			}
+
+			// The lookup has ended, store the result
+			struct loc_database_lookup_result* result = &results[lane_index[i]];
+			memset(result, 0, sizeof(*result));
+
+			if (lane->r == 0) {
+				r = loc_database_fetch_result(db, lane->address,
+					lane->prefix, lane->network_index, result);
+				if (r)
+					return -1;
+
+				found++;
+			}
+
+			loc_database_lookup_block(lane,
+				&result->range_first_address, &result->range_last_address);
+
+			// Perform any lookups that do not need to walk the tree
+			r = loc_database_lookup_batch_accelerated(db, addresses, count, results, &next, &found);
+			if (r)
+				return -1;
+
+			// Start the next lookup in this lane
+			if (next < count) {
+				loc_database_lookup_state_init(lane, &addresses[next]);
+				loc_database_prefetch_node(db, 0);
+
+				lane_index[i++] = next++;
+
+			// Otherwise, close the lane
+			} else {
+				lanes[i] = lanes[--active];
+				lane_index[i] = lane_index[active];
+			}
 		}
+	}
+
+	if (matches)
+		*matches = found;
+
+	return 0;
+}
+
+// Returns the country at position pos
+static int loc_database_fetch_country(struct loc_database* db,
+		struct loc_country** country, off_t pos) {
+	struct loc_database_country_v1* country_v1 = NULL;
+	int r;
+
+	// Check if the country is within range
+	if ((size_t)pos >= db->country_objects.count) {
+		errno = ERANGE;
+		return 1;
+	}
+
+	DEBUG(db->ctx, "Fetching country at position %jd\n", (intmax_t)pos);
+
+	switch (db->version) {
+		case LOC_DATABASE_VERSION_1:
+		case LOC_DATABASE_VERSION_2:
+			// Read the object
+			country_v1 = (struct loc_database_country_v1*)loc_database_object(db,
+				&db->country_objects, sizeof(*country_v1), pos);
+			if (!country_v1)
+				return 1;
+
+			r = loc_country_new_from_database_v1(db->ctx, db->pool, country, country_v1);
+			break;
+
+		default:
+			errno = ENOTSUP;
+			return 1;
+	}
+
+	if (r == 0)
+		DEBUG(db->ctx, "Got country %s\n", loc_country_get_code(*country));
+
+	return r;
+}
 
-		// If it wasn't, we release the country and
-		// adjust our search pointers
-		loc_country_unref(*country);
+/*
+	Returns the slot of a country code in the index or -1 if it cannot be indexed
+*/
+static inline int loc_database_country_index_slot(const char* code) {
+	if (code[0] < 'A' || code[0] > 'Z' || code[1] < 'A' || code[1] > 'Z')
+		return -1;
+
+	return (code[0] - 'A') * 26 + (code[1] - 'A');
+}
+
+/*
+	Builds a table that maps every country code to the position of the country
+*/
+static int loc_database_build_country_index(struct loc_database* db) {
+	const struct loc_database_country_v1* country_v1 = NULL;
+
+	// We cannot index this many countries
+	if (db->country_objects.count >= UINT16_MAX)
+		return 0;
+
+	switch (db->version) {
+		case LOC_DATABASE_VERSION_1:
+		case LOC_DATABASE_VERSION_2:
+			break;
+
+		default:
+			return 0;
+	}
+
+	for (size_t pos = 0; pos < db->country_objects.count; pos++) {
+		country_v1 = (const struct loc_database_country_v1*)loc_database_object(db,
+			&db->country_objects, sizeof(*country_v1), pos);
+		if (!country_v1)
+			return 1;
+
+		// Skip anything that isn't a valid country code
+		int slot = loc_database_country_index_slot(country_v1->code);
+		if (slot < 0)
+			continue;
+
+		// Keep the first country if there are duplicates
+		if (!db->country_index[slot])
+			db->country_index[slot] = pos + 1;
+	}
+
+	db->country_indexed = 1;
+
+	return 0;
+}
+
+/*
+	Finds the position of a country without creating any objects
+
+	Returns 0 if the country was found, 1 if not and -1 on error.
+*/
+static int loc_database_find_country(struct loc_database* db, const char* code, off_t* pos) {
+	const struct loc_database_country_v1* country_v1 = NULL;
 
-		if (result > 0) {
+	// Check if the country code is valid
+	if (!loc_country_code_is_valid(code)) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	// Use the index if we have one
+	if (db->country_indexed) {
+		const uint16_t i = db->country_index[loc_database_country_index_slot(code)];
+		if (!i)
+			return 1;
+
+		*pos = i - 1;
+		return 0;
+	}
+
+	off_t lo = 0;
+	off_t hi = db->country_objects.count - 1;
+
+	// Otherwise perform a binary search and compare the codes in place
+	while (lo <= hi) {
+		off_t i = (lo + hi) / 2;
+
+		country_v1 = (const struct loc_database_country_v1*)loc_database_object(db,
+			&db->country_objects, sizeof(*country_v1), i);
+		if (!country_v1)
+			return -1;
+
+		// Check if this is a match
+		int result = strncmp(code, country_v1->code, 2);
+		if (result == 0) {
+			*pos = i;
+			return 0;
+		}
+
+		if (result > 0)
 			lo = i + 1;
-		} else
+		else
 			hi = i - 1;
 	}
 
+	return 1;
+}
+
+LOC_EXPORT int loc_database_get_country(struct loc_database* db,
+		struct loc_country** country, const char* code) {
+	off_t pos = 0;
+	int r;
+
 	// Nothing found
 	*country = NULL;
 
+#ifdef ENABLE_DEBUG
+	// Save start time
+	clock_t start = clock();
+#endif
+
+	r = loc_database_find_country(db, code, &pos);
+	if (r < 0)
+		return 1;
+
+	// Not found
+	else if (r)
+		return 0;
+
+	// Only fetch the country that we have found
+	r = loc_database_fetch_country(db, country, pos);
+	if (r)
+		return r;
+
+#ifdef ENABLE_DEBUG
+	clock_t end = clock();
+
+	// Log how fast this has been
+	DEBUG(db->ctx, "Found country %s in %.4fms\n", code,
+		(double)(end - start) / CLOCKS_PER_SEC * 1000);
+#endif
+
+	return 0;
+}
+
+/*
+	Works like loc_database_get_country() but does not allocate anything.
+	The name points into the database.
+*/
+LOC_EXPORT int loc_database_get_country_view(struct loc_database* db,
+		const char* code, struct loc_database_country_view* view) {
+	const struct loc_database_country_v1* country_v1 = NULL;
+	off_t pos = 0;
+	int r;
+
+	r = loc_database_find_country(db, code, &pos);
+	if (r)
+		return 1;
+
+	switch (db->version) {
+		case LOC_DATABASE_VERSION_1:
+		case LOC_DATABASE_VERSION_2:
+			country_v1 = (const struct loc_database_country_v1*)loc_database_object(db,
+				&db->country_objects, sizeof(*country_v1), pos);
+			if (!country_v1)
+				return 1;
+
+			loc_country_code_copy(view->code, country_v1->code);
+			view->code[2] = '\0';
+
+			loc_country_code_copy(view->continent_code, country_v1->continent_code);
+			view->continent_code[2] = '\0';
+
+			view->name = loc_stringpool_get(db->pool, be32toh(country_v1->name));
+			if (!view->name)
+				return 1;
+			break;
+
+		default:
+			errno = ENOTSUP;
+			return 1;
+	}
+
 	return 0;
 }
 
@@ -1069,9 +2945,11 @@ static void loc_database_enumerator_free(struct loc_database_enumerator* enumera
 	if (enumerator->asns)
 		loc_as_list_unref(enumerator->asns);
 
-	// Free network search
-	if (enumerator->networks_visited)
-		free(enumerator->networks_visited);
+	if (enumerator->filter_asns)
+		free(enumerator->filter_asns);
+
+	if (enumerator->index_lists)
+		free(enumerator->index_lists);
 
 	// Free subnet/bogons stack
 	if (enumerator->stack)
@@ -1101,23 +2979,13 @@ LOC_EXPORT int loc_database_enumerator_new(struct loc_database_enumerator** enum
 	// Flatten output?
 	e->flatten = (flags & LOC_DB_ENUMERATOR_FLAGS_FLATTEN);
 
-	// Initialise graph search
-	e->network_stack_depth = 1;
-	e->networks_visited = calloc(db->network_node_objects.count, sizeof(*e->networks_visited));
-	if (!e->networks_visited) {
-		ERROR(db->ctx, "Could not allocated visited networks: %m\n");
-		r = 1;
-		goto ERROR;
-	}
-
 	// Allocate stack
 	r = loc_network_list_new(e->ctx, &e->stack);
 	if (r)
 		goto ERROR;
 
-	// Initialize bogon search
-	loc_address_reset(&e->gap6_start, AF_INET6);
-	loc_address_reset(&e->gap4_start, AF_INET);
+	// Initialise the search
+	loc_database_enumerator_reset(e);
 
 	DEBUG(e->ctx, "Database enumerator object allocated at %p\n", e);
 
@@ -1132,7 +3000,7 @@ ERROR:
 }
 
 LOC_EXPORT struct loc_database_enumerator* loc_database_enumerator_ref(struct loc_database_enumerator* enumerator) {
-	enumerator->refcount++;
+	loc_refcount_inc(&enumerator->refcount);
 
 	return enumerator;
 }
@@ -1141,20 +3009,62 @@ LOC_EXPORT struct loc_database_enumerator* loc_database_enumerator_unref(struct
 	if (!enumerator)
 		return NULL;
 
-	if (--enumerator->refcount > 0)
-		return enumerator;
+	if (loc_refcount_dec(&enumerator->refcount) > 0)
+		return enumerator;
+
+	loc_database_enumerator_free(enumerator);
+	return NULL;
+}
+
+/*
+	Starts the enumeration from the beginning again, keeping all filters
+*/
+LOC_EXPORT void loc_database_enumerator_reset(struct loc_database_enumerator* enumerator) {
+	// Reset the AS & country search
+	enumerator->as_index = 0;
+	enumerator->as_search = LOC_DATABASE_AS_SEARCH_NONE;
+	enumerator->country_index = 0;
+
+	// Compile the filters again in case the lists have been changed
+	enumerator->filter_compiled = 0;
+
+	// Decide again how to find the networks
+	enumerator->network_search = LOC_DATABASE_NETWORK_SEARCH_NONE;
+	enumerator->index_lists_count = 0;
+
+	// Start the graph search at the root node
+	memset(&enumerator->network_address, 0, sizeof(enumerator->network_address));
+	memset(&enumerator->network_stack[1], 0, sizeof(enumerator->network_stack[1]));
+	enumerator->network_stack[1].network = -1;
+	enumerator->network_stack_depth = 1;
+
+	// Drop anything that has not been returned, yet
+	loc_network_list_clear(enumerator->stack);
+
+	if (enumerator->subnets)
+		loc_network_list_clear(enumerator->subnets);
 
-	loc_database_enumerator_free(enumerator);
-	return NULL;
+	// Initialize bogon search
+	loc_address_reset(&enumerator->gap6_start, AF_INET6);
+	loc_address_reset(&enumerator->gap4_start, AF_INET);
 }
 
 LOC_EXPORT int loc_database_enumerator_set_string(struct loc_database_enumerator* enumerator, const char* string) {
+	if (enumerator->string)
+		free(enumerator->string);
+
 	enumerator->string = strdup(string);
+	if (!enumerator->string)
+		return 1;
 
 	// Make the string lowercase
 	for (char *p = enumerator->string; *p; p++)
 		*p = tolower(*p);
 
+	// Start searching again
+	enumerator->as_index = 0;
+	enumerator->as_search = LOC_DATABASE_AS_SEARCH_NONE;
+
 	return 0;
 }
 
@@ -1172,6 +3082,7 @@ LOC_EXPORT int loc_database_enumerator_set_countries(
 		loc_country_list_unref(enumerator->countries);
 
 	enumerator->countries = loc_country_list_ref(countries);
+	enumerator->filter_compiled = 0;
 
 	return 0;
 }
@@ -1190,6 +3101,7 @@ LOC_EXPORT int loc_database_enumerator_set_asns(
 		loc_as_list_unref(enumerator->asns);
 
 	enumerator->asns = loc_as_list_ref(asns);
+	enumerator->filter_compiled = 0;
 
 	return 0;
 }
@@ -1208,8 +3120,131 @@ LOC_EXPORT int loc_database_enumerator_set_family(
 	return 0;
 }
 
+/*
+	Finds all ASes whose name might contain string using the search index
+
+	Returns 0 if candidates have been found (there might be none), or 1 if
+	the index cannot be used and all ASes have to be searched.
+*/
+static int loc_database_search_as(struct loc_database* db, const char* string,
+		const uint32_t** candidates, size_t* count) {
+	const struct loc_database_as_trigram_v1* trigram_v1 = NULL;
+	const struct loc_database_as_trigram_v1* best = NULL;
+
+	// We need an index
+	if (!db->as_trigram_objects.data)
+		return 1;
+
+	const size_t length = strlen(string);
+
+	// We need at least one trigram
+	if (length < 3)
+		return 1;
+
+	for (size_t i = 0; i < length; i++) {
+		// Trigrams outside of ASCII are not indexed
+		if ((unsigned char)string[i] >= 0x80)
+			return 1;
+	}
+
+	// Find the trigram with the fewest ASes
+	for (size_t i = 0; i + 3 <= length; i++) {
+		char trigram[3];
+
+		for (unsigned int j = 0; j < 3; j++) {
+			trigram[j] = string[i + j];
+
+			if (trigram[j] >= 'A' && trigram[j] <= 'Z')
+				trigram[j] += 'a' - 'A';
+		}
+
+		off_t lo = 0;
+		off_t hi = db->as_trigram_objects.count - 1;
+
+		trigram_v1 = NULL;
+
+		// Perform a binary search
+		while (lo <= hi) {
+			off_t mid = (lo + hi) / 2;
+
+			const struct loc_database_as_trigram_v1* t =
+				(const struct loc_database_as_trigram_v1*)loc_database_object(db,
+					&db->as_trigram_objects, sizeof(*t), mid);
+			if (!t)
+				return 1;
+
+			int r = memcmp(trigram, t->trigram, sizeof(trigram));
+			if (r == 0) {
+				trigram_v1 = t;
+				break;
+			}
+
+			if (r > 0)
+				lo = mid + 1;
+			else
+				hi = mid - 1;
+		}
+
+		// If any trigram is missing, nothing can match
+		if (!trigram_v1) {
+			*candidates = NULL;
+			*count = 0;
+
+			return 0;
+		}
+
+		if (!best || be32toh(trigram_v1->count) < be32toh(best->count))
+			best = trigram_v1;
+	}
+
+	const size_t offset = be32toh(best->offset);
+	const size_t c = be32toh(best->count);
+
+	// Check if all ASes are within the index
+	if (offset > db->as_posting_objects.count || c > db->as_posting_objects.count - offset)
+		return 1;
+
+	*candidates = (const uint32_t*)db->as_posting_objects.data + offset;
+	*count = c;
+
+	DEBUG(db->ctx, "Found %zu candidate(s) for '%s'\n", *count, string);
+
+	return 0;
+}
+
+/*
+	Checks whether the name of the AS at pos could match without fetching the AS
+*/
+static int loc_database_as_name_matches(struct loc_database* db, off_t pos, const char* string) {
+	const struct loc_database_as_v1* as_v1 = NULL;
+
+	switch (db->version) {
+		case LOC_DATABASE_VERSION_1:
+		case LOC_DATABASE_VERSION_2:
+			as_v1 = (const struct loc_database_as_v1*)loc_database_object(db,
+				&db->as_objects, sizeof(*as_v1), pos);
+			break;
+
+		default:
+			break;
+	}
+
+	// Let the caller decide
+	if (!as_v1)
+		return 1;
+
+	const char* name = loc_stringpool_get(db->pool, be32toh(as_v1->name));
+	if (!name)
+		return 1;
+
+	return (strcasestr(name, string) != NULL);
+}
+
 LOC_EXPORT int loc_database_enumerator_next_as(
 		struct loc_database_enumerator* enumerator, struct loc_as** as) {
+	size_t count;
+	off_t pos;
+
 	*as = NULL;
 
 	// Do not do anything if not in AS mode
@@ -1218,9 +3253,32 @@ LOC_EXPORT int loc_database_enumerator_next_as(
 
 	struct loc_database* db = enumerator->db;
 
-	while (enumerator->as_index < db->as_objects.count) {
+	// Find candidates when we start searching
+	if (enumerator->as_search == LOC_DATABASE_AS_SEARCH_NONE) {
+		if (enumerator->string && loc_database_search_as(db, enumerator->string,
+				&enumerator->as_candidates, &enumerator->as_candidates_count) == 0)
+			enumerator->as_search = LOC_DATABASE_AS_SEARCH_CANDIDATES;
+		else
+			enumerator->as_search = LOC_DATABASE_AS_SEARCH_ALL;
+	}
+
+	if (enumerator->as_search == LOC_DATABASE_AS_SEARCH_CANDIDATES)
+		count = enumerator->as_candidates_count;
+	else
+		count = db->as_objects.count;
+
+	while (enumerator->as_index < count) {
+		if (enumerator->as_search == LOC_DATABASE_AS_SEARCH_CANDIDATES)
+			pos = be32toh(enumerator->as_candidates[enumerator->as_index++]);
+		else
+			pos = enumerator->as_index++;
+
+		// Skip any ASes that cannot match before fetching them
+		if (enumerator->string && !loc_database_as_name_matches(db, pos, enumerator->string))
+			continue;
+
 		// Fetch the next AS
-		int r = loc_database_fetch_as(db, as, enumerator->as_index++);
+		int r = loc_database_fetch_as(db, as, pos);
 		if (r)
 			return r;
 
@@ -1239,13 +3297,14 @@ LOC_EXPORT int loc_database_enumerator_next_as(
 
 	// Reset the index
 	enumerator->as_index = 0;
+	enumerator->as_search = LOC_DATABASE_AS_SEARCH_NONE;
 
 	// We have searched through all of them
 	return 0;
 }
 
 static int loc_database_enumerator_stack_push_node(
-		struct loc_database_enumerator* e, off_t offset, int i, int depth) {
+		struct loc_database_enumerator* e, off_t offset, int i, int depth, off_t network) {
 	// Do not add empty nodes
 	if (!offset)
 		return 0;
@@ -1272,54 +3331,343 @@ static int loc_database_enumerator_stack_push_node(
 	e->network_stack[s].offset = offset;
 	e->network_stack[s].i = i;
 	e->network_stack[s].depth = depth;
+	e->network_stack[s].network = network;
 
 	return 0;
 }
 
-static int loc_database_enumerator_match_network(
-		struct loc_database_enumerator* enumerator, struct loc_network* network) {
-	// If family is set, it must match
-	if (enumerator->family && loc_network_address_family(network) != enumerator->family) {
-		DEBUG(enumerator->ctx, "Filtered network %p because of family not matching\n", network);
+static int __loc_database_enumerator_asn_cmp(const void* p1, const void* p2) {
+	const uint32_t asn1 = *(const uint32_t*)p1;
+	const uint32_t asn2 = *(const uint32_t*)p2;
+
+	if (asn1 == asn2)
 		return 0;
+
+	return (asn1 < asn2) ? -1 : 1;
+}
+
+/*
+	Compiles the country and AS lists into a bitmap of all country codes and
+	a sorted array of all AS numbers so that networks can be matched without
+	allocating anything.
+*/
+static int loc_database_enumerator_compile_filter(struct loc_database_enumerator* enumerator) {
+	memset(enumerator->filter_countries, 0, sizeof(enumerator->filter_countries));
+	enumerator->filter_asns_count = 0;
+
+	// Countries
+	if (enumerator->countries) {
+		for (size_t i = 0; i < loc_country_list_size(enumerator->countries); i++) {
+			struct loc_country* country = loc_country_list_get(enumerator->countries, i);
+			if (!country)
+				continue;
+
+			const int slot = loc_database_country_index_slot(loc_country_get_code(country));
+			if (slot >= 0)
+				enumerator->filter_countries[slot / 8] |= (1 << (slot % 8));
+
+			loc_country_unref(country);
+		}
+	}
+
+	// ASNs
+	if (enumerator->asns) {
+		const size_t size = loc_as_list_size(enumerator->asns);
+
+		if (size) {
+			uint32_t* asns = realloc(enumerator->filter_asns, size * sizeof(*asns));
+			if (!asns)
+				return 1;
+
+			enumerator->filter_asns = asns;
+
+			for (size_t i = 0; i < size; i++) {
+				struct loc_as* as = loc_as_list_get(enumerator->asns, i);
+				if (!as)
+					continue;
+
+				enumerator->filter_asns[enumerator->filter_asns_count++] = loc_as_get_number(as);
+				loc_as_unref(as);
+			}
+
+			qsort(enumerator->filter_asns, enumerator->filter_asns_count,
+				sizeof(*enumerator->filter_asns), __loc_database_enumerator_asn_cmp);
+		}
 	}
 
+	enumerator->filter_compiled = 1;
+
+	return 0;
+}
+
+static int loc_database_enumerator_match(struct loc_database_enumerator* enumerator,
+		int family, const char* country_code, uint32_t asn, uint32_t flags) {
+	// If family is set, it must match
+	if (enumerator->family && family != enumerator->family)
+		return 0;
+
 	// Match if no filter criteria is configured
 	if (!enumerator->countries && !enumerator->asns && !enumerator->flags)
 		return 1;
 
 	// Check if the country code matches
-	if (enumerator->countries && !loc_country_list_empty(enumerator->countries)) {
-		const char* country_code = loc_network_get_country_code(network);
+	const int slot = loc_database_country_index_slot(country_code);
 
-		if (loc_country_list_contains_code(enumerator->countries, country_code)) {
-			DEBUG(enumerator->ctx, "Matched network %p because of its country code\n", network);
-			return 1;
-		}
-	}
+	if (slot >= 0 && (enumerator->filter_countries[slot / 8] & (1 << (slot % 8))))
+		return 1;
 
 	// Check if the ASN matches
-	if (enumerator->asns && !loc_as_list_empty(enumerator->asns)) {
-		uint32_t asn = loc_network_get_asn(network);
+	if (enumerator->filter_asns_count && bsearch(&asn, enumerator->filter_asns,
+			enumerator->filter_asns_count, sizeof(*enumerator->filter_asns),
+			__loc_database_enumerator_asn_cmp))
+		return 1;
 
-		if (loc_as_list_contains_number(enumerator->asns, asn)) {
-			DEBUG(enumerator->ctx, "Matched network %p because of its ASN\n", network);
-			return 1;
-		}
+	// Check if flags match
+	if (enumerator->flags & flags)
+		return 1;
+
+	// Not a match
+	return 0;
+}
+
+static int loc_database_enumerator_match_network(
+		struct loc_database_enumerator* enumerator, struct loc_network* network) {
+	const char* country_code = loc_network_get_country_code(network);
+
+	// Networks without a country code have an empty one
+	if (!country_code || !*country_code)
+		country_code = "\0\0";
+
+	uint32_t flags = 0;
+
+	if (enumerator->flags)
+		flags = loc_network_has_flag(network, enumerator->flags);
+
+	int r = loc_database_enumerator_match(enumerator, loc_network_address_family(network),
+		country_code, loc_network_get_asn(network), flags);
+
+	if (!r)
+		DEBUG(enumerator->ctx, "Filtered network %p\n", network);
+
+	return r;
+}
+
+/*
+	Matches the network at pos without creating a network object
+*/
+static int loc_database_enumerator_match_network_at(
+		struct loc_database_enumerator* enumerator, off_t pos) {
+	const struct loc_database_network_v1* network_v1 = NULL;
+
+	int r = loc_database_fetch_network_v1(enumerator->db, pos, &network_v1);
+	if (r)
+		return r;
+
+	return loc_database_enumerator_match(enumerator,
+		loc_address_family(&enumerator->network_address), network_v1->country_code,
+		be32toh(network_v1->asn), be16toh(network_v1->flags));
+}
+
+/*
+	Finds the list of networks for key in the network index
+*/
+static int loc_database_find_network_index_list(struct loc_database* db,
+		struct loc_database_objects* objects, uint32_t key,
+		struct loc_database_enumerator_index_list* list) {
+	const struct loc_database_network_index_key_v1* key_v1 = NULL;
+
+	off_t lo = 0;
+	off_t hi = objects->count - 1;
+
+	// Perform a binary search
+	while (lo <= hi) {
+		off_t mid = (lo + hi) / 2;
+
+		key_v1 = (const struct loc_database_network_index_key_v1*)loc_database_object(db,
+			objects, sizeof(*key_v1), mid);
+		if (!key_v1)
+			return -1;
+
+		const uint32_t k = be32toh(key_v1->key);
+
+		if (k == key)
+			break;
+
+		if (k < key)
+			lo = mid + 1;
+		else
+			hi = mid - 1;
+
+		key_v1 = NULL;
 	}
 
-	// Check if flags match
-	if (enumerator->flags && loc_network_has_flag(network, enumerator->flags)) {
-		DEBUG(enumerator->ctx, "Matched network %p because of its flags\n", network);
+	// Not found
+	if (!key_v1)
 		return 1;
+
+	const size_t offset = be32toh(key_v1->offset);
+	const size_t count = be32toh(key_v1->count);
+
+	// Check if all networks are within the index
+	if (offset > db->network_index_refs.count || count > db->network_index_refs.count - offset) {
+		ERROR(db->ctx, "Network index list for %u is out of bounds\n", key);
+		errno = EBADMSG;
+		return -1;
 	}
 
-	// Not a match
+	list->refs = (const struct loc_database_network_index_ref_v1*)
+		db->network_index_refs.data + offset;
+	list->count = count;
+	list->pos = 0;
+
+	return 0;
+}
+
+/*
+	Decides whether the networks can be found using the network index which is possible
+	if only countries and ASes are being searched for, and opens all lists that we need.
+*/
+static int loc_database_enumerator_open_network_index(
+		struct loc_database_enumerator* enumerator, int filter) {
+	struct loc_database* db = enumerator->db;
+	size_t count = 0;
+	int r;
+
+	enumerator->network_search = LOC_DATABASE_NETWORK_SEARCH_TREE;
+
+	// We need an index
+	if (!db->network_index_refs.data)
+		return 0;
+
+	// Flattening and bogons need to see all other networks, too
+	if (!filter || enumerator->mode != LOC_DB_ENUMERATE_NETWORKS || enumerator->flatten)
+		return 0;
+
+	// Flags are not indexed
+	if (enumerator->flags || (!enumerator->countries && !enumerator->asns))
+		return 0;
+
+	// Make space for all lists we might need
+	count = enumerator->filter_asns_count;
+
+	for (unsigned int slot = 0; slot < LOC_DATABASE_COUNTRY_INDEX_SIZE; slot++) {
+		if (enumerator->filter_countries[slot / 8] & (1 << (slot % 8)))
+			count++;
+	}
+
+	if (count) {
+		struct loc_database_enumerator_index_list* lists =
+			reallocarray(enumerator->index_lists, count, sizeof(*lists));
+		if (!lists)
+			return 1;
+
+		enumerator->index_lists = lists;
+	}
+
+	enumerator->index_lists_count = 0;
+
+	// Countries
+	for (unsigned int slot = 0; slot < LOC_DATABASE_COUNTRY_INDEX_SIZE; slot++) {
+		if (!(enumerator->filter_countries[slot / 8] & (1 << (slot % 8))))
+			continue;
+
+		const uint32_t key = (('A' + slot / 26) << 8) | ('A' + slot % 26);
+
+		r = loc_database_find_network_index_list(db, &db->network_index_countries, key,
+			&enumerator->index_lists[enumerator->index_lists_count]);
+		if (r < 0)
+			return r;
+
+		else if (r == 0)
+			enumerator->index_lists_count++;
+	}
+
+	// ASes
+	for (size_t i = 0; i < enumerator->filter_asns_count; i++) {
+		r = loc_database_find_network_index_list(db, &db->network_index_asns,
+			enumerator->filter_asns[i], &enumerator->index_lists[enumerator->index_lists_count]);
+		if (r < 0)
+			return r;
+
+		else if (r == 0)
+			enumerator->index_lists_count++;
+	}
+
+	DEBUG(enumerator->ctx, "Searching through %zu list(s) of the network index\n",
+		enumerator->index_lists_count);
+
+	enumerator->network_search = LOC_DATABASE_NETWORK_SEARCH_INDEX;
+
 	return 0;
 }
 
+static int loc_database_network_index_ref_cmp(
+		const struct loc_database_network_index_ref_v1* ref1,
+		const struct loc_database_network_index_ref_v1* ref2) {
+	int r = memcmp(ref1->address, ref2->address, sizeof(ref1->address));
+	if (r)
+		return r;
+
+	return (ref1->prefix > ref2->prefix) - (ref1->prefix < ref2->prefix);
+}
+
+/*
+	Returns the next network from all lists of the network index in the same order
+	as they would have been found in the tree
+*/
+static int loc_database_enumerator_next_indexed_network(
+		struct loc_database_enumerator* enumerator, struct loc_network** network) {
+	const struct loc_database_network_index_ref_v1* ref = NULL;
+	struct loc_database_enumerator_index_list* list = NULL;
+	struct in6_addr address;
+
+	for (;;) {
+		ref = NULL;
+
+		// Find the first network in all lists
+		for (size_t i = 0; i < enumerator->index_lists_count; i++) {
+			list = &enumerator->index_lists[i];
+
+			if (list->pos >= list->count)
+				continue;
+
+			if (!ref || loc_database_network_index_ref_cmp(&list->refs[list->pos], ref) < 0)
+				ref = &list->refs[list->pos];
+		}
+
+		// We have reached the end of all lists
+		if (!ref)
+			return 0;
+
+		// Move on in all lists that have this network
+		for (size_t i = 0; i < enumerator->index_lists_count; i++) {
+			list = &enumerator->index_lists[i];
+
+			if (list->pos < list->count
+					&& loc_database_network_index_ref_cmp(&list->refs[list->pos], ref) == 0)
+				list->pos++;
+		}
+
+		memcpy(&address, ref->address, sizeof(address));
+
+		// If family is set, it must match
+		if (enumerator->family && loc_address_family(&address) != enumerator->family)
+			continue;
+
+		return loc_database_fetch_network(enumerator->db, network,
+			&address, ref->prefix, be32toh(ref->network));
+	}
+}
+
 static int __loc_database_enumerator_next_network(
 		struct loc_database_enumerator* enumerator, struct loc_network** network, int filter) {
+	// Compile the filters when we start
+	if (!enumerator->filter_compiled) {
+		int r = loc_database_enumerator_compile_filter(enumerator);
+		if (r)
+			return r;
+	}
+
 	// Return top element from the stack
 	while (1) {
 		*network = loc_network_list_pop_first(enumerator->stack);
@@ -1337,70 +3685,97 @@ static int __loc_database_enumerator_next_network(
 		*network = NULL;
 	}
 
+	// Decide how to find the networks when we start
+	if (enumerator->network_search == LOC_DATABASE_NETWORK_SEARCH_NONE) {
+		int r = loc_database_enumerator_open_network_index(enumerator, filter);
+		if (r)
+			return r;
+	}
+
+	if (enumerator->network_search == LOC_DATABASE_NETWORK_SEARCH_INDEX)
+		return loc_database_enumerator_next_indexed_network(enumerator, network);
+
 	DEBUG(enumerator->ctx, "Called with a stack of %u nodes\n",
 		enumerator->network_stack_depth);
 
-	// Perform DFS
+	/*
+		Perform DFS
+
+		Because the tree has no shared nodes, every node is reached exactly once
+		and can be removed from the stack straight away. Its children are then
+		pushed so that the zero child is visited first.
+	*/
 	while (enumerator->network_stack_depth > 0) {
 		DEBUG(enumerator->ctx, "Stack depth: %u\n", enumerator->network_stack_depth);
 
-		// Get object from top of the stack
-		struct loc_node_stack* node = &enumerator->network_stack[enumerator->network_stack_depth];
-
-		DEBUG(enumerator->ctx, "  Got node: %jd\n", node->offset);
-
-		// Remove the node from the stack if we have already visited it
-		if (enumerator->networks_visited[node->offset]) {
-			enumerator->network_stack_depth--;
-			continue;
-		}
+		// Pop node from top of the stack
+		const struct loc_node_stack node =
+			enumerator->network_stack[enumerator->network_stack_depth--];
 
 		// Mark the bits on the path correctly
 		loc_address_set_bit(&enumerator->network_address,
-			(node->depth > 0) ? node->depth - 1 : 0, node->i);
+			(node.depth > 0) ? node.depth - 1 : 0, node.i);
 
-		DEBUG(enumerator->ctx, "Looking at node %jd\n", (intmax_t)node->offset);
-		enumerator->networks_visited[node->offset]++;
+		DEBUG(enumerator->ctx, "Looking at node %jd\n", (intmax_t)node.offset);
 
-		// Pop node from top of the stack
-		struct loc_database_network_node_v1* n =
-			(struct loc_database_network_node_v1*)loc_database_object(enumerator->db,
-				&enumerator->db->network_node_objects, sizeof(*n), node->offset);
-		if (!n)
+		struct loc_database_node n;
+
+		int r = loc_database_read_node(enumerator->db, node.offset, &n);
+		if (r)
+			return r;
+
+		// Mark any bits that have been skipped to get to this node
+		for (unsigned int i = 0; i < n.skip; i++)
+			loc_address_set_bit(&enumerator->network_address,
+				node.depth + i, (n.bits >> (31 - i)) & 1);
+
+		const int depth = node.depth + n.skip;
+
+		if (depth > 128) {
+			errno = EBADMSG;
 			return 1;
+		}
+
+		// Skip any copies of the network above in leaf-pushed trees
+		const int pushed = (enumerator->db->header_flags & LOC_DATABASE_HEADER_FLAG_LEAF_PUSHED)
+			&& __loc_database_node_is_leaf(&n) && n.network == node.network;
+
+		const off_t covering = (__loc_database_node_is_leaf(&n)) ? n.network : node.network;
 
 		// Add edges to stack
-		int r = loc_database_enumerator_stack_push_node(enumerator,
-			be32toh(n->one), 1, node->depth + 1);
+		r = loc_database_enumerator_stack_push_node(enumerator, n.one, 1, depth + 1, covering);
 		if (r)
 			return r;
 
-		r = loc_database_enumerator_stack_push_node(enumerator,
-			be32toh(n->zero), 0, node->depth + 1);
+		r = loc_database_enumerator_stack_push_node(enumerator, n.zero, 0, depth + 1, covering);
 		if (r)
 			return r;
 
 		// Check if this node is a leaf and has a network object
-		if (__loc_database_node_is_leaf(n)) {
-			off_t network_index = be32toh(n->network);
+		if (__loc_database_node_is_leaf(&n) && !pushed) {
+			off_t network_index = n.network;
 
 			DEBUG(enumerator->ctx, "Node has a network at %jd\n", (intmax_t)network_index);
 
+			// Skip the network if it does not match before creating an object
+			if (filter) {
+				r = loc_database_enumerator_match_network_at(enumerator, network_index);
+				if (r < 0)
+					return r;
+
+				else if (r == 0)
+					continue;
+			}
+
 			// Fetch the network object
 			r = loc_database_fetch_network(enumerator->db, network,
-				&enumerator->network_address, node->depth, network_index);
+				&enumerator->network_address, depth, network_index);
 
 			// Break on any errors
 			if (r)
 				return r;
 
-			// Return all networks when the filter is disabled, or check for match
-			if (!filter || loc_database_enumerator_match_network(enumerator, *network))
-				return 0;
-
-			// Does not seem to be a match, so we cleanup and move on
-			loc_network_unref(*network);
-			*network = NULL;
+			return 0;
 		}
 	}
 
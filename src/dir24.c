@@ -0,0 +1,395 @@
+/*
+	libloc - A library to determine the location of someone on the Internet
+
+	Copyright (C) 2017 IPFire Development Team <info@ipfire.org>
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+*/
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include <libloc/libloc.h>
+#include <libloc/database.h>
+#include <libloc/dir24.h>
+#include <libloc/private.h>
+
+/*
+	This is a DIR-24-8 table for IPv4 addresses.
+
+	The first 24 bits of the address are used as index into a table with
+	16M entries. If the network is longer than /24, the entry points to
+	a chunk of 256 entries instead which is indexed by the last 8 bits.
+	Therefore every lookup needs at most two memory accesses.
+
+	Entries store the index of the network plus one so that zero means no match.
+*/
+
+#define LOC_DIR24_TBL24_SIZE	(1U << 24)
+#define LOC_DIR24_CHUNK_SIZE	(1U << 8)
+
+// Marks an entry as pointing to a chunk
+#define LOC_DIR24_CHUNK			(1U << 31)
+
+struct loc_dir24 {
+	struct loc_ctx* ctx;
+	int refcount;
+
+	uint32_t* tbl24;
+
+	uint32_t* chunks;
+	size_t chunks_count;
+	size_t chunks_size;
+
+	// The prefix of each network
+	uint8_t* prefixes;
+	size_t networks_count;
+
+	// The database that we are building from
+	struct loc_database* db;
+};
+
+static int loc_dir24_alloc_chunk(struct loc_dir24* table, uint32_t* chunk) {
+	if (table->chunks_count == table->chunks_size) {
+		size_t size = table->chunks_size ? table->chunks_size * 2 : 1024;
+
+		uint32_t* chunks = realloc(table->chunks,
+			size * LOC_DIR24_CHUNK_SIZE * sizeof(*chunks));
+		if (!chunks)
+			return 1;
+
+		table->chunks = chunks;
+		table->chunks_size = size;
+	}
+
+	*chunk = table->chunks_count++;
+
+	return 0;
+}
+
+static void loc_dir24_fill(uint32_t* entries, size_t count, uint32_t leaf) {
+	for (size_t i = 0; i < count; i++)
+		entries[i] = leaf;
+}
+
+/*
+	Remembers the network on the node (if any) as the most specific one
+*/
+static int loc_dir24_visit(struct loc_dir24* table,
+		const struct loc_database_tree_position* position, unsigned int depth, uint32_t* leaf) {
+	uint32_t network;
+	int r;
+
+	r = loc_database_tree_network(table->db, position, &network);
+	if (r < 0)
+		return r;
+
+	// This node has no network
+	else if (r)
+		return 0;
+
+	if (network >= table->networks_count) {
+		errno = ERANGE;
+		return 1;
+	}
+
+	// Leaf-pushed trees repeat the network further down
+	if (*leaf == network + 1)
+		return 0;
+
+	table->prefixes[network] = depth;
+	*leaf = network + 1;
+
+	return 0;
+}
+
+/*
+	Fills a chunk for the node that has been reached after length of its eight bits
+*/
+static int loc_dir24_build_chunk(struct loc_dir24* table, uint32_t chunk,
+		const struct loc_database_tree_position* node, uint32_t bits, unsigned int length,
+		uint32_t leaf) {
+	struct loc_database_tree_position child;
+	int r;
+
+	r = loc_dir24_visit(table, node, 96 + 24 + length, &leaf);
+	if (r)
+		return r;
+
+	// We have reached a host
+	if (length == 8) {
+		table->chunks[chunk * LOC_DIR24_CHUNK_SIZE + bits] = leaf;
+		return 0;
+	}
+
+	for (int bit = 0; bit <= 1; bit++) {
+		const uint32_t b = (bits << 1) | bit;
+
+		r = loc_database_tree_child(table->db, node, bit, &child);
+		if (r < 0)
+			return r;
+
+		// If the tree ends here, all addresses match the same network
+		if (r) {
+			const size_t count = 1U << (8 - length - 1);
+
+			loc_dir24_fill(table->chunks + chunk * LOC_DIR24_CHUNK_SIZE + b * count,
+				count, leaf);
+		} else {
+			r = loc_dir24_build_chunk(table, chunk, &child, b, length + 1, leaf);
+			if (r)
+				return r;
+		}
+	}
+
+	return 0;
+}
+
+/*
+	Fills the table for the node that has been reached after length bits
+*/
+static int loc_dir24_build_node(struct loc_dir24* table,
+		const struct loc_database_tree_position* node, uint32_t bits, unsigned int length,
+		uint32_t leaf) {
+	struct loc_database_tree_position child;
+	uint32_t chunk;
+	int r;
+
+	r = loc_dir24_visit(table, node, 96 + length, &leaf);
+	if (r)
+		return r;
+
+	if (length == 24) {
+		r = loc_database_tree_has_children(table->db, node);
+		if (r < 0)
+			return r;
+
+		// If there are no longer networks, we can store the leaf
+		if (!r) {
+			table->tbl24[bits] = leaf;
+			return 0;
+		}
+
+		// Otherwise we need a chunk
+		r = loc_dir24_alloc_chunk(table, &chunk);
+		if (r)
+			return r;
+
+		table->tbl24[bits] = LOC_DIR24_CHUNK | chunk;
+
+		// Walk through both halves of the chunk
+		for (int bit = 0; bit <= 1; bit++) {
+			r = loc_database_tree_child(table->db, node, bit, &child);
+			if (r < 0)
+				return r;
+
+			if (r) {
+				loc_dir24_fill(table->chunks + chunk * LOC_DIR24_CHUNK_SIZE
+					+ bit * (LOC_DIR24_CHUNK_SIZE / 2), LOC_DIR24_CHUNK_SIZE / 2, leaf);
+			} else {
+				r = loc_dir24_build_chunk(table, chunk, &child, bit, 1, leaf);
+				if (r)
+					return r;
+			}
+		}
+
+		return 0;
+	}
+
+	for (int bit = 0; bit <= 1; bit++) {
+		const uint32_t b = (bits << 1) | bit;
+
+		r = loc_database_tree_child(table->db, node, bit, &child);
+		if (r < 0)
+			return r;
+
+		// If the tree ends here, all addresses match the same network
+		if (r) {
+			const size_t count = 1U << (24 - length - 1);
+
+			loc_dir24_fill(table->tbl24 + b * count, count, leaf);
+		} else {
+			r = loc_dir24_build_node(table, &child, b, length + 1, leaf);
+			if (r)
+				return r;
+		}
+	}
+
+	return 0;
+}
+
+static int loc_dir24_build(struct loc_dir24* table) {
+	struct loc_database_tree_position node;
+	uint32_t leaf = 0;
+	int r;
+
+	r = loc_database_tree_root(table->db, &node);
+	if (r < 0)
+		return r;
+
+	// An empty database has no networks
+	else if (r)
+		return 0;
+
+	r = loc_dir24_visit(table, &node, 0, &leaf);
+	if (r)
+		return r;
+
+	// Walk along ::ffff:0:0/96 to find the start of the IPv4 part of the tree
+	for (unsigned int i = 0; i < 96; i++) {
+		r = loc_database_tree_child(table->db, &node, i >= 80, &node);
+		if (r < 0)
+			return r;
+
+		// If the tree ends here, all addresses match the same network
+		if (r) {
+			loc_dir24_fill(table->tbl24, LOC_DIR24_TBL24_SIZE, leaf);
+			return 0;
+		}
+
+		r = loc_dir24_visit(table, &node, i + 1, &leaf);
+		if (r)
+			return r;
+	}
+
+	return loc_dir24_build_node(table, &node, 0, 0, leaf);
+}
+
+static void loc_dir24_free(struct loc_dir24* table) {
+	DEBUG(table->ctx, "Releasing DIR-24-8 table %p\n", table);
+
+	if (table->tbl24)
+		free(table->tbl24);
+
+	if (table->chunks)
+		free(table->chunks);
+
+	if (table->prefixes)
+		free(table->prefixes);
+
+	loc_unref(table->ctx);
+	free(table);
+}
+
+int loc_dir24_new(struct loc_ctx* ctx, struct loc_dir24** table, struct loc_database* db) {
+	const size_t networks_count = loc_database_count_networks(db);
+	int r = 1;
+
+	// We cannot address more networks than that
+	if (networks_count >= LOC_DIR24_CHUNK) {
+		errno = EFBIG;
+		return 1;
+	}
+
+	struct loc_dir24* t = calloc(1, sizeof(*t));
+	if (!t)
+		return 1;
+
+	t->ctx = loc_ref(ctx);
+	t->refcount = 1;
+
+	t->db = db;
+	t->networks_count = networks_count;
+
+	t->tbl24 = calloc(LOC_DIR24_TBL24_SIZE, sizeof(*t->tbl24));
+	if (!t->tbl24)
+		goto ERROR;
+
+	t->prefixes = calloc(networks_count ? networks_count : 1, sizeof(*t->prefixes));
+	if (!t->prefixes)
+		goto ERROR;
+
+	clock_t start = clock();
+
+	r = loc_dir24_build(t);
+	if (r) {
+		ERROR(ctx, "Could not build DIR-24-8 table: %m\n");
+		goto ERROR;
+	}
+
+	clock_t end = clock();
+
+	// We do not need the database any more
+	t->db = NULL;
+
+	INFO(ctx, "Built DIR-24-8 table with %zu chunk(s) (%zu bytes) in %.4fms\n",
+		t->chunks_count, loc_dir24_get_size(t),
+		(double)(end - start) / CLOCKS_PER_SEC * 1000);
+
+	*table = t;
+	return 0;
+
+ERROR:
+	loc_dir24_free(t);
+
+	return r;
+}
+
+struct loc_dir24* loc_dir24_ref(struct loc_dir24* table) {
+	loc_refcount_inc(&table->refcount);
+
+	return table;
+}
+
+struct loc_dir24* loc_dir24_unref(struct loc_dir24* table) {
+	if (loc_refcount_dec(&table->refcount) > 0)
+		return NULL;
+
+	loc_dir24_free(table);
+
+	return NULL;
+}
+
+/*
+	Returns how much memory this table uses
+*/
+size_t loc_dir24_get_size(struct loc_dir24* table) {
+	return sizeof(*table)
+		+ LOC_DIR24_TBL24_SIZE * sizeof(*table->tbl24)
+		+ table->chunks_count * LOC_DIR24_CHUNK_SIZE * sizeof(*table->chunks)
+		+ table->networks_count * sizeof(*table->prefixes);
+}
+
+/*
+	Looks up an IPv4 address (in host byte order).
+
+	first and last are set to the range of addresses that share the same entry.
+
+	Returns 0 if a network was found, 1 if there was no match.
+*/
+int loc_dir24_lookup(struct loc_dir24* table, uint32_t address,
+		uint32_t* network_index, unsigned int* prefix, uint32_t* first, uint32_t* last) {
+	uint32_t leaf = table->tbl24[address >> 8];
+
+	// Look into the chunk
+	if (leaf & LOC_DIR24_CHUNK) {
+		leaf = table->chunks[(leaf & ~LOC_DIR24_CHUNK) * LOC_DIR24_CHUNK_SIZE + (address & 0xff)];
+
+		*first = *last = address;
+
+	// Otherwise the entire /24 has the same result
+	} else {
+		*first = address & ~0xffU;
+		*last  = address |  0xffU;
+	}
+
+	// No match
+	if (!leaf)
+		return 1;
+
+	*network_index = leaf - 1;
+	*prefix = table->prefixes[leaf - 1];
+
+	return 0;
+}
@@ -97,13 +97,13 @@ LOC_EXPORT struct loc_ctx* loc_ref(struct loc_ctx* ctx) {
 	if (!ctx)
 		return NULL;
 
-	ctx->refcount++;
+	loc_refcount_inc(&ctx->refcount);
 
 	return ctx;
 }
 
 LOC_EXPORT struct loc_ctx* loc_unref(struct loc_ctx* ctx) {
-	if (--ctx->refcount > 0)
+	if (loc_refcount_dec(&ctx->refcount) > 0)
 		return NULL;
 
 	INFO(ctx, "context %p released\n", ctx);
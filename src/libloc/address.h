@@ -17,19 +17,37 @@
 #ifndef LIBLOC_ADDRESS_H
 #define LIBLOC_ADDRESS_H
 
+#include <netinet/in.h>
+#include <stddef.h>
+
+/*
+	These functions are part of the public API
+*/
+
+int loc_address_parse_buffer(struct in6_addr* address, unsigned int* prefix,
+	const char* string, size_t length);
+size_t loc_address_parse_lines(struct in6_addr* addresses, size_t max,
+	const char* buffer, size_t length, size_t* consumed);
+
 #ifdef LIBLOC_PRIVATE
 
 #include <errno.h>
-#include <netinet/in.h>
+#include <stdint.h>
+#include <string.h>
+
+#ifdef HAVE_ENDIAN_H
+#  include <endian.h>
+#endif
 
 #include <libloc/compat.h>
 
 /*
-	All of these functions are private and for internal use only
+	All of the following functions are private and for internal use only
 */
 
-const char* loc_address_str(const struct in6_addr* address);
 int loc_address_parse(struct in6_addr* address, unsigned int* prefix, const char* string);
+const char* loc_address_format(const struct in6_addr* address, char* buffer, size_t length);
+const char* loc_address_str(const struct in6_addr* address);
 
 static inline int loc_address_family(const struct in6_addr* address) {
 	if (IN6_IS_ADDR_V4MAPPED(address))
@@ -66,44 +84,58 @@ static inline int loc_address_valid_prefix(const struct in6_addr* address, unsig
 	return 0;
 }
 
-static inline int loc_address_cmp(const struct in6_addr* a1, const struct in6_addr* a2) {
-	for (unsigned int i = 0; i < 16; i++) {
-		if (a1->s6_addr[i] > a2->s6_addr[i])
-			return 1;
+/*
+	For arithmetic, addresses are loaded into two 64 bit words in host byte order
+*/
+static inline void loc_address_load(const struct in6_addr* address, uint64_t* hi, uint64_t* lo) {
+	memcpy(hi, &address->s6_addr[0], sizeof(*hi));
+	memcpy(lo, &address->s6_addr[8], sizeof(*lo));
 
-		else if (a1->s6_addr[i] < a2->s6_addr[i])
-			return -1;
-	}
+	*hi = be64toh(*hi);
+	*lo = be64toh(*lo);
+}
 
-	return 0;
+static inline void loc_address_store(struct in6_addr* address, uint64_t hi, uint64_t lo) {
+	hi = htobe64(hi);
+	lo = htobe64(lo);
+
+	memcpy(&address->s6_addr[0], &hi, sizeof(hi));
+	memcpy(&address->s6_addr[8], &lo, sizeof(lo));
 }
 
-#define foreach_octet_in_address(octet, address) \
-	for (octet = (IN6_IS_ADDR_V4MAPPED(address) ? 12 : 0); octet <= 15; octet++)
+static inline int loc_address_cmp(const struct in6_addr* a1, const struct in6_addr* a2) {
+	uint64_t hi1, lo1, hi2, lo2;
+
+	loc_address_load(a1, &hi1, &lo1);
+	loc_address_load(a2, &hi2, &lo2);
 
-#define foreach_octet_in_address_reverse(octet, address) \
-	for (octet = 15; octet >= (IN6_IS_ADDR_V4MAPPED(address) ? 12 : 0); octet--)
+	if (hi1 != hi2)
+		return (hi1 > hi2) ? 1 : -1;
+
+	return (lo1 > lo2) - (lo1 < lo2);
+}
 
 static inline int loc_address_all_zeroes(const struct in6_addr* address) {
-	int octet = 0;
+	uint64_t hi, lo;
 
-	foreach_octet_in_address(octet, address) {
-		if (address->s6_addr[octet])
-			return 0;
-	}
+	loc_address_load(address, &hi, &lo);
+
+	// IPv4 addresses only use the last 32 bits
+	if (IN6_IS_ADDR_V4MAPPED(address))
+		return !(uint32_t)lo;
 
-	return 1;
+	return !(hi | lo);
 }
 
 static inline int loc_address_all_ones(const struct in6_addr* address) {
-	int octet = 0;
+	uint64_t hi, lo;
 
-	foreach_octet_in_address(octet, address) {
-		if (address->s6_addr[octet] < 255)
-			return 0;
-	}
+	loc_address_load(address, &hi, &lo);
+
+	if (IN6_IS_ADDR_V4MAPPED(address))
+		return ((uint32_t)lo == 0xffffffff);
 
-	return 1;
+	return ((hi & lo) == 0xffffffffffffffffULL);
 }
 
 static inline int loc_address_get_bit(const struct in6_addr* address, unsigned int i) {
@@ -114,6 +146,30 @@ static inline void loc_address_set_bit(struct in6_addr* address, unsigned int i,
 	address->s6_addr[i / 8] ^= (-val ^ address->s6_addr[i / 8]) & (1 << (7 - (i % 8)));
 }
 
+/*
+	Returns length bits (up to 32) starting at bit i, aligned to the left
+*/
+static inline uint32_t loc_address_get_bits(const struct in6_addr* address,
+		unsigned int i, unsigned int length) {
+	uint64_t bits = 0;
+
+	if (!length)
+		return 0;
+
+	// Load the five octets that contain all bits
+	for (unsigned int j = 0; j < 5; j++) {
+		const unsigned int octet = i / 8 + j;
+
+		bits = (bits << 8) | ((octet < 16) ? address->s6_addr[octet] : 0);
+	}
+
+	// Remove any leading bits
+	bits <<= 24 + (i % 8);
+
+	// Remove anything after length
+	return (bits >> 32) & ~((1ULL << (32 - length)) - 1);
+}
+
 static inline struct in6_addr loc_prefix_to_bitmask(const unsigned int prefix) {
 	struct in6_addr bitmask;
 
@@ -131,13 +187,17 @@ static inline struct in6_addr loc_prefix_to_bitmask(const unsigned int prefix) {
 }
 
 static inline unsigned int loc_address_bit_length(const struct in6_addr* address) {
-	int octet = 0;
-	foreach_octet_in_address(octet, address) {
-		if (address->s6_addr[octet])
-			return (15 - octet) * 8 + 32 - __builtin_clz(address->s6_addr[octet]);
-	}
+	uint64_t hi, lo;
 
-	return 0;
+	loc_address_load(address, &hi, &lo);
+
+	if (IN6_IS_ADDR_V4MAPPED(address))
+		return ((uint32_t)lo) ? 32 - __builtin_clz((uint32_t)lo) : 0;
+
+	if (hi)
+		return 128 - __builtin_clzll(hi);
+
+	return (lo) ? 64 - __builtin_clzll(lo) : 0;
 }
 
 static inline int loc_address_reset(struct in6_addr* address, int family) {
@@ -213,71 +273,82 @@ static inline int loc_address_sub(struct in6_addr* result,
 		return 1;
 	}
 
-	// Clear result
-	int r = loc_address_reset(result, family1);
-	if (r)
-		return r;
-
-	int octet = 0;
-	int remainder = 0;
+	uint64_t hi1, lo1, hi2, lo2;
 
-	foreach_octet_in_address_reverse(octet, address1) {
-		int x = address1->s6_addr[octet] - address2->s6_addr[octet] + remainder;
+	loc_address_load(address1, &hi1, &lo1);
+	loc_address_load(address2, &hi2, &lo2);
 
-		// Store remainder for the next iteration
-		remainder = (x >> 8);
+	// Subtract with borrow
+	uint64_t lo = lo1 - lo2;
+	uint64_t hi = hi1 - hi2 - (lo1 < lo2);
 
-		result->s6_addr[octet] = x & 0xff;
+	// IPv4 addresses wrap around after 32 bits
+	if (family1 == AF_INET) {
+		hi = 0;
+		lo = 0x0000ffff00000000ULL | (uint32_t)lo;
 	}
 
+	loc_address_store(result, hi, lo);
+
 	return 0;
 }
 
+/*
+	Increments or decrements the address as a 128 bit number,
+	no matter which address family it belongs to
+*/
+static inline void __loc_address_increment(struct in6_addr* address) {
+	uint64_t hi, lo;
+
+	loc_address_load(address, &hi, &lo);
+
+	// Carry into the upper word
+	if (!++lo)
+		hi++;
+
+	loc_address_store(address, hi, lo);
+}
+
+static inline void __loc_address_decrement(struct in6_addr* address) {
+	uint64_t hi, lo;
+
+	loc_address_load(address, &hi, &lo);
+
+	// Borrow from the upper word
+	if (!lo--)
+		hi--;
+
+	loc_address_store(address, hi, lo);
+}
+
 static inline void loc_address_increment(struct in6_addr* address) {
 	// Prevent overflow when everything is ones
 	if (loc_address_all_ones(address))
 		return;
 
-	int octet = 0;
-	foreach_octet_in_address_reverse(octet, address) {
-		if (address->s6_addr[octet] < 255) {
-			address->s6_addr[octet]++;
-			break;
-		} else {
-			address->s6_addr[octet] = 0;
-		}
-	}
+	__loc_address_increment(address);
 }
 
 static inline void loc_address_decrement(struct in6_addr* address) {
-	// Prevent underflow when everything is ones
+	// Prevent underflow when everything is zeroes
 	if (loc_address_all_zeroes(address))
 		return;
 
-	int octet = 0;
-	foreach_octet_in_address_reverse(octet, address) {
-		if (address->s6_addr[octet] > 0) {
-			address->s6_addr[octet]--;
-			break;
-		} else {
-			address->s6_addr[octet] = 255;
-		}
-	}
+	__loc_address_decrement(address);
 }
 
 static inline int loc_address_count_trailing_zero_bits(const struct in6_addr* address) {
-	int zeroes = 0;
-
-	int octet = 0;
-	foreach_octet_in_address_reverse(octet, address) {
-		if (address->s6_addr[octet]) {
-			zeroes += __builtin_ctz(address->s6_addr[octet]);
-			break;
-		} else
-			zeroes += 8;
-	}
+	uint64_t hi, lo;
+
+	loc_address_load(address, &hi, &lo);
+
+	if (IN6_IS_ADDR_V4MAPPED(address))
+		return ((uint32_t)lo) ? __builtin_ctz((uint32_t)lo) : 32;
+
+	if (lo)
+		return __builtin_ctzll(lo);
 
-	return zeroes;
+	return (hi) ? 64 + __builtin_ctzll(hi) : 128;
 }
 
 #endif /* LIBLOC_PRIVATE */
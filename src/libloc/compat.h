@@ -27,6 +27,7 @@
 #define htobe32(x) OSSwapHostToBigInt32(x)
 #define be64toh(x) OSSwapBigToHostInt64(x)
 #define htobe64(x) OSSwapHostToBigInt64(x)
+#define le64toh(x) OSSwapLittleToHostInt64(x)
 
 #ifndef s6_addr16
 #  define s6_addr16 __u6_addr.__u6_addr16
@@ -0,0 +1,35 @@
+/*
+	libloc - A library to determine the location of someone on the Internet
+
+	Copyright (C) 2017 IPFire Development Team <info@ipfire.org>
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+*/
+
+#ifndef LIBLOC_DATABASE_HANDLE_H
+#define LIBLOC_DATABASE_HANDLE_H
+
+#include <libloc/libloc.h>
+#include <libloc/database.h>
+
+struct loc_database_handle;
+int loc_database_handle_new(struct loc_ctx* ctx, struct loc_database_handle** handle,
+	const char* path, const char* public_key, int flags);
+struct loc_database_handle* loc_database_handle_ref(struct loc_database_handle* handle);
+struct loc_database_handle* loc_database_handle_unref(struct loc_database_handle* handle);
+
+struct loc_database* loc_database_handle_get(struct loc_database_handle* handle);
+int loc_database_handle_reload(struct loc_database_handle* handle);
+
+int loc_database_handle_watch(struct loc_database_handle* handle);
+int loc_database_handle_process(struct loc_database_handle* handle);
+
+#endif
@@ -27,8 +27,44 @@
 #include <libloc/country.h>
 #include <libloc/country-list.h>
 
+enum loc_database_flags {
+	// Build an in-memory index that accelerates lookups
+	LOC_DB_FLAGS_POPTRIE = (1 << 0),
+
+	// Build a DIR-24-8 table for IPv4 lookups
+	LOC_DB_FLAGS_DIR24_8 = (1 << 1),
+
+	// Validate the structure of the database once so lookups can skip all checks
+	LOC_DB_FLAGS_VALIDATE = (1 << 2),
+
+	// Copy the network tree into memory in host byte order
+	LOC_DB_FLAGS_COPY_TREE = (1 << 3),
+
+	// Read the entire database from disk when it is being opened
+	LOC_DB_FLAGS_POPULATE = (1 << 4),
+
+	// Lock the network tree and all networks into memory
+	LOC_DB_FLAGS_MLOCK = (1 << 5),
+
+	// Copy the network tree into huge pages (implies LOC_DB_FLAGS_COPY_TREE)
+	LOC_DB_FLAGS_HUGEPAGES = (1 << 6),
+
+	// The database is mostly going to be read from start to end
+	LOC_DB_FLAGS_SEQUENTIAL = (1 << 7),
+
+	// Build a hash table to find ASes by their number
+	LOC_DB_FLAGS_AS_INDEX = (1 << 8),
+};
+
 struct loc_database;
 int loc_database_new(struct loc_ctx* ctx, struct loc_database** database, FILE* f);
+int loc_database_new_with_flags(struct loc_ctx* ctx,
+	struct loc_database** database, FILE* f, int flags);
+int loc_database_new_from_fd(struct loc_ctx* ctx,
+	struct loc_database** database, int fd, int flags);
+int loc_database_new_from_buffer(struct loc_ctx* ctx,
+	struct loc_database** database, const void* buffer, size_t length, int flags,
+	void (*destroy)(void* buffer, size_t length));
 struct loc_database* loc_database_ref(struct loc_database* db);
 struct loc_database* loc_database_unref(struct loc_database* db);
 
@@ -42,14 +78,76 @@ const char* loc_database_get_license(struct loc_database* db);
 int loc_database_get_as(struct loc_database* db, struct loc_as** as, uint32_t number);
 size_t loc_database_count_as(struct loc_database* db);
 
+struct loc_database_as_view {
+	uint32_t number;
+
+	// The name points into the database and must not be used after it has been released
+	const char* name;
+};
+
+int loc_database_get_as_view(struct loc_database* db,
+	uint32_t number, struct loc_database_as_view* view);
+
+struct loc_database_lookup_result {
+	// The first and last address of the matched network
+	struct in6_addr first_address;
+	struct in6_addr last_address;
+
+	// The prefix and family of the matched network
+	unsigned int prefix;
+	int family;
+
+	// Country code (NUL-terminated)
+	char country_code[3];
+
+	// ASN
+	uint32_t asn;
+
+	// Flags
+	enum loc_network_flags flags;
+
+	// The position of the network in the database
+	uint32_t network_index;
+
+	// The range of addresses around the looked up address that have the same result
+	struct in6_addr range_first_address;
+	struct in6_addr range_last_address;
+};
+
+int loc_database_lookup_result(struct loc_database* db,
+		const struct in6_addr* address, struct loc_database_lookup_result* result);
+int loc_database_lookup_range(struct loc_database* db,
+		const struct in6_addr* address, struct loc_database_lookup_result* result);
+int loc_database_lookup4(struct loc_database* db,
+		uint32_t address, struct loc_database_lookup_result* result);
+int loc_database_lookup_batch(struct loc_database* db, const struct in6_addr* addresses,
+		size_t count, struct loc_database_lookup_result* results, size_t* matches);
 int loc_database_lookup(struct loc_database* db,
 		const struct in6_addr* address, struct loc_network** network);
 int loc_database_lookup_from_string(struct loc_database* db,
 		const char* string, struct loc_network** network);
 
+int loc_database_lookup_asn(struct loc_database* db,
+		const struct in6_addr* address, uint32_t* asn);
+int loc_database_lookup_country_code(struct loc_database* db,
+		const struct in6_addr* address, char* country_code);
+int loc_database_lookup_flags(struct loc_database* db,
+		const struct in6_addr* address, enum loc_network_flags* flags);
+
 int loc_database_get_country(struct loc_database* db,
 		struct loc_country** country, const char* code);
 
+struct loc_database_country_view {
+	char code[3];
+	char continent_code[3];
+
+	// The name points into the database and must not be used after it has been released
+	const char* name;
+};
+
+int loc_database_get_country_view(struct loc_database* db,
+		const char* code, struct loc_database_country_view* view);
+
 enum loc_database_enumerator_mode {
 	LOC_DB_ENUMERATE_NETWORKS  = 1,
 	LOC_DB_ENUMERATE_ASES      = 2,
@@ -66,6 +164,7 @@ int loc_database_enumerator_new(struct loc_database_enumerator** enumerator,
 	struct loc_database* db, enum loc_database_enumerator_mode mode, int flags);
 struct loc_database_enumerator* loc_database_enumerator_ref(struct loc_database_enumerator* enumerator);
 struct loc_database_enumerator* loc_database_enumerator_unref(struct loc_database_enumerator* enumerator);
+void loc_database_enumerator_reset(struct loc_database_enumerator* enumerator);
 
 int loc_database_enumerator_set_string(struct loc_database_enumerator* enumerator, const char* string);
 struct loc_country_list* loc_database_enumerator_get_countries(struct loc_database_enumerator* enumerator);
@@ -84,4 +183,29 @@ int loc_database_enumerator_next_network(
 int loc_database_enumerator_next_country(
 	struct loc_database_enumerator* enumerator, struct loc_country** country);
 
+#ifdef LIBLOC_PRIVATE
+
+size_t loc_database_count_networks(struct loc_database* db);
+
+/*
+	A position in the network tree when walking through it one bit at a time
+*/
+struct loc_database_tree_position {
+	uint32_t node;
+
+	// The number of bits that have been skipped before the node that we have consumed
+	unsigned int offset;
+};
+
+int loc_database_tree_root(struct loc_database* db, struct loc_database_tree_position* position);
+int loc_database_tree_child(struct loc_database* db,
+	const struct loc_database_tree_position* position, int bit,
+	struct loc_database_tree_position* child);
+int loc_database_tree_network(struct loc_database* db,
+	const struct loc_database_tree_position* position, uint32_t* network);
+int loc_database_tree_has_children(struct loc_database* db,
+	const struct loc_database_tree_position* position);
+
+#endif
+
 #endif
@@ -0,0 +1,40 @@
+/*
+	libloc - A library to determine the location of someone on the Internet
+
+	Copyright (C) 2017 IPFire Development Team <info@ipfire.org>
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+*/
+
+#ifndef LIBLOC_DIR24_H
+#define LIBLOC_DIR24_H
+
+#ifdef LIBLOC_PRIVATE
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libloc/libloc.h>
+#include <libloc/database.h>
+
+struct loc_dir24;
+int loc_dir24_new(struct loc_ctx* ctx, struct loc_dir24** table, struct loc_database* db);
+
+struct loc_dir24* loc_dir24_ref(struct loc_dir24* table);
+struct loc_dir24* loc_dir24_unref(struct loc_dir24* table);
+
+size_t loc_dir24_get_size(struct loc_dir24* table);
+
+int loc_dir24_lookup(struct loc_dir24* table, uint32_t address,
+	uint32_t* network_index, unsigned int* prefix, uint32_t* first, uint32_t* last);
+
+#endif
+#endif
@@ -25,6 +25,7 @@
 enum loc_database_version {
 	LOC_DATABASE_VERSION_UNSET = 0,
 	LOC_DATABASE_VERSION_1     = 1,
+	LOC_DATABASE_VERSION_2     = 2,
 };
 
 #define LOC_DATABASE_VERSION_LATEST LOC_DATABASE_VERSION_1
@@ -36,6 +37,16 @@ enum loc_database_version {
 #define LOC_DATABASE_PAGE_SIZE		4096
 #define LOC_SIGNATURE_MAX_LENGTH	2048
 
+enum loc_database_header_flags {
+	/*
+		Every empty child of a node inside a network refers to a copy of that network,
+		so that any walk down the tree that is covered by a network ends on a node
+		that carries a network. The copies have no children and are not networks
+		of their own.
+	*/
+	LOC_DATABASE_HEADER_FLAG_LEAF_PUSHED = (1 << 0),
+};
+
 struct loc_database_magic {
 	char magic[7];
 
@@ -82,8 +93,19 @@ struct loc_database_header_v1 {
 	char signature1[LOC_SIGNATURE_MAX_LENGTH];
 	char signature2[LOC_SIGNATURE_MAX_LENGTH];
 
+	// Flags (see enum loc_database_header_flags)
+	uint32_t flags;
+
+	// Tells us where the AS search index starts (optional)
+	uint32_t as_search_offset;
+	uint32_t as_search_length;
+
+	// Tells us where the network index starts (optional)
+	uint32_t network_index_offset;
+	uint32_t network_index_length;
+
 	// Add some padding for future extensions
-	char padding[32];
+	char padding[12];
 };
 
 struct loc_database_network_node_v1 {
@@ -93,6 +115,29 @@ struct loc_database_network_node_v1 {
 	uint32_t network;
 };
 
+/*
+	Version 2 uses the same header as version 1, but the network tree is path-compressed:
+	nodes that have only one child and no network are left out and the bits on their
+	path are stored in the next node instead.
+*/
+#define LOC_DATABASE_NODE_V2_MAX_SKIP	32
+
+struct loc_database_network_node_v2 {
+	uint32_t zero;
+	uint32_t one;
+
+	uint32_t network;
+
+	// The bits that have been skipped before reaching this node (aligned to the left)
+	uint32_t bits;
+
+	// The number of skipped bits
+	uint8_t skip;
+
+	// Reserved
+	char padding[3];
+};
+
 struct loc_database_network_v1 {
 	// The start address and prefix will be encoded in the tree
 
@@ -117,6 +162,65 @@ struct loc_database_as_v1 {
 	uint32_t name;
 };
 
+/*
+	The AS search index maps every trigram (three consecutive characters in lower case)
+	in the names of all ASes to the positions of all ASes whose name contains it.
+
+	The section starts with the number of trigrams, followed by all trigrams in
+	ascending order, followed by their lists of AS positions (in ascending order).
+	Trigrams with any characters outside of ASCII are not indexed.
+*/
+struct loc_database_as_search_v1 {
+	// The number of trigrams
+	uint32_t trigrams;
+};
+
+struct loc_database_as_trigram_v1 {
+	char trigram[3];
+
+	// Reserved
+	char padding[1];
+
+	// The first AS position of this trigram and how many there are
+	uint32_t offset;
+	uint32_t count;
+};
+
+/*
+	The network index lists all networks of each country and each AS so that
+	they can be found without walking through the entire tree.
+
+	The section starts with the number of countries and ASes, followed by all
+	countries and all ASes in ascending order, followed by their lists of networks.
+	Each list is in the same order as the networks appear in the tree.
+*/
+struct loc_database_network_index_v1 {
+	// The number of countries and ASes
+	uint32_t countries;
+	uint32_t asns;
+};
+
+struct loc_database_network_index_key_v1 {
+	// The country code (in the lower two bytes) or the ASN
+	uint32_t key;
+
+	// The first network of this key and how many there are
+	uint32_t offset;
+	uint32_t count;
+};
+
+struct loc_database_network_index_ref_v1 {
+	// The address and prefix of the network like it is stored in the tree
+	uint8_t address[16];
+	uint8_t prefix;
+
+	// Reserved
+	char padding[3];
+
+	// The position of the network
+	uint32_t network;
+};
+
 struct loc_database_country_v1 {
 	char code[2];
 	char continent_code[2];
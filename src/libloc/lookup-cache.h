@@ -0,0 +1,40 @@
+/*
+	libloc - A library to determine the location of someone on the Internet
+
+	Copyright (C) 2017 IPFire Development Team <info@ipfire.org>
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+*/
+
+#ifndef LIBLOC_LOOKUP_CACHE_H
+#define LIBLOC_LOOKUP_CACHE_H
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libloc/libloc.h>
+#include <libloc/database.h>
+
+struct loc_lookup_cache;
+int loc_lookup_cache_new(struct loc_ctx* ctx, struct loc_lookup_cache** cache,
+	struct loc_database* db, size_t size);
+struct loc_lookup_cache* loc_lookup_cache_ref(struct loc_lookup_cache* cache);
+struct loc_lookup_cache* loc_lookup_cache_unref(struct loc_lookup_cache* cache);
+
+int loc_lookup_cache_lookup(struct loc_lookup_cache* cache,
+	const struct in6_addr* address, struct loc_database_lookup_result* result);
+
+uint64_t loc_lookup_cache_get_hits(struct loc_lookup_cache* cache);
+uint64_t loc_lookup_cache_get_misses(struct loc_lookup_cache* cache);
+void loc_lookup_cache_clear(struct loc_lookup_cache* cache);
+
+#endif
@@ -0,0 +1,41 @@
+/*
+	libloc - A library to determine the location of someone on the Internet
+
+	Copyright (C) 2017 IPFire Development Team <info@ipfire.org>
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+*/
+
+#ifndef LIBLOC_POPTRIE_H
+#define LIBLOC_POPTRIE_H
+
+#ifdef LIBLOC_PRIVATE
+
+#include <netinet/in.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include <libloc/libloc.h>
+#include <libloc/database.h>
+
+struct loc_poptrie;
+int loc_poptrie_new(struct loc_ctx* ctx, struct loc_poptrie** trie, struct loc_database* db);
+
+struct loc_poptrie* loc_poptrie_ref(struct loc_poptrie* trie);
+struct loc_poptrie* loc_poptrie_unref(struct loc_poptrie* trie);
+
+size_t loc_poptrie_get_size(struct loc_poptrie* trie);
+
+int loc_poptrie_lookup(struct loc_poptrie* trie, const struct in6_addr* address,
+	uint32_t* network_index, unsigned int* prefix, struct in6_addr* first, struct in6_addr* last);
+
+#endif
+#endif
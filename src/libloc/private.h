@@ -52,6 +52,17 @@ loc_log_null(struct loc_ctx *ctx, const char *format, ...) {}
 
 #define LOC_EXPORT __attribute__ ((visibility("default")))
 
+/*
+	Objects might be shared between threads, so references must be counted atomically
+*/
+static inline int loc_refcount_inc(int* refcount) {
+	return __atomic_add_fetch(refcount, 1, __ATOMIC_RELAXED);
+}
+
+static inline int loc_refcount_dec(int* refcount) {
+	return __atomic_sub_fetch(refcount, 1, __ATOMIC_ACQ_REL);
+}
+
 void loc_log(struct loc_ctx *ctx,
 	int priority, const char *file, int line, const char *fn,
 	const char *format, ...) __attribute__((format(printf, 6, 7)));
@@ -25,6 +25,21 @@
 #include <libloc/database.h>
 #include <libloc/network.h>
 
+enum loc_writer_flags {
+	// Lay out the network tree in subtrees that fit into cache lines and pages
+	LOC_WRITER_FLAGS_CLUSTER_TREE = (1 << 0),
+
+	// Push networks into all empty children of the nodes below them
+	// (only possible with LOC_DATABASE_VERSION_2 or later)
+	LOC_WRITER_FLAGS_PUSH_LEAVES  = (1 << 1),
+
+	// Write an index to search ASes by their name
+	LOC_WRITER_FLAGS_SEARCH_INDEX = (1 << 2),
+
+	// Write an index of all networks by country and ASN
+	LOC_WRITER_FLAGS_NETWORK_INDEX = (1 << 3),
+};
+
 struct loc_writer;
 
 int loc_writer_new(struct loc_ctx* ctx, struct loc_writer** writer,
@@ -33,6 +48,9 @@ int loc_writer_new(struct loc_ctx* ctx, struct loc_writer** writer,
 struct loc_writer* loc_writer_ref(struct loc_writer* writer);
 struct loc_writer* loc_writer_unref(struct loc_writer* writer);
 
+int loc_writer_get_flags(struct loc_writer* writer);
+int loc_writer_set_flags(struct loc_writer* writer, int flags);
+
 const char* loc_writer_get_vendor(struct loc_writer* writer);
 int loc_writer_set_vendor(struct loc_writer* writer, const char* vendor);
 const char* loc_writer_get_description(struct loc_writer* writer);
@@ -0,0 +1,219 @@
+/*
+	libloc - A library to determine the location of someone on the Internet
+
+	Copyright (C) 2017 IPFire Development Team <info@ipfire.org>
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+*/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <libloc/libloc.h>
+#include <libloc/address.h>
+#include <libloc/database.h>
+#include <libloc/lookup-cache.h>
+#include <libloc/private.h>
+
+/*
+	This cache remembers the results of recent lookups (including those that
+	did not find anything) together with the range of addresses they are valid
+	for, so that any other address in the same range can be answered without
+	walking the tree again.
+
+	It is set-associative: every address is mapped to a set by its /24 (IPv4)
+	or /48 (IPv6) and the least recently used entry of that set is replaced.
+
+	A cache is not thread-safe, but every thread can have its own.
+*/
+
+#define LOC_LOOKUP_CACHE_WAYS	4
+
+struct loc_lookup_cache_entry {
+	struct loc_database_lookup_result result;
+
+	// When this entry has been used last
+	uint64_t used;
+};
+
+struct loc_lookup_cache {
+	struct loc_ctx* ctx;
+	int refcount;
+
+	struct loc_database* db;
+
+	struct loc_lookup_cache_entry* entries;
+	size_t sets;
+
+	// A counter to find the least recently used entry
+	uint64_t clock;
+
+	// Statistics
+	uint64_t hits;
+	uint64_t misses;
+};
+
+static void loc_lookup_cache_free(struct loc_lookup_cache* cache) {
+	DEBUG(cache->ctx, "Releasing lookup cache %p\n", cache);
+
+	if (cache->entries)
+		free(cache->entries);
+
+	if (cache->db)
+		loc_database_unref(cache->db);
+
+	loc_unref(cache->ctx);
+	free(cache);
+}
+
+LOC_EXPORT int loc_lookup_cache_new(struct loc_ctx* ctx, struct loc_lookup_cache** cache,
+		struct loc_database* db, size_t size) {
+	if (!db || !size) {
+		errno = EINVAL;
+		return 1;
+	}
+
+	struct loc_lookup_cache* c = calloc(1, sizeof(*c));
+	if (!c)
+		return 1;
+
+	c->ctx = loc_ref(ctx);
+	c->refcount = 1;
+
+	c->db = loc_database_ref(db);
+
+	// Round up to the next power of two
+	c->sets = 1;
+	while (c->sets * LOC_LOOKUP_CACHE_WAYS < size)
+		c->sets <<= 1;
+
+	c->entries = calloc(c->sets * LOC_LOOKUP_CACHE_WAYS, sizeof(*c->entries));
+	if (!c->entries) {
+		loc_lookup_cache_free(c);
+		return 1;
+	}
+
+	DEBUG(ctx, "Lookup cache allocated at %p with %zu entries\n",
+		c, c->sets * LOC_LOOKUP_CACHE_WAYS);
+
+	*cache = c;
+	return 0;
+}
+
+LOC_EXPORT struct loc_lookup_cache* loc_lookup_cache_ref(struct loc_lookup_cache* cache) {
+	loc_refcount_inc(&cache->refcount);
+
+	return cache;
+}
+
+LOC_EXPORT struct loc_lookup_cache* loc_lookup_cache_unref(struct loc_lookup_cache* cache) {
+	if (loc_refcount_dec(&cache->refcount) > 0)
+		return cache;
+
+	loc_lookup_cache_free(cache);
+
+	return NULL;
+}
+
+/*
+	Returns the first entry of the set the address belongs to
+*/
+static struct loc_lookup_cache_entry* loc_lookup_cache_get_set(
+		struct loc_lookup_cache* cache, const struct in6_addr* address) {
+	uint64_t key;
+
+	// Use the /24 for IPv4
+	if (IN6_IS_ADDR_V4MAPPED(address))
+		key = (1ULL << 63) | (ntohl(address->s6_addr32[3]) >> 8);
+
+	// Use the /48 for IPv6
+	else
+		key = ((uint64_t)ntohl(address->s6_addr32[0]) << 16)
+			| (ntohl(address->s6_addr32[1]) >> 16);
+
+	// Mix all bits into the upper half
+	key *= 0x9e3779b97f4a7c15ULL;
+
+	return cache->entries + ((key >> 32) & (cache->sets - 1)) * LOC_LOOKUP_CACHE_WAYS;
+}
+
+static inline int loc_lookup_cache_entry_matches(
+		const struct loc_lookup_cache_entry* entry, const struct in6_addr* address) {
+	// Skip empty entries
+	if (!entry->used)
+		return 0;
+
+	return loc_address_cmp(&entry->result.range_first_address, address) <= 0
+		&& loc_address_cmp(address, &entry->result.range_last_address) <= 0;
+}
+
+/*
+	Looks up an address like loc_database_lookup_result() but answers
+	from the cache if possible.
+
+	Returns 0 if a network was found, 1 if there was no match and -1 on error.
+*/
+LOC_EXPORT int loc_lookup_cache_lookup(struct loc_lookup_cache* cache,
+		const struct in6_addr* address, struct loc_database_lookup_result* result) {
+	struct loc_lookup_cache_entry* set = loc_lookup_cache_get_set(cache, address);
+	struct loc_lookup_cache_entry* victim = set;
+	int r;
+
+	for (unsigned int i = 0; i < LOC_LOOKUP_CACHE_WAYS; i++) {
+		struct loc_lookup_cache_entry* entry = &set[i];
+
+		if (loc_lookup_cache_entry_matches(entry, address)) {
+			entry->used = ++cache->clock;
+			cache->hits++;
+
+			*result = entry->result;
+
+			// Cached lookups might not have found anything
+			return (result->family == AF_UNSPEC);
+		}
+
+		// Find the least recently used entry (empty entries have never been used)
+		if (entry->used < victim->used)
+			victim = entry;
+	}
+
+	cache->misses++;
+
+	r = loc_database_lookup_result(cache->db, address, result);
+	if (r < 0)
+		return r;
+
+	// Remember the result for its entire range
+	victim->result = *result;
+	victim->used = ++cache->clock;
+
+	return r;
+}
+
+LOC_EXPORT uint64_t loc_lookup_cache_get_hits(struct loc_lookup_cache* cache) {
+	return cache->hits;
+}
+
+LOC_EXPORT uint64_t loc_lookup_cache_get_misses(struct loc_lookup_cache* cache) {
+	return cache->misses;
+}
+
+LOC_EXPORT void loc_lookup_cache_clear(struct loc_lookup_cache* cache) {
+	memset(cache->entries, 0, sizeof(*cache->entries) * cache->sets * LOC_LOOKUP_CACHE_WAYS);
+
+	cache->clock = 0;
+	cache->hits = 0;
+	cache->misses = 0;
+}
@@ -67,7 +67,7 @@ LOC_EXPORT int loc_network_list_new(struct loc_ctx* ctx,
 }
 
 LOC_EXPORT struct loc_network_list* loc_network_list_ref(struct loc_network_list* list) {
-	list->refcount++;
+	loc_refcount_inc(&list->refcount);
 
 	return list;
 }
@@ -83,7 +83,7 @@ static void loc_network_list_free(struct loc_network_list* list) {
 }
 
 LOC_EXPORT struct loc_network_list* loc_network_list_unref(struct loc_network_list* list) {
-	if (--list->refcount > 0)
+	if (loc_refcount_dec(&list->refcount) > 0)
 		return list;
 
 	loc_network_list_free(list);
@@ -103,7 +103,7 @@ LOC_EXPORT int loc_network_new_from_string(struct loc_ctx* ctx,
 }
 
 LOC_EXPORT struct loc_network* loc_network_ref(struct loc_network* network) {
-	network->refcount++;
+	loc_refcount_inc(&network->refcount);
 
 	return network;
 }
@@ -116,7 +116,7 @@ static void loc_network_free(struct loc_network* network) {
 }
 
 LOC_EXPORT struct loc_network* loc_network_unref(struct loc_network* network) {
-	if (--network->refcount > 0)
+	if (loc_refcount_dec(&network->refcount) > 0)
 		return network;
 
 	loc_network_free(network);
@@ -732,7 +732,7 @@ static void loc_network_tree_free(struct loc_network_tree* tree) {
 }
 
 struct loc_network_tree* loc_network_tree_unref(struct loc_network_tree* tree) {
-	if (--tree->refcount > 0)
+	if (loc_refcount_dec(&tree->refcount) > 0)
 		return tree;
 
 	loc_network_tree_free(tree);
@@ -831,7 +831,7 @@ int loc_network_tree_node_new(struct loc_ctx* ctx, struct loc_network_tree_node*
 
 struct loc_network_tree_node* loc_network_tree_node_ref(struct loc_network_tree_node* node) {
 	if (node)
-		node->refcount++;
+		loc_refcount_inc(&node->refcount);
 
 	return node;
 }
@@ -853,7 +853,7 @@ static void loc_network_tree_node_free(struct loc_network_tree_node* node) {
 }
 
 struct loc_network_tree_node* loc_network_tree_node_unref(struct loc_network_tree_node* node) {
-	if (--node->refcount > 0)
+	if (loc_refcount_dec(&node->refcount) > 0)
 		return node;
 
 	loc_network_tree_node_free(node);
@@ -7,10 +7,18 @@
 #include <string.h>
 
 #include <libloc/libloc.h>
+#include <libloc/address.h>
 #include <libloc/database.h>
 #include <libloc/network.h>
 #include <libloc/country.h>
 
+/*
+	Parses a single IP address
+*/
+static int parse_address(struct in6_addr* address, const char* string) {
+	return loc_address_parse_buffer(address, NULL, string, strlen(string));
+}
+
 MODULE = Location		PACKAGE = Location
 
 struct loc_database *
@@ -168,15 +176,16 @@ lookup_country_code(db, address)
 	CODE:
 		RETVAL = &PL_sv_undef;
 
-		// Lookup network
-		struct loc_network *network;
-		int err = loc_database_lookup_from_string(db, address, &network);
+		// Parse the address
+		struct in6_addr in6;
+		if (parse_address(&in6, address))
+			XSRETURN_UNDEF;
+
+		// Lookup the country code
+		char country_code[3];
+		int err = loc_database_lookup_country_code(db, &in6, country_code);
 		if (!err) {
-			// Extract the country code
-			const char* country_code = loc_network_get_country_code(network);
 			RETVAL = newSVpv(country_code, strlen(country_code));
-
-			loc_network_unref(network);
 		}
 	OUTPUT:
 		RETVAL
@@ -203,17 +212,20 @@ lookup_network_has_flag(db, address, flag)
 		else
 			croak("Invalid flag");
 
-		// Lookup network
-		struct loc_network *network;
-		int err = loc_database_lookup_from_string(db, address, &network);
+		// Parse the address
+		struct in6_addr in6;
+		if (parse_address(&in6, address))
+			XSRETURN_NO;
+
+		// Lookup the flags
+		enum loc_network_flags flags;
+		int err = loc_database_lookup_flags(db, &in6, &flags);
 
 		if (!err) {
 			// Check if the network has the given flag.
-			if (loc_network_has_flag(network, iv)) {
+			if (flags & iv) {
 				RETVAL = true;
 			}
-
-			loc_network_unref(network);
 		}
 
 	OUTPUT:
@@ -227,17 +239,18 @@ lookup_asn(db, address)
 	CODE:
 		RETVAL = &PL_sv_undef;
 
-		// Lookup network
-		struct loc_network *network;
-		int err = loc_database_lookup_from_string(db, address, &network);
+		// Parse the address
+		struct in6_addr in6;
+		if (parse_address(&in6, address))
+			XSRETURN_UNDEF;
+
+		// Lookup the ASN
+		uint32_t as_number;
+		int err = loc_database_lookup_asn(db, &in6, &as_number);
 		if (!err) {
-			// Extract the ASN
-			unsigned int as_number = loc_network_get_asn(network);
 			if (as_number > 0) {
 				RETVAL = newSViv(as_number);
 			}
-
-			loc_network_unref(network);
 		}
 	OUTPUT:
 		RETVAL
@@ -254,14 +267,11 @@ get_country_name(db, ccode)
 		RETVAL = &PL_sv_undef;
 
 		// Lookup country code
-		struct loc_country *country;
-		int err = loc_database_get_country(db, &country, ccode);
+		struct loc_database_country_view country;
+		int err = loc_database_get_country_view(db, ccode, &country);
 		if(!err) {
-			// Extract the name for the given country code.
-			const char* country_name = loc_country_get_name(country);
-			RETVAL = newSVpv(country_name, strlen(country_name));
-
-			loc_country_unref(country);
+			// Copy the name for the given country code.
+			RETVAL = newSVpv(country.name, strlen(country.name));
 		}
 
 	OUTPUT:
@@ -276,14 +286,11 @@ get_continent_code(db, ccode)
 		RETVAL = &PL_sv_undef;
 
 		// Lookup country code
-		struct loc_country *country;
-		int err = loc_database_get_country(db, &country, ccode);
+		struct loc_database_country_view country;
+		int err = loc_database_get_country_view(db, ccode, &country);
 		if(!err) {
-			//Extract the continent code for the given country code.
-			const char* continent_code =  loc_country_get_continent_code(country);
-			RETVAL = newSVpv(continent_code, strlen(continent_code));
-
-			loc_country_unref(country);
+			// Copy the continent code for the given country code.
+			RETVAL = newSVpv(country.continent_code, strlen(country.continent_code));
 		}
 
 	OUTPUT:
@@ -298,15 +305,11 @@ get_as_name(db, as_number)
 		RETVAL = &PL_sv_undef;
 
 		// Lookup AS.
-		struct loc_as *as;
-		int err = loc_database_get_as(db, &as, as_number);
+		struct loc_database_as_view as;
+		int err = loc_database_get_as_view(db, as_number, &as);
 		if(!err) {
-			// Get the name of the given AS number.
-			const char* as_name = loc_as_get_name(as);
-
-			RETVAL = newSVpv(as_name, strlen(as_name));
-
-			loc_as_unref(as);
+			// Copy the name of the given AS number.
+			RETVAL = newSVpv(as.name, strlen(as.name));
 		}
 
 	OUTPUT:
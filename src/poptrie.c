@@ -0,0 +1,624 @@
+/*
+	libloc - A library to determine the location of someone on the Internet
+
+	Copyright (C) 2017 IPFire Development Team <info@ipfire.org>
+
+	This library is free software; you can redistribute it and/or
+	modify it under the terms of the GNU Lesser General Public
+	License as published by the Free Software Foundation; either
+	version 2.1 of the License, or (at your option) any later version.
+
+	This library is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+	Lesser General Public License for more details.
+*/
+
+#include <errno.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <libloc/libloc.h>
+#include <libloc/address.h>
+#include <libloc/compat.h>
+#include <libloc/database.h>
+#include <libloc/poptrie.h>
+#include <libloc/private.h>
+
+/*
+	This is an in-memory copy of the network tree that is optimised for lookups.
+
+	The binary tree in the database needs one memory access for every bit of the
+	address. Here, we resolve the first 16 bits with a direct lookup table and then
+	consume the address in strides of six bits. Each node has a bitmap of its 64
+	possible children and another one for its leaves. Children and leaves are
+	stored consecutively so that their position can be computed with popcount.
+
+	IPv4 addresses have their own table so that they can skip the 96 bits
+	of the mapped prefix.
+
+	Leaves store the index of the network plus one so that zero means no match.
+*/
+
+#define LOC_POPTRIE_DIRECT_BITS	16
+#define LOC_POPTRIE_STRIDE		6
+
+// Marks a direct table entry as pointing to a node
+#define LOC_POPTRIE_NODE		(1U << 31)
+
+// There is no node in the database tree
+#define LOC_POPTRIE_NONE		UINT32_MAX
+
+// The walk has reached the IPv4 part of the tree
+#define LOC_POPTRIE_IPV4		(UINT32_MAX - 1)
+
+struct loc_poptrie_node {
+	uint64_t vector;
+	uint64_t leafvec;
+	uint32_t base0;
+	uint32_t base1;
+};
+
+struct loc_poptrie_root {
+	uint32_t table[1 << LOC_POPTRIE_DIRECT_BITS];
+	unsigned int depth;
+};
+
+struct loc_poptrie {
+	struct loc_ctx* ctx;
+	int refcount;
+
+	struct loc_poptrie_root root6;
+	struct loc_poptrie_root root4;
+
+	struct loc_poptrie_node* nodes;
+	size_t nodes_count;
+	size_t nodes_size;
+
+	uint32_t* leaves;
+	size_t leaves_count;
+	size_t leaves_size;
+
+	// The prefix of each network
+	uint8_t* prefixes;
+	size_t networks_count;
+
+	// The database that we are building from
+	struct loc_database* db;
+
+	// The position where the IPv4 part of the tree starts
+	struct loc_database_tree_position node4;
+};
+
+static inline unsigned int loc_poptrie_bits(const uint64_t address[2],
+		unsigned int offset, unsigned int length) {
+	const unsigned int word = offset / 64;
+	const unsigned int shift = offset % 64;
+
+	uint64_t bits = address[word] << shift;
+
+	// Fetch the rest from the next word
+	if (shift + length > 64)
+		bits |= address[1] >> (64 - shift);
+
+	return bits >> (64 - length);
+}
+
+static inline unsigned int loc_poptrie_stride(unsigned int depth) {
+	if (depth + LOC_POPTRIE_STRIDE > 128)
+		return 128 - depth;
+
+	return LOC_POPTRIE_STRIDE;
+}
+
+static int loc_poptrie_grow(void** data, size_t* size, size_t required, size_t length) {
+	if (required <= *size)
+		return 0;
+
+	size_t s = *size ? *size : 1024;
+	while (s < required)
+		s *= 2;
+
+	void* p = realloc(*data, s * length);
+	if (!p)
+		return 1;
+
+	*data = p;
+	*size = s;
+
+	return 0;
+}
+
+static int loc_poptrie_alloc_nodes(struct loc_poptrie* trie, size_t count, uint32_t* index) {
+	int r = loc_poptrie_grow((void**)&trie->nodes, &trie->nodes_size,
+		trie->nodes_count + count, sizeof(*trie->nodes));
+	if (r)
+		return r;
+
+	*index = trie->nodes_count;
+	trie->nodes_count += count;
+
+	return 0;
+}
+
+static inline int loc_poptrie_is_node4(struct loc_poptrie* trie,
+		const struct loc_database_tree_position* position) {
+	return position->node == trie->node4.node && position->offset == trie->node4.offset;
+}
+
+/*
+	Remembers the network on the node (if any) as the most specific one
+*/
+static int loc_poptrie_visit(struct loc_poptrie* trie,
+		const struct loc_database_tree_position* position, unsigned int depth, uint32_t* leaf) {
+	uint32_t network;
+	int r;
+
+	r = loc_database_tree_network(trie->db, position, &network);
+	if (r < 0)
+		return r;
+
+	// This node has no network
+	else if (r)
+		return 0;
+
+	if (network >= trie->networks_count) {
+		errno = ERANGE;
+		return 1;
+	}
+
+	// Leaf-pushed trees repeat the network further down
+	if (*leaf == network + 1)
+		return 0;
+
+	trie->prefixes[network] = depth;
+	*leaf = network + 1;
+
+	return 0;
+}
+
+/*
+	Follows the database tree for length bits of pattern starting at position
+*/
+static int loc_poptrie_walk(struct loc_poptrie* trie, struct loc_database_tree_position* position,
+		unsigned int depth, unsigned int pattern, unsigned int length, uint32_t* leaf) {
+	struct loc_database_tree_position child;
+	int r;
+
+	for (unsigned int i = 0; i < length; i++) {
+		if (position->node == LOC_POPTRIE_NONE || position->node == LOC_POPTRIE_IPV4)
+			break;
+
+		r = loc_database_tree_child(trie->db, position,
+			(pattern >> (length - i - 1)) & 1, &child);
+		if (r < 0)
+			return r;
+
+		// The tree ends here
+		if (r) {
+			position->node = LOC_POPTRIE_NONE;
+			break;
+		}
+
+		// The IPv4 part of the tree lives in its own table
+		if (loc_poptrie_is_node4(trie, &child)) {
+			position->node = LOC_POPTRIE_IPV4;
+			break;
+		}
+
+		*position = child;
+
+		r = loc_poptrie_visit(trie, position, depth + i + 1, leaf);
+		if (r)
+			return r;
+	}
+
+	return 0;
+}
+
+/*
+	Returns true if we have to create a node to continue the walk
+*/
+static int loc_poptrie_has_children(struct loc_poptrie* trie,
+		const struct loc_database_tree_position* position) {
+	if (position->node == LOC_POPTRIE_NONE || position->node == LOC_POPTRIE_IPV4)
+		return 0;
+
+	return loc_database_tree_has_children(trie->db, position);
+}
+
+static int loc_poptrie_build_node(struct loc_poptrie* trie, uint32_t index,
+		const struct loc_database_tree_position* node, unsigned int depth, uint32_t leaf) {
+	const unsigned int stride = loc_poptrie_stride(depth);
+	struct loc_database_tree_position child_nodes[1 << LOC_POPTRIE_STRIDE];
+	uint32_t child_leaves[1 << LOC_POPTRIE_STRIDE];
+	uint32_t leaves[1 << LOC_POPTRIE_STRIDE];
+	unsigned int children = 0;
+	struct loc_poptrie_node n = {};
+	uint32_t last_leaf = 0;
+	int last_was_leaf = 0;
+	size_t count = 0;
+	int r;
+
+	for (unsigned int i = 0; i < (1U << stride); i++) {
+		struct loc_database_tree_position child_node = *node;
+		uint32_t child_leaf = leaf;
+
+		r = loc_poptrie_walk(trie, &child_node, depth, i, stride, &child_leaf);
+		if (r)
+			return r;
+
+		r = loc_poptrie_has_children(trie, &child_node);
+		if (r < 0)
+			return r;
+
+		// Continue in a child node
+		if (r) {
+			n.vector |= (1ULL << i);
+
+			child_nodes[children] = child_node;
+			child_leaves[children] = child_leaf;
+			children++;
+
+			last_was_leaf = 0;
+
+		// Give the IPv4 part of the tree its own leaf so that it is never merged
+		// with any other leaves and no range runs into ::ffff:0:0/96
+		} else if (child_node.node == LOC_POPTRIE_IPV4) {
+			n.leafvec |= (1ULL << i);
+			leaves[count++] = child_leaf;
+
+			last_was_leaf = 0;
+
+		// Store a leaf, but only if it is different from the one before
+		} else {
+			if (!last_was_leaf || child_leaf != last_leaf) {
+				n.leafvec |= (1ULL << i);
+				leaves[count++] = child_leaf;
+			}
+
+			last_leaf = child_leaf;
+			last_was_leaf = 1;
+		}
+	}
+
+	// Store the leaves
+	r = loc_poptrie_grow((void**)&trie->leaves, &trie->leaves_size,
+		trie->leaves_count + count, sizeof(*trie->leaves));
+	if (r)
+		return r;
+
+	n.base0 = trie->leaves_count;
+	memcpy(trie->leaves + trie->leaves_count, leaves, count * sizeof(*leaves));
+	trie->leaves_count += count;
+
+	// Allocate all children next to each other
+	r = loc_poptrie_alloc_nodes(trie, children, &n.base1);
+	if (r)
+		return r;
+
+	trie->nodes[index] = n;
+
+	// Build all children
+	for (unsigned int i = 0; i < children; i++) {
+		r = loc_poptrie_build_node(trie, n.base1 + i,
+			&child_nodes[i], depth + stride, child_leaves[i]);
+		if (r)
+			return r;
+	}
+
+	return 0;
+}
+
+static int loc_poptrie_build_root(struct loc_poptrie* trie, struct loc_poptrie_root* root,
+		const struct loc_database_tree_position* node, unsigned int depth, uint32_t leaf) {
+	uint32_t index;
+	int r;
+
+	root->depth = depth;
+
+	for (unsigned int i = 0; i < (1U << LOC_POPTRIE_DIRECT_BITS); i++) {
+		struct loc_database_tree_position child_node = *node;
+		uint32_t child_leaf = leaf;
+
+		r = loc_poptrie_walk(trie, &child_node, depth, i, LOC_POPTRIE_DIRECT_BITS, &child_leaf);
+		if (r)
+			return r;
+
+		r = loc_poptrie_has_children(trie, &child_node);
+		if (r < 0)
+			return r;
+
+		// Store the leaf
+		if (!r) {
+			root->table[i] = child_leaf;
+			continue;
+		}
+
+		r = loc_poptrie_alloc_nodes(trie, 1, &index);
+		if (r)
+			return r;
+
+		r = loc_poptrie_build_node(trie, index, &child_node,
+			depth + LOC_POPTRIE_DIRECT_BITS, child_leaf);
+		if (r)
+			return r;
+
+		root->table[i] = LOC_POPTRIE_NODE | index;
+	}
+
+	return 0;
+}
+
+static int loc_poptrie_build(struct loc_poptrie* trie) {
+	const struct in6_addr mapped = { .s6_addr = {
+		0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0xff, 0xff } };
+	struct loc_database_tree_position node;
+	uint32_t leaf = 0;
+	int r;
+
+	trie->node4.node = LOC_POPTRIE_NONE;
+
+	r = loc_database_tree_root(trie->db, &node);
+	if (r < 0)
+		return r;
+
+	// An empty tree has no root
+	else if (r)
+		node.node = LOC_POPTRIE_NONE;
+
+	else {
+		r = loc_poptrie_visit(trie, &node, 0, &leaf);
+		if (r)
+			return r;
+	}
+
+	struct loc_database_tree_position node4 = node;
+	uint32_t leaf4 = leaf;
+
+	// Find the start of the IPv4 part of the tree
+	for (unsigned int i = 0; i < 96; i++) {
+		r = loc_poptrie_walk(trie, &node4, i, loc_address_get_bit(&mapped, i), 1, &leaf4);
+		if (r)
+			return r;
+	}
+
+	trie->node4 = node4;
+
+	r = loc_poptrie_build_root(trie, &trie->root4, &node4, 96, leaf4);
+	if (r)
+		return r;
+
+	return loc_poptrie_build_root(trie, &trie->root6, &node, 0, leaf);
+}
+
+static void loc_poptrie_free(struct loc_poptrie* trie) {
+	DEBUG(trie->ctx, "Releasing poptrie %p\n", trie);
+
+	if (trie->nodes)
+		free(trie->nodes);
+
+	if (trie->leaves)
+		free(trie->leaves);
+
+	if (trie->prefixes)
+		free(trie->prefixes);
+
+	loc_unref(trie->ctx);
+	free(trie);
+}
+
+int loc_poptrie_new(struct loc_ctx* ctx, struct loc_poptrie** trie, struct loc_database* db) {
+	const size_t networks_count = loc_database_count_networks(db);
+	int r = 1;
+
+	// We cannot address more networks than that
+	if (networks_count >= LOC_POPTRIE_NODE) {
+		errno = EFBIG;
+		return 1;
+	}
+
+	struct loc_poptrie* t = calloc(1, sizeof(*t));
+	if (!t)
+		return 1;
+
+	t->ctx = loc_ref(ctx);
+	t->refcount = 1;
+
+	t->db = db;
+	t->networks_count = networks_count;
+
+	t->prefixes = calloc(networks_count ? networks_count : 1, sizeof(*t->prefixes));
+	if (!t->prefixes)
+		goto ERROR;
+
+	clock_t start = clock();
+
+	r = loc_poptrie_build(t);
+	if (r) {
+		ERROR(ctx, "Could not build poptrie: %m\n");
+		goto ERROR;
+	}
+
+	clock_t end = clock();
+
+	// We do not need the database any more
+	t->db = NULL;
+
+	INFO(ctx, "Built poptrie with %zu node(s) and %zu leaves (%zu bytes) in %.4fms\n",
+		t->nodes_count, t->leaves_count, loc_poptrie_get_size(t),
+		(double)(end - start) / CLOCKS_PER_SEC * 1000);
+
+	*trie = t;
+	return 0;
+
+ERROR:
+	loc_poptrie_free(t);
+
+	return r;
+}
+
+struct loc_poptrie* loc_poptrie_ref(struct loc_poptrie* trie) {
+	loc_refcount_inc(&trie->refcount);
+
+	return trie;
+}
+
+struct loc_poptrie* loc_poptrie_unref(struct loc_poptrie* trie) {
+	if (loc_refcount_dec(&trie->refcount) > 0)
+		return NULL;
+
+	loc_poptrie_free(trie);
+
+	return NULL;
+}
+
+/*
+	Returns how much memory this poptrie uses
+*/
+size_t loc_poptrie_get_size(struct loc_poptrie* trie) {
+	return sizeof(*trie)
+		+ trie->nodes_count * sizeof(*trie->nodes)
+		+ trie->leaves_count * sizeof(*trie->leaves)
+		+ trie->networks_count * sizeof(*trie->prefixes);
+}
+
+/*
+	Stores the range of addresses that start with the first depth bits of the
+	address, followed by any value between from and to in the next length bits.
+*/
+static void loc_poptrie_range(const uint64_t a[2], unsigned int depth, unsigned int length,
+		uint64_t from, uint64_t to, struct in6_addr* first, struct in6_addr* last) {
+	const unsigned int end = depth + length;
+	uint64_t f[2], l[2];
+
+	// Keep the first depth bits
+	for (unsigned int i = 0; i < 2; i++) {
+		const unsigned int keep = (depth > i * 64) ? depth - i * 64 : 0;
+
+		if (keep >= 64)
+			f[i] = a[i];
+		else if (keep)
+			f[i] = a[i] & ~(UINT64_MAX >> keep);
+		else
+			f[i] = 0;
+
+		l[i] = f[i];
+	}
+
+	// Insert the values so that their last bit ends up at bit end - 1
+	const unsigned int shift = 128 - end;
+
+	if (shift >= 64) {
+		f[0] |= from << (shift - 64);
+		l[0] |= to   << (shift - 64);
+	} else {
+		f[1] |= from << shift;
+		l[1] |= to   << shift;
+
+		if (shift) {
+			f[0] |= from >> (64 - shift);
+			l[0] |= to   >> (64 - shift);
+		}
+	}
+
+	// Set all remaining bits of the last address
+	if (end < 64)
+		l[0] |= UINT64_MAX >> end;
+
+	if (end <= 64)
+		l[1] = UINT64_MAX;
+	else if (end < 128)
+		l[1] |= UINT64_MAX >> (end - 64);
+
+	f[0] = htobe64(f[0]);
+	f[1] = htobe64(f[1]);
+	l[0] = htobe64(l[0]);
+	l[1] = htobe64(l[1]);
+
+	memcpy(first->s6_addr, f, sizeof(f));
+	memcpy(last->s6_addr, l, sizeof(l));
+}
+
+/*
+	Looks up the address and sets first and last to the range of addresses
+	that share the same leaf.
+
+	Returns 0 if a network was found, 1 if there was no match.
+*/
+int loc_poptrie_lookup(struct loc_poptrie* trie, const struct in6_addr* address,
+		uint32_t* network_index, unsigned int* prefix, struct in6_addr* first, struct in6_addr* last) {
+	const struct loc_poptrie_root* root = &trie->root6;
+	const struct loc_poptrie_node* node = NULL;
+	uint64_t a[2];
+	uint32_t leaf;
+
+	// Load the address in host byte order
+	memcpy(a, address->s6_addr, sizeof(a));
+	a[0] = be64toh(a[0]);
+	a[1] = be64toh(a[1]);
+
+	if (IN6_IS_ADDR_V4MAPPED(address))
+		root = &trie->root4;
+
+	unsigned int depth = root->depth;
+
+	// Look up the first bits directly
+	const unsigned int index = loc_poptrie_bits(a, depth, LOC_POPTRIE_DIRECT_BITS);
+
+	leaf = root->table[index];
+
+	if (leaf & LOC_POPTRIE_NODE) {
+		node = &trie->nodes[leaf & ~LOC_POPTRIE_NODE];
+		depth += LOC_POPTRIE_DIRECT_BITS;
+
+		for (;;) {
+			const unsigned int stride = loc_poptrie_stride(depth);
+			const unsigned int i = loc_poptrie_bits(a, depth, stride);
+
+			// Descend into the next node
+			if (node->vector & (1ULL << i)) {
+				node = &trie->nodes[node->base1
+					+ __builtin_popcountll(node->vector & ((1ULL << i) - 1))];
+				depth += stride;
+				continue;
+			}
+
+			const uint64_t below = node->leafvec & ((2ULL << i) - 1);
+
+			// Fetch the leaf
+			leaf = trie->leaves[node->base0 + __builtin_popcountll(below) - 1];
+
+			// The leaf is shared by all slots up to the start of the next leaf or node
+			uint64_t from = 63 - __builtin_clzll(below);
+			uint64_t to = (1ULL << stride) - 1;
+
+			const uint64_t nodes_below = node->vector & ((1ULL << i) - 1);
+			if (nodes_below && (uint64_t)(64 - __builtin_clzll(nodes_below)) > from)
+				from = 64 - __builtin_clzll(nodes_below);
+
+			const uint64_t above = (node->leafvec | node->vector) & ~((2ULL << i) - 1);
+			if (above && (uint64_t)__builtin_ctzll(above) - 1 < to)
+				to = __builtin_ctzll(above) - 1;
+
+			loc_poptrie_range(a, depth, stride, from, to, first, last);
+			break;
+		}
+
+	// The leaf covers everything with the same first bits
+	} else {
+		loc_poptrie_range(a, depth, LOC_POPTRIE_DIRECT_BITS, index, index, first, last);
+	}
+
+	// No match
+	if (!leaf)
+		return 1;
+
+	*network_index = leaf - 1;
+	*prefix = trie->prefixes[leaf - 1];
+
+	return 0;
+}
@@ -17,6 +17,7 @@
 #include <Python.h>
 
 #include <libloc/libloc.h>
+#include <libloc/address.h>
 #include <libloc/as.h>
 #include <libloc/as-list.h>
 #include <libloc/database.h>
@@ -44,13 +45,54 @@ static void Database_dealloc(DatabaseObject* self) {
 }
 
 static int Database_init(DatabaseObject* self, PyObject* args, PyObject* kwargs) {
+	char* kwlist[] = { "path", "poptrie", "dir24_8", "validate", "copy_tree",
+		"populate", "mlock", "hugepages", "sequential", "as_index", NULL };
 	const char* path = NULL;
+	int poptrie = 0;
+	int dir24_8 = 0;
+	int validate = 0;
+	int copy_tree = 0;
+	int populate = 0;
+	int mlock = 0;
+	int hugepages = 0;
+	int sequential = 0;
+	int as_index = 0;
+	int flags = 0;
 	FILE* f = NULL;
 
 	// Parse arguments
-	if (!PyArg_ParseTuple(args, "s", &path))
+	if (!PyArg_ParseTupleAndKeywords(args, kwargs, "s|$ppppppppp", kwlist, &path,
+			&poptrie, &dir24_8, &validate, &copy_tree, &populate, &mlock, &hugepages, &sequential,
+			&as_index))
 		return -1;
 
+	if (poptrie)
+		flags |= LOC_DB_FLAGS_POPTRIE;
+
+	if (dir24_8)
+		flags |= LOC_DB_FLAGS_DIR24_8;
+
+	if (validate)
+		flags |= LOC_DB_FLAGS_VALIDATE;
+
+	if (copy_tree)
+		flags |= LOC_DB_FLAGS_COPY_TREE;
+
+	if (populate)
+		flags |= LOC_DB_FLAGS_POPULATE;
+
+	if (mlock)
+		flags |= LOC_DB_FLAGS_MLOCK;
+
+	if (hugepages)
+		flags |= LOC_DB_FLAGS_HUGEPAGES;
+
+	if (sequential)
+		flags |= LOC_DB_FLAGS_SEQUENTIAL;
+
+	if (as_index)
+		flags |= LOC_DB_FLAGS_AS_INDEX;
+
 	// Copy path
 	self->path = strdup(path);
 	if (!self->path)
@@ -62,7 +104,7 @@ static int Database_init(DatabaseObject* self, PyObject* args, PyObject* kwargs)
 		goto ERROR;
 
 	// Load the database
-	int r = loc_database_new(loc_ctx, &self->db, f);
+	int r = loc_database_new_with_flags(loc_ctx, &self->db, f, flags);
 	if (r)
 		goto ERROR;
 
@@ -232,6 +274,87 @@ static PyObject* Database_lookup(DatabaseObject* self, PyObject* args) {
 	return NULL;
 }
 
+static int Database_parse_address(struct in6_addr* address, const char* string) {
+	if (loc_address_parse_buffer(address, NULL, string, strlen(string))) {
+		PyErr_Format(PyExc_ValueError, "Invalid IP address: %s", string);
+		return 1;
+	}
+
+	return 0;
+}
+
+static PyObject* Database_lookup_asn(DatabaseObject* self, PyObject* args) {
+	const char* string = NULL;
+	struct in6_addr address;
+	uint32_t asn = 0;
+
+	if (!PyArg_ParseTuple(args, "s", &string))
+		return NULL;
+
+	if (Database_parse_address(&address, string))
+		return NULL;
+
+	int r = loc_database_lookup_asn(self->db, &address, &asn);
+	if (r < 0) {
+		PyErr_SetFromErrno(PyExc_OSError);
+		return NULL;
+	}
+
+	// Nothing found
+	if (r || !asn)
+		Py_RETURN_NONE;
+
+	return PyLong_FromUnsignedLong(asn);
+}
+
+static PyObject* Database_lookup_country_code(DatabaseObject* self, PyObject* args) {
+	const char* string = NULL;
+	struct in6_addr address;
+	char country_code[3];
+
+	if (!PyArg_ParseTuple(args, "s", &string))
+		return NULL;
+
+	if (Database_parse_address(&address, string))
+		return NULL;
+
+	int r = loc_database_lookup_country_code(self->db, &address, country_code);
+	if (r < 0) {
+		PyErr_SetFromErrno(PyExc_OSError);
+		return NULL;
+	}
+
+	// Nothing found
+	if (r)
+		Py_RETURN_NONE;
+
+	return PyUnicode_FromString(country_code);
+}
+
+static PyObject* Database_lookup_flags(DatabaseObject* self, PyObject* args) {
+	const char* string = NULL;
+	struct in6_addr address;
+	enum loc_network_flags flags = 0;
+
+	if (!PyArg_ParseTuple(args, "s", &string))
+		return NULL;
+
+	if (Database_parse_address(&address, string))
+		return NULL;
+
+	int r = loc_database_lookup_flags(self->db, &address, &flags);
+	if (r < 0) {
+		PyErr_SetFromErrno(PyExc_OSError);
+		return NULL;
+	}
+
+	// Nothing found
+	if (r)
+		Py_RETURN_NONE;
+
+	return PyLong_FromLong(flags);
+}
+
 static PyObject* new_database_enumerator(PyTypeObject* type, struct loc_database_enumerator* enumerator) {
 	DatabaseEnumeratorObject* self = (DatabaseEnumeratorObject*)type->tp_alloc(type, 0);
 	if (self) {
@@ -494,6 +617,24 @@ static struct PyMethodDef Database_methods[] = {
 		METH_VARARGS,
 		NULL,
 	},
+	{
+		"lookup_asn",
+		(PyCFunction)Database_lookup_asn,
+		METH_VARARGS,
+		NULL,
+	},
+	{
+		"lookup_country_code",
+		(PyCFunction)Database_lookup_country_code,
+		METH_VARARGS,
+		NULL,
+	},
+	{
+		"lookup_flags",
+		(PyCFunction)Database_lookup_flags,
+		METH_VARARGS,
+		NULL,
+	},
 	{
 		"search_as",
 		(PyCFunction)Database_search_as,
@@ -180,5 +180,18 @@ PyMODINIT_FUNC PyInit__location(void) {
 	if (PyModule_AddIntConstant(m, "DATABASE_VERSION_LATEST", LOC_DATABASE_VERSION_LATEST))
 		return NULL;
 
+	// Add writer flags
+	if (PyModule_AddIntConstant(m, "WRITER_FLAG_CLUSTER_TREE", LOC_WRITER_FLAGS_CLUSTER_TREE))
+		return NULL;
+
+	if (PyModule_AddIntConstant(m, "WRITER_FLAG_PUSH_LEAVES", LOC_WRITER_FLAGS_PUSH_LEAVES))
+		return NULL;
+
+	if (PyModule_AddIntConstant(m, "WRITER_FLAG_SEARCH_INDEX", LOC_WRITER_FLAGS_SEARCH_INDEX))
+		return NULL;
+
+	if (PyModule_AddIntConstant(m, "WRITER_FLAG_NETWORK_INDEX", LOC_WRITER_FLAGS_NETWORK_INDEX))
+		return NULL;
+
 	return m;
 }
@@ -221,10 +221,13 @@ static PyObject* Writer_add_network(WriterObject* self, PyObject* args) {
 static PyObject* Writer_write(WriterObject* self, PyObject* args) {
 	const char* path = NULL;
 	int version = LOC_DATABASE_VERSION_UNSET;
+	int flags = 0;
 
-	if (!PyArg_ParseTuple(args, "s|i", &path, &version))
+	if (!PyArg_ParseTuple(args, "s|ii", &path, &version, &flags))
 		return NULL;
 
+	loc_writer_set_flags(self->writer, flags);
+
 	FILE* f = fopen(path, "w+");
 	if (!f) {
 		PyErr_SetFromErrno(PyExc_OSError);
@@ -16,6 +16,7 @@
 
 #include <errno.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -29,6 +30,16 @@
 
 #define LOC_STRINGPOOL_BLOCK_SIZE	(512 * 1024)
 
+// The initial number of entries in the index
+#define LOC_STRINGPOOL_INDEX_SIZE	1024
+
+struct loc_stringpool_index_entry {
+	uint32_t hash;
+
+	// The offset of the string plus one (or zero if this entry is empty)
+	uint32_t offset;
+};
+
 struct loc_stringpool {
 	struct loc_ctx* ctx;
 	int refcount;
@@ -40,27 +51,92 @@ struct loc_stringpool {
 	// Reference to own storage
 	char* blocks;
 	size_t size;
+
+	// A hash table of all strings that have been added
+	struct loc_stringpool_index_entry* index;
+	size_t index_size;
+	size_t index_count;
 };
 
-static int loc_stringpool_grow(struct loc_stringpool* pool, const size_t size) {
-	DEBUG(pool->ctx, "Growing string pool by %zu byte(s)\n", size);
+static int loc_stringpool_grow(struct loc_stringpool* pool, const size_t length) {
+	size_t size = (pool->size) ? pool->size : LOC_STRINGPOOL_BLOCK_SIZE;
+
+	// Double the size until the string fits
+	while (pool->length + length > size)
+		size *= 2;
 
-	// Increment size
-	pool->size += size;
+	DEBUG(pool->ctx, "Growing string pool to %zu byte(s)\n", size);
 
 	// Reallocate blocks
-	pool->blocks = realloc(pool->blocks, pool->size);
-	if (!pool->blocks) {
+	char* blocks = realloc(pool->blocks, size);
+	if (!blocks) {
 		ERROR(pool->ctx, "Could not grow string pool: %m\n");
 		return 1;
 	}
 
+	pool->blocks = blocks;
+	pool->size = size;
+
 	// Update data pointer
 	pool->data = pool->blocks;
 
 	return 0;
 }
 
+// FNV-1a
+static uint32_t loc_stringpool_hash(const char* s) {
+	uint32_t hash = 0x811c9dc5;
+
+	while (*s) {
+		hash ^= (unsigned char)*s++;
+		hash *= 0x01000193;
+	}
+
+	return hash;
+}
+
+static void loc_stringpool_index_insert(struct loc_stringpool_index_entry* index,
+		size_t size, uint32_t hash, uint32_t offset) {
+	size_t i = hash & (size - 1);
+
+	// Find the next free entry
+	while (index[i].offset)
+		i = (i + 1) & (size - 1);
+
+	index[i].hash = hash;
+	index[i].offset = offset + 1;
+}
+
+/*
+	Makes room in the index for one more string
+*/
+static int loc_stringpool_index_grow(struct loc_stringpool* pool) {
+	// Keep the index at most half full
+	if ((pool->index_count + 1) * 2 <= pool->index_size)
+		return 0;
+
+	const size_t size = (pool->index_size) ? pool->index_size * 2 : LOC_STRINGPOOL_INDEX_SIZE;
+
+	struct loc_stringpool_index_entry* index = calloc(size, sizeof(*index));
+	if (!index)
+		return 1;
+
+	// Move all strings into the new index
+	for (size_t i = 0; i < pool->index_size; i++) {
+		if (pool->index[i].offset)
+			loc_stringpool_index_insert(index, size,
+				pool->index[i].hash, pool->index[i].offset - 1);
+	}
+
+	if (pool->index)
+		free(pool->index);
+
+	pool->index = index;
+	pool->index_size = size;
+
+	return 0;
+}
+
 static off_t loc_stringpool_append(struct loc_stringpool* pool, const char* string) {
 	if (!string) {
 		errno = EINVAL;
@@ -74,9 +150,9 @@ static off_t loc_stringpool_append(struct loc_stringpool* pool, const char* stri
 
 	// Make sure we have enough space
 	if (pool->length + length > pool->size) {
-		int r = loc_stringpool_grow(pool, LOC_STRINGPOOL_BLOCK_SIZE);
+		int r = loc_stringpool_grow(pool, length);
 		if (r)
-			return r;
+			return -1;
 	}
 
 	off_t offset = pool->length;
@@ -96,6 +172,8 @@ static void loc_stringpool_free(struct loc_stringpool* pool) {
 	// Free any data
 	if (pool->blocks)
 		free(pool->blocks);
+	if (pool->index)
+		free(pool->index);
 
 	loc_unref(pool->ctx);
 	free(pool);
@@ -140,13 +218,13 @@ ERROR:
 }
 
 struct loc_stringpool* loc_stringpool_ref(struct loc_stringpool* pool) {
-	pool->refcount++;
+	loc_refcount_inc(&pool->refcount);
 
 	return pool;
 }
 
 struct loc_stringpool* loc_stringpool_unref(struct loc_stringpool* pool) {
-	if (--pool->refcount > 0)
+	if (loc_refcount_dec(&pool->refcount) > 0)
 		return NULL;
 
 	loc_stringpool_free(pool);
@@ -169,26 +247,23 @@ size_t loc_stringpool_get_size(struct loc_stringpool* pool) {
 	return pool->length;
 }
 
-static off_t loc_stringpool_find(struct loc_stringpool* pool, const char* s) {
-	if (!s || !*s) {
-		errno = EINVAL;
+static off_t loc_stringpool_find(struct loc_stringpool* pool, const char* s, uint32_t hash) {
+	// Nothing has been added, yet
+	if (!pool->index_size) {
+		errno = ENOENT;
 		return -1;
 	}
 
-	off_t offset = 0;
-	while (offset < pool->length) {
-		const char* string = loc_stringpool_get(pool, offset);
+	for (size_t i = hash & (pool->index_size - 1); pool->index[i].offset;
+			i = (i + 1) & (pool->index_size - 1)) {
+		if (pool->index[i].hash != hash)
+			continue;
 
-		// Error!
-		if (!string)
-			return 1;
+		const off_t offset = pool->index[i].offset - 1;
 
 		// Is this a match?
-		if (strcmp(s, string) == 0)
+		if (strcmp(s, pool->data + offset) == 0)
 			return offset;
-
-		// Shift offset
-		offset += strlen(string) + 1;
 	}
 
 	// Nothing found
@@ -197,13 +272,36 @@ static off_t loc_stringpool_find(struct loc_stringpool* pool, const char* s) {
 }
 
 off_t loc_stringpool_add(struct loc_stringpool* pool, const char* string) {
-	off_t offset = loc_stringpool_find(pool, string);
+	if (!string) {
+		errno = EINVAL;
+		return -1;
+	}
+
+	const uint32_t hash = loc_stringpool_hash(string);
+
+	off_t offset = loc_stringpool_find(pool, string, hash);
 	if (offset >= 0) {
 		DEBUG(pool->ctx, "Found '%s' at position %jd\n", string, (intmax_t)offset);
 		return offset;
 	}
 
-	return loc_stringpool_append(pool, string);
+	// Offsets are stored as 32 bit integers
+	if (pool->length + strlen(string) + 1 > UINT32_MAX) {
+		errno = EFBIG;
+		return -1;
+	}
+
+	if (loc_stringpool_index_grow(pool))
+		return -1;
+
+	offset = loc_stringpool_append(pool, string);
+	if (offset < 0)
+		return offset;
+
+	loc_stringpool_index_insert(pool->index, pool->index_size, hash, offset);
+	pool->index_count++;
+
+	return offset;
 }
 
 void loc_stringpool_dump(struct loc_stringpool* pool) {
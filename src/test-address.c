@@ -14,6 +14,8 @@
 	GNU General Public License for more details.
 */
 
+#include <arpa/inet.h>
+#include <errno.h>
 #include <stdlib.h>
 #include <string.h>
 #include <syslog.h>
@@ -110,6 +112,495 @@ static int perform_tests(struct loc_ctx* ctx, const int family) {
 	return 0;
 }
 
+/*
+	These are the previous implementations of the arithmetic helpers which
+	worked on one octet at a time. They are used to check that the new ones
+	return exactly the same results.
+*/
+#define foreach_octet_in_address(octet, address) \
+	for (octet = (IN6_IS_ADDR_V4MAPPED(address) ? 12 : 0); octet <= 15; octet++)
+
+#define foreach_octet_in_address_reverse(octet, address) \
+	for (octet = 15; octet >= (IN6_IS_ADDR_V4MAPPED(address) ? 12 : 0); octet--)
+
+static int old_address_cmp(const struct in6_addr* a1, const struct in6_addr* a2) {
+	for (unsigned int i = 0; i < 16; i++) {
+		if (a1->s6_addr[i] > a2->s6_addr[i])
+			return 1;
+
+		else if (a1->s6_addr[i] < a2->s6_addr[i])
+			return -1;
+	}
+
+	return 0;
+}
+
+static int old_address_all_zeroes(const struct in6_addr* address) {
+	int octet = 0;
+
+	foreach_octet_in_address(octet, address) {
+		if (address->s6_addr[octet])
+			return 0;
+	}
+
+	return 1;
+}
+
+static int old_address_all_ones(const struct in6_addr* address) {
+	int octet = 0;
+
+	foreach_octet_in_address(octet, address) {
+		if (address->s6_addr[octet] < 255)
+			return 0;
+	}
+
+	return 1;
+}
+
+static unsigned int old_address_bit_length(const struct in6_addr* address) {
+	int octet = 0;
+	foreach_octet_in_address(octet, address) {
+		if (address->s6_addr[octet])
+			return (15 - octet) * 8 + 32 - __builtin_clz(address->s6_addr[octet]);
+	}
+
+	return 0;
+}
+
+static int old_address_sub(struct in6_addr* result,
+		const struct in6_addr* address1, const struct in6_addr* address2) {
+	int family1 = loc_address_family(address1);
+	int family2 = loc_address_family(address2);
+
+	// Address family must match
+	if (family1 != family2) {
+		errno = EINVAL;
+		return 1;
+	}
+
+	// Clear result
+	int r = loc_address_reset(result, family1);
+	if (r)
+		return r;
+
+	int octet = 0;
+	int remainder = 0;
+
+	foreach_octet_in_address_reverse(octet, address1) {
+		int x = address1->s6_addr[octet] - address2->s6_addr[octet] + remainder;
+
+		// Store remainder for the next iteration
+		remainder = (x >> 8);
+
+		result->s6_addr[octet] = x & 0xff;
+	}
+
+	return 0;
+}
+
+static void old_address_increment(struct in6_addr* address) {
+	// Prevent overflow when everything is ones
+	if (old_address_all_ones(address))
+		return;
+
+	int octet = 0;
+	foreach_octet_in_address_reverse(octet, address) {
+		if (address->s6_addr[octet] < 255) {
+			address->s6_addr[octet]++;
+			break;
+		} else {
+			address->s6_addr[octet] = 0;
+		}
+	}
+}
+
+static void old_address_decrement(struct in6_addr* address) {
+	// Prevent underflow when everything is ones
+	if (old_address_all_zeroes(address))
+		return;
+
+	int octet = 0;
+	foreach_octet_in_address_reverse(octet, address) {
+		if (address->s6_addr[octet] > 0) {
+			address->s6_addr[octet]--;
+			break;
+		} else {
+			address->s6_addr[octet] = 255;
+		}
+	}
+}
+
+static int old_address_count_trailing_zero_bits(const struct in6_addr* address) {
+	int zeroes = 0;
+
+	int octet = 0;
+	foreach_octet_in_address_reverse(octet, address) {
+		if (address->s6_addr[octet]) {
+			zeroes += __builtin_ctz(address->s6_addr[octet]);
+			break;
+		} else
+			zeroes += 8;
+	}
+
+	return zeroes;
+}
+
+/*
+	Generates addresses that are likely to hit any corner cases: all bits
+	or all bits but one set, runs of ones or zeroes at either end and random ones
+*/
+static size_t generate_addresses(struct in6_addr* addresses, const int family) {
+	const unsigned int bits = loc_address_family_bit_length(family);
+	const unsigned int offset = 128 - bits;
+	size_t n = 0;
+
+	for (unsigned int i = 0; i <= bits; i++) {
+		struct in6_addr* a = &addresses[n];
+
+		// A single bit
+		loc_address_reset(&a[0], family);
+		if (i < bits)
+			loc_address_set_bit(&a[0], offset + i, 1);
+
+		// Everything but a single bit
+		loc_address_reset_last(&a[1], family);
+		if (i < bits)
+			loc_address_set_bit(&a[1], offset + i, 0);
+
+		// The first i bits
+		loc_address_reset(&a[2], family);
+		for (unsigned int j = 0; j < i; j++)
+			loc_address_set_bit(&a[2], offset + j, 1);
+
+		// The last i bits
+		loc_address_reset(&a[3], family);
+		for (unsigned int j = bits - i; j < bits; j++)
+			loc_address_set_bit(&a[3], offset + j, 1);
+
+		// Something random
+		loc_address_reset(&a[4], family);
+		for (unsigned int j = 0; j < bits; j++)
+			loc_address_set_bit(&a[4], offset + j, random() % 2);
+
+		n += 5;
+	}
+
+	return n;
+}
+
+static int check_arithmetic(const struct in6_addr* a1, const struct in6_addr* a2) {
+	struct in6_addr r1, r2;
+	int e1, e2;
+
+	if (loc_address_cmp(a1, a2) != old_address_cmp(a1, a2)) {
+		fprintf(stderr, "Comparing %s and %s returned a different result\n", loc_address_str(a1), loc_address_str(a2));
+		return 1;
+	}
+
+	// Subtract
+	memset(&r1, 0, sizeof(r1));
+	memset(&r2, 0, sizeof(r2));
+
+	e1 = loc_address_sub(&r1, a1, a2);
+	e2 = old_address_sub(&r2, a1, a2);
+
+	if (e1 != e2 || (!e1 && old_address_cmp(&r1, &r2) != 0)) {
+		fprintf(stderr, "Subtracting %s from %s returned a different result\n", loc_address_str(a2), loc_address_str(a1));
+		return 1;
+	}
+
+	// Everything else only needs to be checked once per address
+	if (a1 != a2)
+		return 0;
+
+	if (loc_address_all_zeroes(a1) != old_address_all_zeroes(a1)
+			|| loc_address_all_ones(a1) != old_address_all_ones(a1)
+			|| loc_address_bit_length(a1) != old_address_bit_length(a1)
+			|| loc_address_count_trailing_zero_bits(a1) != old_address_count_trailing_zero_bits(a1)) {
+		fprintf(stderr, "Properties of %s are different\n", loc_address_str(a1));
+		return 1;
+	}
+
+	r1 = r2 = *a1;
+	loc_address_increment(&r1);
+	old_address_increment(&r2);
+
+	if (old_address_cmp(&r1, &r2) != 0) {
+		fprintf(stderr, "Incrementing %s returned a different result\n", loc_address_str(a1));
+		return 1;
+	}
+
+	r1 = r2 = *a1;
+	loc_address_decrement(&r1);
+	old_address_decrement(&r2);
+
+	if (old_address_cmp(&r1, &r2) != 0) {
+		fprintf(stderr, "Decrementing %s returned a different result\n", loc_address_str(a1));
+		return 1;
+	}
+
+	return 0;
+}
+
+static int test_arithmetic(void) {
+	struct in6_addr addresses[2 * 5 * 129];
+	size_t n = 0;
+
+	n += generate_addresses(addresses + n, AF_INET6);
+	n += generate_addresses(addresses + n, AF_INET);
+
+	// Check every pair of addresses
+	for (unsigned int i = 0; i < n; i++) {
+		for (unsigned int j = 0; j < n; j++) {
+			if (check_arithmetic(&addresses[i], &addresses[j]))
+				return 1;
+		}
+	}
+
+	return 0;
+}
+
+/*
+	This is how addresses used to be parsed before loc_address_parse()
+	had its own parser. It is used to check that both accept the same input.
+*/
+static int parse_inet_pton(struct in6_addr* address, const char* string) {
+	char buffer[INET6_ADDRSTRLEN + 4];
+	struct in_addr address4;
+
+	// Copy the string into the buffer
+	snprintf(buffer, sizeof(buffer) - 1, "%s", string);
+
+	if (inet_pton(AF_INET6, buffer, address) == 1)
+		return 0;
+
+	if (inet_pton(AF_INET, buffer, &address4) == 1) {
+		address->s6_addr32[0] = 0;
+		address->s6_addr32[1] = 0;
+		address->s6_addr32[2] = htonl(0xffff);
+		address->s6_addr32[3] = address4.s_addr;
+
+		return 0;
+	}
+
+	return 1;
+}
+
+static void random_address_string(char* buffer, size_t length) {
+	static const char* alphabet = "0123456789abcdefABCDEFg:.. ";
+	struct in6_addr address;
+	size_t l;
+
+	for (unsigned int i = 0; i < 16; i++)
+		address.s6_addr[i] = random();
+
+	switch (random() % 4) {
+		// Random IPv4 addresses
+		case 0:
+			address.s6_addr32[0] = address.s6_addr32[1] = 0;
+			address.s6_addr32[2] = htonl(0xffff);
+			break;
+
+		// IPv6 addresses with plenty of zeroes to compress
+		case 1:
+			for (unsigned int i = 0; i < 8; i++) {
+				if (random() % 2)
+					address.s6_addr16[i] = 0;
+			}
+			break;
+	}
+
+	loc_address_format(&address, buffer, length);
+
+	// Write some IPv6 addresses in uppercase or with an IPv4 address at the end
+	if (!IN6_IS_ADDR_V4MAPPED(&address)) {
+		switch (random() % 4) {
+			case 0:
+				for (char* p = buffer; *p; p++) {
+					if (*p >= 'a' && *p <= 'f')
+						*p -= 'a' - 'A';
+				}
+				break;
+
+			case 1:
+				inet_ntop(AF_INET6, &address, buffer, length);
+				snprintf(strrchr(buffer, ':') + 1, 16, "%u.%u.%u.%u",
+					address.s6_addr[12], address.s6_addr[13],
+					address.s6_addr[14], address.s6_addr[15]);
+				break;
+		}
+	}
+
+	// Randomly break some of them
+	for (int mutations = random() % 4 - 1; mutations > 0; mutations--) {
+		l = strlen(buffer);
+
+		size_t pos = random() % (l + 1);
+		const char c = alphabet[random() % strlen(alphabet)];
+
+		switch (random() % 3) {
+			// Replace a character
+			case 0:
+				if (pos < l)
+					buffer[pos] = c;
+				break;
+
+			// Insert a character
+			case 1:
+				if (l + 1 < length) {
+					memmove(buffer + pos + 1, buffer + pos, l - pos + 1);
+					buffer[pos] = c;
+				}
+				break;
+
+			// Remove a character
+			case 2:
+				if (pos < l)
+					memmove(buffer + pos, buffer + pos + 1, l - pos);
+				break;
+		}
+	}
+}
+
+static int check_parse(const char* string) {
+	struct in6_addr address1 = IN6ADDR_ANY_INIT;
+	struct in6_addr address2 = IN6ADDR_ANY_INIT;
+
+	int r1 = parse_inet_pton(&address1, string);
+	int r2 = loc_address_parse(&address2, NULL, string);
+
+	if (r1 != r2) {
+		fprintf(stderr, "Parsing '%s' should have %s\n", string, (r1) ? "failed" : "succeeded");
+		return 1;
+	}
+
+	if (!r1 && loc_address_cmp(&address1, &address2) != 0) {
+		fprintf(stderr, "Parsing '%s' returned %s instead of %s\n", string,
+			loc_address_str(&address2), loc_address_str(&address1));
+		return 1;
+	}
+
+	return 0;
+}
+
+static int test_parse(void) {
+	struct in6_addr address;
+	unsigned int prefix;
+	char buffer[INET6_ADDRSTRLEN + 8];
+	int r;
+
+	const char* strings[] = {
+		"", ".", ":", "::", ":::", "::1", "1::", "1:", ":1", "::1:", "1::2::3",
+		"0.0.0.0", "255.255.255.255", "256.0.0.0", "1.2.3", "1.2.3.4.5", "1.2.3.",
+		".1.2.3", "1..2.3", "01.2.3.4", "1.02.3.4", "1.2.3.00", "1.2.3.4 ", " 1.2.3.4",
+		"1.2.3.1000", "1234.1.1.1", "a.b.c.d", "1.2.3.4:", "0x1.2.3.4",
+		"::1.2.3.4", "::ffff:1.2.3.4", "1:2:3:4:5:6:1.2.3.4", "1:2:3:4:5:6:7:1.2.3.4",
+		"1:2:3:4:5::1.2.3.4", "::1.2.3", "::1.2.3.4.5", "::01.2.3.4", "1.2.3.4::",
+		"1:2:3:4:5:6:7:8", "1:2:3:4:5:6:7:8:9", "1:2:3:4:5:6:7:8:", ":1:2:3:4:5:6:7:8",
+		"1:2:3:4::5:6:7:8", "::2:3:4:5:6:7:8", "1:2:3:4:5:6:7::", "12345::", "ffff::",
+		"FFFF::", "fFfF::0", "g::", "2001:db8::1", "2001:DB8:0:0:0:0:0:1", "::00001",
+		"1.2.3.4\n", "255.255.255.256", "99.99.99.99", "100.200.250.255",
+		NULL,
+	};
+
+	// Check some corner cases
+	for (const char** s = strings; *s; s++) {
+		if (check_parse(*s))
+			return 1;
+	}
+
+	// Check plenty of random strings
+	for (unsigned int i = 0; i < 1000000; i++) {
+		random_address_string(buffer, sizeof(buffer));
+
+		if (check_parse(buffer))
+			return 1;
+	}
+
+	const struct prefix_test {
+		const char* string;
+		int r;
+		unsigned int prefix;
+	} prefixes[] = {
+		{ "2001:db8::", 0, 128 },
+		{ "2001:db8::/32", 0, 32 },
+		{ "2001:db8::/0", 0, 0 },
+		{ "2001:db8::/128", 0, 128 },
+		{ "2001:db8::/129", 1, 0 },
+		{ "2001:db8::/", 1, 0 },
+		{ "2001:db8::/1a", 1, 0 },
+		{ "2001:db8::/-1", 1, 0 },
+		{ "2001:db8::/0128", 1, 0 },
+		{ "10.0.0.0", 0, 32 },
+		{ "10.0.0.0/8", 0, 8 },
+		{ "10.0.0.0/32", 0, 32 },
+		{ "10.0.0.0/33", 1, 0 },
+		{ "10.0.0.0/8/8", 1, 0 },
+		{ "/8", 1, 0 },
+		{ NULL },
+	};
+
+	// Check prefixes
+	for (const struct prefix_test* t = prefixes; t->string; t++) {
+		r = loc_address_parse(&address, &prefix, t->string);
+
+		if (r != t->r || (!r && prefix != t->prefix)) {
+			fprintf(stderr, "Parsing '%s' returned %d with prefix %u\n", t->string, r, prefix);
+			return 1;
+		}
+	}
+
+	// The input does not need to be terminated
+	r = loc_address_parse_buffer(&address, &prefix, "10.0.0.0/8x", 10);
+	if (r || prefix != 8) {
+		fprintf(stderr, "Could not parse the beginning of a string\n");
+		return 1;
+	}
+
+	return 0;
+}
+
+static int test_parse_lines(void) {
+	struct in6_addr addresses[4];
+	size_t consumed;
+	size_t count;
+
+	const char* lines =
+		"1.2.3.4\n"
+		"\n"
+		"2001:db8::1\r\n"
+		"10.0.0.0/8\n"
+		"invalid\n"
+		"5.6.7.8";
+
+	count = loc_address_parse_lines(addresses, 4, lines, strlen(lines), &consumed);
+
+	// The parser should stop at the invalid line
+	if (count != 3 || strncmp(lines + consumed, "invalid", 7) != 0) {
+		fprintf(stderr, "Parsed %zu lines, stopped at '%s'\n", count, lines + consumed);
+		return 1;
+	}
+
+	if (strcmp(loc_address_str(&addresses[0]), "1.2.3.4") != 0
+			|| strcmp(loc_address_str(&addresses[1]), "2001:db8::1") != 0
+			|| strcmp(loc_address_str(&addresses[2]), "10.0.0.0") != 0) {
+		fprintf(stderr, "Lines have been parsed incorrectly\n");
+		return 1;
+	}
+
+	// Continue after the invalid line
+	lines += consumed + strlen("invalid\n");
+
+	count = loc_address_parse_lines(addresses, 4, lines, strlen(lines), &consumed);
+	if (count != 1 || consumed != strlen(lines)
+			|| strcmp(loc_address_str(&addresses[0]), "5.6.7.8") != 0) {
+		fprintf(stderr, "Could not parse the last line\n");
+		return 1;
+	}
+
+	return 0;
+}
+
 int main(int argc, char** argv) {
 	struct loc_ctx* ctx = NULL;
 	int r = EXIT_FAILURE;
@@ -131,6 +622,20 @@ int main(int argc, char** argv) {
 	if (r)
 		goto ERROR;
 
+	// Compare the arithmetic against the previous implementation
+	r = test_arithmetic();
+	if (r)
+		goto ERROR;
+
+	// Compare the parser against inet_pton()
+	r = test_parse();
+	if (r)
+		goto ERROR;
+
+	r = test_parse_lines();
+	if (r)
+		goto ERROR;
+
 ERROR:
 	loc_unref(ctx);
 
@@ -25,6 +25,41 @@
 
 #define TEST_AS_COUNT 5000
 
+/*
+	Enumerates all ASes matching string and returns how many there were
+	and the sum of their numbers.
+*/
+static int search(struct loc_database* db, const char* string,
+		unsigned int* count, unsigned long* sum) {
+	struct loc_database_enumerator* enumerator;
+	struct loc_as* as;
+	int r;
+
+	*count = 0;
+	*sum = 0;
+
+	r = loc_database_enumerator_new(&enumerator, db, LOC_DB_ENUMERATE_ASES, 0);
+	if (r)
+		return r;
+
+	loc_database_enumerator_set_string(enumerator, string);
+
+	for (;;) {
+		r = loc_database_enumerator_next_as(enumerator, &as);
+		if (r || !as)
+			break;
+
+		*count += 1;
+		*sum += loc_as_get_number(as);
+
+		loc_as_unref(as);
+	}
+
+	loc_database_enumerator_unref(enumerator);
+
+	return r;
+}
+
 int main(int argc, char** argv) {
 	int err;
 
@@ -65,6 +100,21 @@ int main(int argc, char** argv) {
 		exit(EXIT_FAILURE);
 	}
 
+	// Write the database again with a search index
+	FILE* g = tmpfile();
+	if (!g) {
+		fprintf(stderr, "Could not open file for writing: %m\n");
+		exit(EXIT_FAILURE);
+	}
+
+	loc_writer_set_flags(writer, LOC_WRITER_FLAGS_SEARCH_INDEX);
+
+	err = loc_writer_write(writer, g, LOC_DATABASE_VERSION_UNSET);
+	if (err) {
+		fprintf(stderr, "Could not write database with search index: %m\n");
+		exit(EXIT_FAILURE);
+	}
+
 	loc_writer_unref(writer);
 
 	// And open it again from disk
@@ -92,6 +142,60 @@ int main(int argc, char** argv) {
 		loc_as_unref(as);
 	}
 
+	// Open the database again with an index
+	struct loc_database* indexed;
+	err = loc_database_new_with_flags(ctx, &indexed, f, LOC_DB_FLAGS_AS_INDEX);
+	if (err) {
+		fprintf(stderr, "Could not open database with AS index: %m\n");
+		exit(EXIT_FAILURE);
+	}
+
+	struct loc_database_as_view view1;
+	struct loc_database_as_view view2;
+	for (unsigned int i = 0; i <= TEST_AS_COUNT + 1; i++) {
+		int r1 = loc_database_get_as_view(db, i, &view1);
+		int r2 = loc_database_get_as_view(indexed, i, &view2);
+
+		// AS0 and anything after the last AS must not exist
+		if (i == 0 || i > TEST_AS_COUNT) {
+			if (!r1 || !r2) {
+				fprintf(stderr, "Found non-existent AS%u\n", i);
+				exit(EXIT_FAILURE);
+			}
+
+			err = loc_database_get_as(indexed, &as, i);
+			if (!err || as) {
+				fprintf(stderr, "Found non-existent AS%u in index\n", i);
+				exit(EXIT_FAILURE);
+			}
+
+			continue;
+		}
+
+		if (r1 || r2) {
+			fprintf(stderr, "Could not find view of AS%u\n", i);
+			exit(EXIT_FAILURE);
+		}
+
+		sprintf(name, "Test AS%u", i);
+
+		if (view1.number != i || view2.number != i
+				|| strcmp(view1.name, name) != 0 || strcmp(view2.name, name) != 0) {
+			fprintf(stderr, "Got wrong view of AS%u\n", i);
+			exit(EXIT_FAILURE);
+		}
+
+		err = loc_database_get_as(indexed, &as, i);
+		if (err || loc_as_get_number(as) != i || strcmp(loc_as_get_name(as), name) != 0) {
+			fprintf(stderr, "Could not find AS%u in index\n", i);
+			exit(EXIT_FAILURE);
+		}
+
+		loc_as_unref(as);
+	}
+
+	loc_database_unref(indexed);
+
 	// Enumerator
 
 	struct loc_database_enumerator* enumerator;
@@ -120,9 +224,51 @@ int main(int argc, char** argv) {
 	}
 
 	loc_database_enumerator_unref(enumerator);
+
+	// Search through the database with the search index
+	struct loc_database* searchable;
+	err = loc_database_new(ctx, &searchable, g);
+	if (err) {
+		fprintf(stderr, "Could not open database with search index: %m\n");
+		exit(EXIT_FAILURE);
+	}
+
+	const char* strings[] = {
+		"10", "100", "AS1", "test as12", "TEST AS4999", "st A", "t", "",
+		"AS50000", "Example", "as1\xc3\xa4", NULL,
+	};
+
+	for (const char** string = strings; *string; string++) {
+		unsigned int count1, count2;
+		unsigned long sum1, sum2;
+
+		if (search(db, *string, &count1, &sum1) || search(searchable, *string, &count2, &sum2)) {
+			fprintf(stderr, "Could not search for '%s'\n", *string);
+			exit(EXIT_FAILURE);
+		}
+
+		if (count1 != count2 || sum1 != sum2) {
+			fprintf(stderr, "Search for '%s' returned %u AS(es), but %u with an index\n",
+				*string, count1, count2);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// "AS100" matches AS100 and AS1000-AS1009
+	unsigned int count;
+	unsigned long sum;
+
+	err = search(searchable, "AS100", &count, &sum);
+	if (err || count != 11) {
+		fprintf(stderr, "Search for 'AS100' returned %u AS(es)\n", count);
+		exit(EXIT_FAILURE);
+	}
+
+	loc_database_unref(searchable);
 	loc_database_unref(db);
 	loc_unref(ctx);
 	fclose(f);
+	fclose(g);
 
 	return EXIT_SUCCESS;
 }
@@ -151,6 +151,40 @@ int main(int argc, char** argv) {
 	}
 	loc_country_unref(country);
 
+	// Countries that don't exist must not be found
+	err = loc_database_get_country(db, &country, "AT");
+	if (err || country) {
+		fprintf(stderr, "Found non-existent country: AT\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Fetch a view of a country
+	struct loc_database_country_view view;
+	err = loc_database_get_country_view(db, "DE", &view);
+	if (err) {
+		fprintf(stderr, "Could not find view of country: DE\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (strcmp(view.code, "DE") != 0 || strcmp(view.continent_code, "YY") != 0
+			|| strcmp(view.name, "Testistan") != 0) {
+		fprintf(stderr, "Got wrong view of country DE: %s, %s, %s\n",
+			view.code, view.continent_code, view.name);
+		exit(EXIT_FAILURE);
+	}
+
+	err = loc_database_get_country_view(db, "AT", &view);
+	if (!err) {
+		fprintf(stderr, "Found view of non-existent country: AT\n");
+		exit(EXIT_FAILURE);
+	}
+
+	err = loc_database_get_country_view(db, "A1", &view);
+	if (!err || errno != EINVAL) {
+		fprintf(stderr, "Found view of invalid country: A1\n");
+		exit(EXIT_FAILURE);
+	}
+
 	struct loc_network* network = NULL;
 
 	// Create a test network
@@ -0,0 +1,338 @@
+/*
+	libloc - A library to determine the location of someone on the Internet
+
+	Copyright (C) 2017 IPFire Development Team <info@ipfire.org>
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <errno.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <libloc/libloc.h>
+#include <libloc/database.h>
+#include <libloc/database-handle.h>
+#include <libloc/network.h>
+#include <libloc/writer.h>
+
+/*
+	This test keeps looking up addresses from a couple of threads while
+	the database is being replaced underneath them.
+*/
+
+#define THREADS		4
+#define RELOADS		50
+
+static char path[] = "/tmp/libloc-test-XXXXXX";
+static char database[sizeof(path) + 32];
+static char tmp[sizeof(path) + 32];
+
+static int stop = 0;
+
+static int write_database(struct loc_ctx* ctx, const char* vendor, int sign) {
+	struct loc_writer* writer = NULL;
+	struct loc_network* network = NULL;
+	FILE* private_key = NULL;
+	FILE* f = NULL;
+	int r = 1;
+
+	if (sign) {
+		private_key = fopen(ABS_SRCDIR "/examples/private-key.pem", "r");
+		if (!private_key) {
+			fprintf(stderr, "Could not open private key: %m\n");
+			goto ERROR;
+		}
+	}
+
+	if (loc_writer_new(ctx, &writer, private_key, NULL))
+		goto ERROR;
+
+	if (loc_writer_set_vendor(writer, vendor))
+		goto ERROR;
+
+	if (loc_writer_add_network(writer, &network, "2001:db8::/32"))
+		goto ERROR;
+
+	loc_network_set_country_code(network, vendor[0] == 'A' ? "DE" : "FR");
+
+	// Write to a temporary file and then replace the database like an update would
+	f = fopen(tmp, "w+");
+	if (!f)
+		goto ERROR;
+
+	if (loc_writer_write(writer, f, LOC_DATABASE_VERSION_UNSET))
+		goto ERROR;
+
+	if (fclose(f))
+		goto ERROR;
+	f = NULL;
+
+	if (rename(tmp, database))
+		goto ERROR;
+
+	r = 0;
+
+ERROR:
+	if (f)
+		fclose(f);
+	if (private_key)
+		fclose(private_key);
+	if (network)
+		loc_network_unref(network);
+	if (writer)
+		loc_writer_unref(writer);
+
+	return r;
+}
+
+static int has_vendor(struct loc_database_handle* handle, const char* vendor) {
+	struct loc_database* db = loc_database_handle_get(handle);
+
+	int r = (strcmp(loc_database_get_vendor(db), vendor) == 0);
+	loc_database_unref(db);
+
+	return r;
+}
+
+static void* reader(void* data) {
+	struct loc_database_handle* handle = data;
+	struct loc_network* network = NULL;
+	uintptr_t r = 1;
+
+	while (!__atomic_load_n(&stop, __ATOMIC_RELAXED)) {
+		struct loc_database* db = loc_database_handle_get(handle);
+
+		if (loc_database_lookup_from_string(db, "2001:db8::1", &network) || !network) {
+			fprintf(stderr, "Lookup failed\n");
+			loc_database_unref(db);
+			goto ERROR;
+		}
+
+		// The country must match the database we are holding on to
+		const char* vendor = loc_database_get_vendor(db);
+		const char* country_code = loc_network_get_country_code(network);
+
+		if (strcmp(country_code, (vendor[0] == 'A') ? "DE" : "FR") != 0) {
+			fprintf(stderr, "Got %s from database %s\n", country_code, vendor);
+			loc_network_unref(network);
+			loc_database_unref(db);
+			goto ERROR;
+		}
+
+		loc_network_unref(network);
+		loc_database_unref(db);
+	}
+
+	r = 0;
+
+ERROR:
+	return (void*)r;
+}
+
+static int test_reload(struct loc_ctx* ctx) {
+	struct loc_database_handle* handle = NULL;
+	pthread_t threads[THREADS];
+	unsigned int running = 0;
+	void* result = NULL;
+	int r = 1;
+
+	if (write_database(ctx, "A", 0))
+		goto ERROR;
+
+	if (loc_database_handle_new(ctx, &handle, database, NULL, 0)) {
+		fprintf(stderr, "Could not open database handle: %m\n");
+		goto ERROR;
+	}
+
+	for (unsigned int i = 0; i < THREADS; i++) {
+		if (pthread_create(&threads[i], NULL, reader, handle))
+			goto ERROR;
+
+		running++;
+	}
+
+	// Replace the database a couple of times
+	for (unsigned int i = 0; i < RELOADS; i++) {
+		const char* vendor = (i % 2) ? "A" : "B";
+
+		if (write_database(ctx, vendor, 0))
+			goto ERROR;
+
+		if (loc_database_handle_reload(handle)) {
+			fprintf(stderr, "Could not reload the database: %m\n");
+			goto ERROR;
+		}
+
+		if (!has_vendor(handle, vendor)) {
+			fprintf(stderr, "The database has not been replaced\n");
+			goto ERROR;
+		}
+	}
+
+	r = 0;
+
+ERROR:
+	__atomic_store_n(&stop, 1, __ATOMIC_RELAXED);
+
+	for (unsigned int i = 0; i < running; i++) {
+		pthread_join(threads[i], &result);
+
+		if (result)
+			r = 1;
+	}
+
+	if (handle)
+		loc_database_handle_unref(handle);
+
+	return r;
+}
+
+static int test_watch(struct loc_ctx* ctx) {
+	struct loc_database_handle* handle = NULL;
+	int r = 1;
+
+	if (write_database(ctx, "A", 0))
+		goto ERROR;
+
+	if (loc_database_handle_new(ctx, &handle, database, NULL, 0))
+		goto ERROR;
+
+	int fd = loc_database_handle_watch(handle);
+	if (fd < 0) {
+		if (errno == ENOTSUP) {
+			r = 0;
+			goto ERROR;
+		}
+
+		fprintf(stderr, "Could not watch the database: %m\n");
+		goto ERROR;
+	}
+
+	// Nothing has happened, yet
+	if (loc_database_handle_process(handle))
+		goto ERROR;
+
+	if (write_database(ctx, "B", 0))
+		goto ERROR;
+
+	struct pollfd pfd = {
+		.fd = fd,
+		.events = POLLIN,
+	};
+
+	if (poll(&pfd, 1, 5000) != 1) {
+		fprintf(stderr, "Did not receive any event\n");
+		goto ERROR;
+	}
+
+	if (loc_database_handle_process(handle)) {
+		fprintf(stderr, "Could not process events: %m\n");
+		goto ERROR;
+	}
+
+	if (!has_vendor(handle, "B")) {
+		fprintf(stderr, "The database has not been reloaded\n");
+		goto ERROR;
+	}
+
+	r = 0;
+
+ERROR:
+	if (handle)
+		loc_database_handle_unref(handle);
+
+	return r;
+}
+
+static int test_verify(struct loc_ctx* ctx) {
+	struct loc_database_handle* handle = NULL;
+	int r = 1;
+
+	if (write_database(ctx, "A", 1))
+		goto ERROR;
+
+	if (loc_database_handle_new(ctx, &handle, database,
+			ABS_SRCDIR "/examples/public-key.pem", 0)) {
+		fprintf(stderr, "Could not open a signed database: %m\n");
+		goto ERROR;
+	}
+
+	// Replace it with an unsigned database
+	if (write_database(ctx, "B", 0))
+		goto ERROR;
+
+	if (!loc_database_handle_reload(handle)) {
+		fprintf(stderr, "An unsigned database has been loaded\n");
+		goto ERROR;
+	}
+
+	if (errno != EBADMSG)
+		goto ERROR;
+
+	// The old database must still be there
+	if (!has_vendor(handle, "A")) {
+		fprintf(stderr, "The database has been replaced\n");
+		goto ERROR;
+	}
+
+	r = 0;
+
+ERROR:
+	if (handle)
+		loc_database_handle_unref(handle);
+
+	return r;
+}
+
+int main(int argc, char** argv) {
+	struct loc_ctx* ctx = NULL;
+	int r = EXIT_FAILURE;
+
+	if (!mkdtemp(path)) {
+		fprintf(stderr, "Could not create a temporary directory: %m\n");
+		exit(EXIT_FAILURE);
+	}
+
+	snprintf(database, sizeof(database), "%s/location.db", path);
+	snprintf(tmp, sizeof(tmp), "%s/location.db.tmp", path);
+
+	if (loc_new(&ctx) < 0)
+		goto ERROR;
+
+	loc_set_log_priority(ctx, LOG_INFO);
+
+	if (test_reload(ctx))
+		goto ERROR;
+
+	if (test_watch(ctx))
+		goto ERROR;
+
+	if (test_verify(ctx))
+		goto ERROR;
+
+	r = EXIT_SUCCESS;
+
+ERROR:
+	unlink(database);
+	unlink(tmp);
+	rmdir(path);
+
+	if (ctx)
+		loc_unref(ctx);
+
+	return r;
+}
@@ -14,6 +14,7 @@
 	GNU General Public License for more details.
 */
 
+#include <arpa/inet.h>
 #include <stdio.h>
 #include <stddef.h>
 #include <stdlib.h>
@@ -25,7 +26,9 @@
 #include <syslog.h>
 
 #include <libloc/libloc.h>
+#include <libloc/compat.h>
 #include <libloc/database.h>
+#include <libloc/format.h>
 #include <libloc/writer.h>
 
 const char* VENDOR = "Test Vendor";
@@ -67,6 +70,217 @@ static int attempt_to_open(struct loc_ctx* ctx, char* path) {
 	return r;
 }
 
+/*
+	Returns a copy of the database in f where the child of the given network
+	node has been replaced by child
+*/
+static FILE* corrupt_database(FILE* f, uint32_t node, uint32_t child) {
+	struct loc_database_header_v1 header;
+	struct loc_database_network_node_v1 n;
+	FILE* corrupt = NULL;
+	char buffer[4096];
+	size_t bytes;
+
+	corrupt = tmpfile();
+	if (!corrupt)
+		return NULL;
+
+	// Copy the entire database
+	rewind(f);
+
+	while ((bytes = fread(buffer, 1, sizeof(buffer), f)))
+		fwrite(buffer, 1, bytes, corrupt);
+
+	// Read the header
+	fseek(corrupt, LOC_DATABASE_MAGIC_SIZE, SEEK_SET);
+	if (fread(&header, 1, sizeof(header), corrupt) != sizeof(header))
+		goto ERROR;
+
+	const off_t offset = be32toh(header.network_tree_offset) + node * sizeof(n);
+
+	// Read the node
+	fseek(corrupt, offset, SEEK_SET);
+	if (fread(&n, 1, sizeof(n), corrupt) != sizeof(n))
+		goto ERROR;
+
+	// Replace whatever child there is
+	if (n.zero)
+		n.zero = htobe32(child);
+	else
+		n.one = htobe32(child);
+
+	fseek(corrupt, offset, SEEK_SET);
+	if (fwrite(&n, 1, sizeof(n), corrupt) != sizeof(n))
+		goto ERROR;
+
+	fflush(corrupt);
+	rewind(corrupt);
+
+	return corrupt;
+
+ERROR:
+	fclose(corrupt);
+
+	return NULL;
+}
+
+static int test_validate(struct loc_ctx* ctx, FILE* f) {
+	struct loc_database* db = NULL;
+	FILE* corrupt = NULL;
+	int r;
+
+	// A valid database must pass validation
+	r = loc_database_new_with_flags(ctx, &db, f, LOC_DB_FLAGS_VALIDATE);
+	if (r) {
+		fprintf(stderr, "Could not validate the database: %m\n");
+		return 1;
+	}
+	loc_database_unref(db);
+
+	const uint32_t corruptions[][2] = {
+		// A child that does not exist
+		{ 0, 0xffffff },
+
+		// A cycle
+		{ 2, 1 },
+	};
+
+	for (unsigned int i = 0; i < sizeof(corruptions) / sizeof(*corruptions); i++) {
+		corrupt = corrupt_database(f, corruptions[i][0], corruptions[i][1]);
+		if (!corrupt) {
+			fprintf(stderr, "Could not corrupt the database: %m\n");
+			return 1;
+		}
+
+		// The database can still be opened without validation
+		r = loc_database_new(ctx, &db, corrupt);
+		if (r) {
+			fprintf(stderr, "Could not open corrupt database: %m\n");
+			return 1;
+		}
+		loc_database_unref(db);
+
+		// But validation must fail
+		r = loc_database_new_with_flags(ctx, &db, corrupt, LOC_DB_FLAGS_VALIDATE);
+		if (r == 0 || errno != EBADMSG) {
+			fprintf(stderr, "Corrupt database %u passed validation\n", i);
+			return 1;
+		}
+
+		fclose(corrupt);
+	}
+
+	return 0;
+}
+
+static int destroyed = 0;
+
+static void destroy_buffer(void* buffer, size_t length) {
+	free(buffer);
+
+	destroyed++;
+}
+
+/*
+	Reads the entire file into memory
+*/
+static char* read_database(FILE* f, size_t* length) {
+	char* buffer = NULL;
+
+	if (fseek(f, 0, SEEK_END))
+		return NULL;
+
+	*length = ftell(f);
+	rewind(f);
+
+	buffer = malloc(*length);
+	if (!buffer)
+		return NULL;
+
+	if (fread(buffer, 1, *length, f) != *length) {
+		free(buffer);
+		return NULL;
+	}
+
+	return buffer;
+}
+
+static int check_vendor(struct loc_database* db) {
+	const char* vendor = loc_database_get_vendor(db);
+
+	if (!vendor || strcmp(vendor, VENDOR) != 0) {
+		fprintf(stderr, "Vendor doesn't match: %s != %s\n", vendor, VENDOR);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int test_open(struct loc_ctx* ctx, FILE* f) {
+	struct loc_database* db = NULL;
+	size_t length = 0;
+	int r;
+
+	// Open the database from the file descriptor
+	r = loc_database_new_from_fd(ctx, &db, fileno(f), 0);
+	if (r) {
+		fprintf(stderr, "Could not open database from file descriptor: %m\n");
+		return r;
+	}
+
+	r = check_vendor(db);
+	loc_database_unref(db);
+	if (r)
+		return r;
+
+	// Open the database from memory
+	char* buffer = read_database(f, &length);
+	if (!buffer) {
+		fprintf(stderr, "Could not read database: %m\n");
+		return 1;
+	}
+
+	r = loc_database_new_from_buffer(ctx, &db, buffer, length, LOC_DB_FLAGS_VALIDATE,
+		destroy_buffer);
+	if (r) {
+		fprintf(stderr, "Could not open database from memory: %m\n");
+		free(buffer);
+		return r;
+	}
+
+	r = check_vendor(db);
+	loc_database_unref(db);
+	if (r)
+		return r;
+
+	// The buffer must have been released
+	if (destroyed != 1) {
+		fprintf(stderr, "The buffer has not been released\n");
+		return 1;
+	}
+
+	// A truncated database must not be opened and the buffer must remain with us
+	buffer = read_database(f, &length);
+	if (!buffer)
+		return 1;
+
+	r = loc_database_new_from_buffer(ctx, &db, buffer, 128, 0, destroy_buffer);
+	if (r == 0) {
+		fprintf(stderr, "Truncated database was opened\n");
+		loc_database_unref(db);
+		return 1;
+	}
+
+	free(buffer);
+
+	if (destroyed != 1) {
+		fprintf(stderr, "The buffer has been released after an error\n");
+		return 1;
+	}
+
+	return 0;
+}
+
 int main(int argc, char** argv) {
 	int err;
 
@@ -186,6 +400,11 @@ int main(int argc, char** argv) {
 		exit(EXIT_FAILURE);
 	}
 
+	// Open the database from a file descriptor and from memory
+	err = test_open(ctx, f);
+	if (err)
+		exit(EXIT_FAILURE);
+
 	// Try reading something from the database
 	vendor = loc_database_get_vendor(db);
 	if (!vendor) {
@@ -196,6 +415,99 @@ int main(int argc, char** argv) {
 		exit(EXIT_FAILURE);
 	}
 
+	// Lookup an address without allocating a network
+	struct loc_database_lookup_result result;
+	struct in6_addr address;
+
+	err = inet_pton(AF_INET6, "2001:db8:1000::1", &address);
+	if (err != 1) {
+		fprintf(stderr, "Could not parse IP address\n");
+		exit(EXIT_FAILURE);
+	}
+
+	err = loc_database_lookup_result(db, &address, &result);
+	if (err) {
+		fprintf(stderr, "Could not look up 2001:db8:1000::1\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (result.family != AF_INET6 || result.prefix != 48) {
+		fprintf(stderr, "Lookup returned an unexpected network: /%u\n", result.prefix);
+		exit(EXIT_FAILURE);
+	}
+
+	// The result must match what loc_database_lookup() returns
+	err = loc_database_lookup(db, &address, &network);
+	if (err) {
+		fprintf(stderr, "Could not look up 2001:db8:1000::1\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (memcmp(loc_network_get_first_address(network), &result.first_address, sizeof(address)) != 0
+			|| memcmp(loc_network_get_last_address(network), &result.last_address, sizeof(address)) != 0
+			|| loc_network_prefix(network) != result.prefix) {
+		fprintf(stderr, "Lookup results differ: %s\n", loc_network_str(network));
+		exit(EXIT_FAILURE);
+	}
+	loc_network_unref(network);
+
+	// Lookup an address that is not in the database
+	err = inet_pton(AF_INET6, "2001:db9::1", &address);
+	if (err != 1) {
+		fprintf(stderr, "Could not parse IP address\n");
+		exit(EXIT_FAILURE);
+	}
+
+	err = loc_database_lookup_result(db, &address, &result);
+	if (err != 1 || result.family != AF_UNSPEC) {
+		fprintf(stderr, "Found a network for 2001:db9::1, but I shouldn't\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Lookup many addresses at once
+	struct in6_addr batch_addresses[] = {
+		{ .s6_addr = { 0x20, 0x01, 0x0d, 0xb8, 0x10, 0x00 } },
+		{ .s6_addr = { 0x20, 0x01, 0x0d, 0xb8, 0x20, 0x20, 0, 0, 0, 0, 0, 0, 0, 0, 0, 1 } },
+		{ .s6_addr = { 0x20, 0x01, 0x0d, 0xb8, 0xff, 0xff } },
+		{ .s6_addr = { 0x20, 0x01, 0x0d, 0xb9 } },
+		{ .s6_addr = { 0x20, 0x01, 0x0d, 0xb8, 0x20, 0x00, 0xff } },
+	};
+	const size_t batch_size = sizeof(batch_addresses) / sizeof(*batch_addresses);
+	struct loc_database_lookup_result batch_results[batch_size];
+
+	size_t batch_matches = 0;
+
+	err = loc_database_lookup_batch(db, batch_addresses, batch_size, batch_results, &batch_matches);
+	if (err) {
+		fprintf(stderr, "Batch lookup failed: %m\n");
+		exit(EXIT_FAILURE);
+	}
+
+	if (batch_matches != 4) {
+		fprintf(stderr, "Batch lookup returned an unexpected number of matches: %zu\n",
+			batch_matches);
+		exit(EXIT_FAILURE);
+	}
+
+	// All results must be the same as for a single lookup
+	for (unsigned int i = 0; i < batch_size; i++) {
+		err = loc_database_lookup_result(db, &batch_addresses[i], &result);
+		if (err < 0) {
+			fprintf(stderr, "Could not look up address %u\n", i);
+			exit(EXIT_FAILURE);
+		}
+
+		if (memcmp(&result, &batch_results[i], sizeof(result)) != 0) {
+			fprintf(stderr, "Batch lookup result %u differs\n", i);
+			exit(EXIT_FAILURE);
+		}
+	}
+
+	// Validation
+	err = test_validate(ctx, f);
+	if (err)
+		exit(EXIT_FAILURE);
+
 	// Enumerator
 	struct loc_database_enumerator* enumerator;
 	err = loc_database_enumerator_new(&enumerator, db, LOC_DB_ENUMERATE_NETWORKS, 0);
@@ -204,6 +516,9 @@ int main(int argc, char** argv) {
 		exit(EXIT_FAILURE);
 	}
 
+	unsigned int count = 0;
+	char first[INET6_ADDRSTRLEN + 4] = "";
+
 	// Walk through all networks
 	while (1) {
 		err = loc_database_enumerator_next_network(enumerator, &network);
@@ -217,6 +532,41 @@ int main(int argc, char** argv) {
 
 		const char* s = loc_network_str(network);
 		printf("Got network: %s\n", s);
+
+		if (!count++)
+			snprintf(first, sizeof(first), "%s", s);
+
+		loc_network_unref(network);
+	}
+
+	// Start again after fetching only one network
+	for (unsigned int i = 0; i < 2; i++) {
+		loc_database_enumerator_reset(enumerator);
+
+		err = loc_database_enumerator_next_network(enumerator, &network);
+		if (err || !network || strcmp(loc_network_str(network), first) != 0) {
+			fprintf(stderr, "Did not start from the beginning after reset\n");
+			exit(EXIT_FAILURE);
+		}
+
+		loc_network_unref(network);
+	}
+
+	// Walk through the rest of the networks again
+	for (unsigned int i = 1; i < count; i++) {
+		err = loc_database_enumerator_next_network(enumerator, &network);
+		if (err || !network) {
+			fprintf(stderr, "Could only find %u of %u networks after reset\n", i, count);
+			exit(EXIT_FAILURE);
+		}
+
+		loc_network_unref(network);
+	}
+
+	err = loc_database_enumerator_next_network(enumerator, &network);
+	if (err || network) {
+		fprintf(stderr, "Found more networks after reset\n");
+		exit(EXIT_FAILURE);
 	}
 
 	// Free the enumerator
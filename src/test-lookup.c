@@ -0,0 +1,1250 @@
+/*
+	libloc - A library to determine the location of someone on the Internet
+
+	Copyright (C) 2017 IPFire Development Team <info@ipfire.org>
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <inttypes.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+
+#include <libloc/libloc.h>
+#include <libloc/address.h>
+#include <libloc/as.h>
+#include <libloc/as-list.h>
+#include <libloc/country.h>
+#include <libloc/country-list.h>
+#include <libloc/database.h>
+#include <libloc/lookup-cache.h>
+#include <libloc/network.h>
+#include <libloc/writer.h>
+
+/*
+	This test creates a database with many random networks and checks
+	that all lookup accelerators return exactly the same results as
+	walking the tree in the database.
+
+	It only looks up a sample of addresses, "make bench" compares the
+	results of all accelerators for many more.
+*/
+
+#define NETWORKS	20000
+#define LOOKUPS		10000
+
+// Check the ranges of every n-th lookup
+#define RANGE_SAMPLE	16
+
+static const char* fixed_networks[] = {
+	"2000::/3",
+	"2001:db8::/32",
+	"2001:db8::1/128",
+	"0.0.0.0/2",
+	"10.0.0.0/8",
+	"10.1.2.3/32",
+	"192.168.0.0/16",
+	NULL,
+};
+
+static const char* country_codes[] = {
+	"DE", "FR", "GB", "US",
+};
+
+static uint64_t seed = 0x9e3779b97f4a7c15;
+
+static uint64_t next_random(void) {
+	seed ^= seed << 13;
+	seed ^= seed >> 7;
+	seed ^= seed << 17;
+
+	return seed;
+}
+
+static void random_address(struct in6_addr* address) {
+	uint64_t r = next_random();
+
+	memset(address, 0, sizeof(*address));
+
+	if (r & 1) {
+		address->s6_addr[10] = 0xff;
+		address->s6_addr[11] = 0xff;
+
+		for (unsigned int i = 12; i < 16; i++)
+			address->s6_addr[i] = next_random();
+	} else {
+		for (unsigned int i = 0; i < 16; i++)
+			address->s6_addr[i] = next_random();
+
+		// Keep most IPv6 addresses close together
+		if (r & 2) {
+			address->s6_addr[0] = 0x20;
+			address->s6_addr[1] = 0x01;
+		}
+	}
+}
+
+static int add_network(struct loc_writer* writer, const char* string) {
+	struct loc_network* network = NULL;
+	int r;
+
+	r = loc_writer_add_network(writer, &network, string);
+
+	// Ignore duplicates
+	if (r == -EBUSY) {
+		loc_network_unref(network);
+		return 0;
+	} else if (r) {
+		fprintf(stderr, "Could not add network %s\n", string);
+		return r;
+	}
+
+	loc_network_set_asn(network, next_random() % 65536);
+
+	// Give some networks a country code or flag
+	const uint64_t r2 = next_random();
+
+	if (r2 % 3)
+		loc_network_set_country_code(network, country_codes[(r2 >> 8) % 4]);
+
+	if (r2 % 8 == 0)
+		loc_network_set_flag(network, LOC_NETWORK_FLAG_ANYCAST);
+
+	loc_network_unref(network);
+
+	return 0;
+}
+
+static struct loc_writer* create_writer(struct loc_ctx* ctx) {
+	struct loc_writer* writer = NULL;
+	struct loc_network* network = NULL;
+	struct in6_addr address;
+	int r;
+
+	r = loc_writer_new(ctx, &writer, NULL, NULL);
+	if (r)
+		return NULL;
+
+	for (const char** n = fixed_networks; *n; n++) {
+		r = add_network(writer, *n);
+		if (r)
+			goto ERROR;
+	}
+
+	for (unsigned int i = 0; i < NETWORKS; i++) {
+		unsigned int prefix;
+
+		random_address(&address);
+
+		if (IN6_IS_ADDR_V4MAPPED(&address))
+			prefix = 1 + next_random() % 32;
+		else
+			prefix = 1 + next_random() % 128;
+
+		r = loc_network_new(ctx, &network, &address, prefix);
+		if (r)
+			goto ERROR;
+
+		r = add_network(writer, loc_network_str(network));
+		loc_network_unref(network);
+		if (r)
+			goto ERROR;
+	}
+
+	return writer;
+
+ERROR:
+	loc_writer_unref(writer);
+
+	return NULL;
+}
+
+static FILE* write_database(struct loc_writer* writer, enum loc_database_version version) {
+	FILE* f = tmpfile();
+	if (!f)
+		return NULL;
+
+	int r = loc_writer_write(writer, f, version);
+	if (r) {
+		fclose(f);
+		return NULL;
+	}
+
+	return f;
+}
+
+/*
+	Checks that the range of the result contains the address and that it is not
+	larger than the largest possible range.
+*/
+static int check_range(const struct loc_database_lookup_result* reference,
+		const struct loc_database_lookup_result* result, const struct in6_addr* address) {
+	if (loc_address_cmp(&result->range_first_address, address) > 0
+			|| loc_address_cmp(address, &result->range_last_address) > 0) {
+		fprintf(stderr, "The range of %s does not contain it\n", loc_address_str(address));
+		return 1;
+	}
+
+	if (loc_address_cmp(&result->range_first_address, &reference->range_first_address) < 0
+			|| loc_address_cmp(&result->range_last_address, &reference->range_last_address) > 0) {
+		fprintf(stderr, "The range of %s is too large: %s - %s\n",
+			loc_address_str(address), loc_address_str(&result->range_first_address),
+			loc_address_str(&result->range_last_address));
+		return 1;
+	}
+
+	return 0;
+}
+
+/*
+	Checks the ranges that an accelerated database returns for address
+*/
+static int check_ranges(struct loc_database* db, struct loc_database* accelerated,
+		const struct in6_addr* address) {
+	struct loc_database_lookup_result reference;
+	struct loc_database_lookup_result result;
+
+	if (loc_database_lookup_range(db, address, &reference) < 0)
+		return 1;
+
+	if (loc_database_lookup_result(accelerated, address, &result) < 0)
+		return 1;
+
+	if (check_range(&reference, &result, address))
+		return 1;
+
+	if (IN6_IS_ADDR_V4MAPPED(address)) {
+		if (loc_database_lookup4(accelerated, ntohl(address->s6_addr32[3]), &result) < 0)
+			return 1;
+
+		if (check_range(&reference, &result, address))
+			return 1;
+	}
+
+	return 0;
+}
+
+/*
+	Resets everything that may differ between databases and accelerators
+*/
+static void reset_result(struct loc_database_lookup_result* result) {
+	// The position of the network may differ between database versions
+	result->network_index = 0;
+
+	// The accelerators may return smaller ranges
+	memset(&result->range_first_address, 0, sizeof(result->range_first_address));
+	memset(&result->range_last_address, 0, sizeof(result->range_last_address));
+}
+
+static int compare(struct loc_database* db1, struct loc_database* db2,
+		const struct in6_addr* address) {
+	struct loc_database_lookup_result result1;
+	struct loc_database_lookup_result result2;
+	int r1, r2;
+
+	r1 = loc_database_lookup_result(db1, address, &result1);
+	r2 = loc_database_lookup_result(db2, address, &result2);
+
+	if (r1 < 0 || r2 < 0) {
+		fprintf(stderr, "Could not look up %s\n", loc_address_str(address));
+		return 1;
+	}
+
+	reset_result(&result1);
+	reset_result(&result2);
+
+	if (r1 != r2 || memcmp(&result1, &result2, sizeof(result1)) != 0) {
+		fprintf(stderr, "Lookup results for %s differ: /%u != /%u\n",
+			loc_address_str(address), result1.prefix, result2.prefix);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int compare4(struct loc_database* db1, struct loc_database* db2,
+		const struct in6_addr* address) {
+	struct loc_database_lookup_result result1;
+	struct loc_database_lookup_result result2;
+	int r1, r2;
+
+	r1 = loc_database_lookup_result(db1, address, &result1);
+	r2 = loc_database_lookup4(db2, ntohl(address->s6_addr32[3]), &result2);
+
+	if (r1 < 0 || r2 < 0) {
+		fprintf(stderr, "Could not look up %s\n", loc_address_str(address));
+		return 1;
+	}
+
+	reset_result(&result1);
+	reset_result(&result2);
+
+	if (r1 != r2 || memcmp(&result1, &result2, sizeof(result1)) != 0) {
+		fprintf(stderr, "IPv4 lookup results for %s differ: /%u != /%u\n",
+			loc_address_str(address), result1.prefix, result2.prefix);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int compare_networks(struct loc_database* db1, struct loc_database* db2) {
+	struct loc_database_enumerator* enumerator1 = NULL;
+	struct loc_database_enumerator* enumerator2 = NULL;
+	struct loc_network* network1 = NULL;
+	struct loc_network* network2 = NULL;
+	int r;
+
+	r = loc_database_enumerator_new(&enumerator1, db1, LOC_DB_ENUMERATE_NETWORKS, 0);
+	if (r)
+		return r;
+
+	r = loc_database_enumerator_new(&enumerator2, db2, LOC_DB_ENUMERATE_NETWORKS, 0);
+	if (r)
+		goto ERROR;
+
+	while (1) {
+		r = loc_database_enumerator_next_network(enumerator1, &network1);
+		if (r)
+			goto ERROR;
+
+		r = loc_database_enumerator_next_network(enumerator2, &network2);
+		if (r)
+			goto ERROR;
+
+		// Both enumerators must end at the same time
+		if (!network1 || !network2) {
+			if (network1 || network2) {
+				fprintf(stderr, "Enumerators returned a different number of networks\n");
+				r = 1;
+			}
+
+			break;
+		}
+
+		if (loc_network_cmp(network1, network2) != 0
+				|| loc_network_get_asn(network1) != loc_network_get_asn(network2)) {
+			fprintf(stderr, "Enumerated networks differ: %s\n", loc_network_str(network1));
+			r = 1;
+			goto ERROR;
+		}
+
+		loc_network_unref(network1);
+		loc_network_unref(network2);
+		network1 = network2 = NULL;
+	}
+
+ERROR:
+	if (network1)
+		loc_network_unref(network1);
+	if (network2)
+		loc_network_unref(network2);
+	if (enumerator1)
+		loc_database_enumerator_unref(enumerator1);
+	if (enumerator2)
+		loc_database_enumerator_unref(enumerator2);
+
+	return r;
+}
+
+/*
+	Checks whether an enumerator with filters returns the same networks
+	as filtering all networks here
+*/
+static int test_filter(struct loc_ctx* ctx, struct loc_database* db,
+		const char* country_code, unsigned int asns, int flag, int family) {
+	struct loc_database_enumerator* enumerator1 = NULL;
+	struct loc_database_enumerator* enumerator2 = NULL;
+	struct loc_country_list* countries = NULL;
+	struct loc_as_list* as_list = NULL;
+	struct loc_network* network1 = NULL;
+	struct loc_network* network2 = NULL;
+	struct loc_country* country = NULL;
+	struct loc_as* as = NULL;
+	unsigned int matches = 0;
+	int r;
+
+	r = loc_database_enumerator_new(&enumerator1, db, LOC_DB_ENUMERATE_NETWORKS, 0);
+	if (r)
+		goto ERROR;
+
+	r = loc_database_enumerator_new(&enumerator2, db, LOC_DB_ENUMERATE_NETWORKS, 0);
+	if (r)
+		goto ERROR;
+
+	// Filter by country
+	if (country_code) {
+		r = loc_country_list_new(ctx, &countries);
+		if (r)
+			goto ERROR;
+
+		if (*country_code) {
+			r = loc_country_new(ctx, &country, country_code);
+			if (r)
+				goto ERROR;
+
+			r = loc_country_list_append(countries, country);
+			if (r)
+				goto ERROR;
+		}
+
+		loc_database_enumerator_set_countries(enumerator2, countries);
+	}
+
+	// Filter by every 100th ASN
+	if (asns) {
+		r = loc_as_list_new(ctx, &as_list);
+		if (r)
+			goto ERROR;
+
+		for (unsigned int i = asns; i > 0; i--) {
+			r = loc_as_new(ctx, &as, i * 100);
+			if (r)
+				goto ERROR;
+
+			r = loc_as_list_append(as_list, as);
+			loc_as_unref(as);
+			as = NULL;
+			if (r)
+				goto ERROR;
+		}
+
+		loc_database_enumerator_set_asns(enumerator2, as_list);
+	}
+
+	if (flag)
+		loc_database_enumerator_set_flag(enumerator2, flag);
+
+	if (family)
+		loc_database_enumerator_set_family(enumerator2, family);
+
+	while (1) {
+		r = loc_database_enumerator_next_network(enumerator1, &network1);
+		if (r)
+			goto ERROR;
+
+		if (!network1)
+			break;
+
+		if (family && loc_network_address_family(network1) != family)
+			goto NEXT;
+
+		if (countries || as_list || flag) {
+			const uint32_t asn = loc_network_get_asn(network1);
+
+			if (!(country && strcmp(loc_network_get_country_code(network1), country_code) == 0)
+					&& !(asns && asn % 100 == 0 && asn > 0 && asn <= asns * 100)
+					&& !(flag && loc_network_has_flag(network1, flag)))
+				goto NEXT;
+		}
+
+		matches++;
+
+		// The filtered enumerator must return the same network
+		r = loc_database_enumerator_next_network(enumerator2, &network2);
+		if (r)
+			goto ERROR;
+
+		if (!network2 || loc_network_cmp(network1, network2) != 0) {
+			fprintf(stderr, "Filtered enumerator did not return %s\n", loc_network_str(network1));
+			r = 1;
+			goto ERROR;
+		}
+
+		loc_network_unref(network2);
+		network2 = NULL;
+
+NEXT:
+		loc_network_unref(network1);
+		network1 = NULL;
+	}
+
+	// There must not be any more networks
+	r = loc_database_enumerator_next_network(enumerator2, &network2);
+	if (r)
+		goto ERROR;
+
+	if (network2) {
+		fprintf(stderr, "Filtered enumerator returned %s\n", loc_network_str(network2));
+		r = 1;
+		goto ERROR;
+	}
+
+	printf("Filter %s/%u/%d/%d matched %u network(s)\n",
+		country_code ? country_code : "-", asns, flag, family, matches);
+
+ERROR:
+	if (network1)
+		loc_network_unref(network1);
+	if (network2)
+		loc_network_unref(network2);
+	if (country)
+		loc_country_unref(country);
+	if (countries)
+		loc_country_list_unref(countries);
+	if (as_list)
+		loc_as_list_unref(as_list);
+	if (enumerator1)
+		loc_database_enumerator_unref(enumerator1);
+	if (enumerator2)
+		loc_database_enumerator_unref(enumerator2);
+
+	return r;
+}
+
+static int test_filters(struct loc_ctx* ctx, struct loc_database* db) {
+	int r;
+
+	const struct filter {
+		const char* country_code;
+		unsigned int asns;
+		int flag;
+		int family;
+	} filters[] = {
+		{ NULL, 0, 0, AF_INET },
+		{ "DE", 0, 0, 0 },
+		{ "US", 0, 0, AF_INET6 },
+		{ NULL, 300, 0, 0 },
+		{ NULL, 0, LOC_NETWORK_FLAG_ANYCAST, 0 },
+		{ "FR", 300, LOC_NETWORK_FLAG_ANYCAST, AF_INET },
+		{ "DE", 300, 0, 0 },
+		{ "GB", 300, 0, AF_INET6 },
+		{ "ZZ", 0, 0, 0 },
+
+		// An empty list of countries does not match anything
+		{ "", 0, 0, 0 },
+		{ NULL, 0, 0, 0 },
+	};
+
+	for (const struct filter* f = filters; f->country_code || f->asns || f->flag || f->family; f++) {
+		r = test_filter(ctx, db, f->country_code, f->asns, f->flag, f->family);
+		if (r)
+			return r;
+	}
+
+	return 0;
+}
+
+static int is_same_result(int r1, const struct loc_database_lookup_result* result1,
+		int r2, const struct loc_database_lookup_result* result2) {
+	if (r1 != r2)
+		return 0;
+
+	// Neither lookup has found anything
+	if (r1)
+		return 1;
+
+	return result1->network_index == result2->network_index;
+}
+
+/*
+	Checks that loc_database_lookup_range() returns the largest possible range
+*/
+static int test_range(struct loc_database* db, const struct in6_addr* address) {
+	struct loc_database_lookup_result result;
+	struct loc_database_lookup_result other;
+	struct in6_addr edge;
+	int r1, r2;
+
+	r1 = loc_database_lookup_range(db, address, &result);
+	if (r1 < 0)
+		return 1;
+
+	// A regular lookup must return the same network
+	r2 = loc_database_lookup_result(db, address, &other);
+	if (!is_same_result(r1, &result, r2, &other)) {
+		fprintf(stderr, "Lookup results for %s differ\n", loc_address_str(address));
+		return 1;
+	}
+
+	// Its range must be within the largest possible range
+	if (check_range(&result, &other, address))
+		return 1;
+
+	// The addresses at the edges of the range must have exactly the same result
+	r2 = loc_database_lookup_range(db, &result.range_first_address, &other);
+	if (r1 != r2 || memcmp(&result, &other, sizeof(result)) != 0) {
+		fprintf(stderr, "The first address in the range of %s has another result\n",
+			loc_address_str(address));
+		return 1;
+	}
+
+	r2 = loc_database_lookup_range(db, &result.range_last_address, &other);
+	if (r1 != r2 || memcmp(&result, &other, sizeof(result)) != 0) {
+		fprintf(stderr, "The last address in the range of %s has another result\n",
+			loc_address_str(address));
+		return 1;
+	}
+
+	// The addresses right outside of the range must have another result
+	loc_address_reset(&edge, loc_address_family(address));
+
+	if (loc_address_cmp(&result.range_first_address, &edge) != 0) {
+		edge = result.range_first_address;
+		loc_address_decrement(&edge);
+
+		r2 = loc_database_lookup_result(db, &edge, &other);
+		if (is_same_result(r1, &result, r2, &other)) {
+			fprintf(stderr, "The range of %s could start earlier\n", loc_address_str(address));
+			return 1;
+		}
+	}
+
+	loc_address_reset_last(&edge, loc_address_family(address));
+
+	if (loc_address_cmp(&result.range_last_address, &edge) != 0) {
+		edge = result.range_last_address;
+		loc_address_increment(&edge);
+
+		r2 = loc_database_lookup_result(db, &edge, &other);
+		if (is_same_result(r1, &result, r2, &other)) {
+			fprintf(stderr, "The range of %s could end later\n", loc_address_str(address));
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+static int test_ranges(struct loc_database* db) {
+	struct in6_addr address;
+	int r;
+
+	for (unsigned int i = 0; i < LOOKUPS; i++) {
+		random_address(&address);
+
+		r = test_range(db, &address);
+		if (r)
+			return r;
+	}
+
+	return 0;
+}
+
+/*
+	Checks that looking up single fields returns the same as a full lookup
+*/
+static int compare_fields(struct loc_database* db1, struct loc_database* db2,
+		const struct in6_addr* address) {
+	struct loc_database_lookup_result result;
+	enum loc_network_flags flags;
+	char country_code[3];
+	uint32_t asn;
+	int r;
+
+	r = loc_database_lookup_result(db1, address, &result);
+	if (r < 0)
+		return 1;
+
+	if (loc_database_lookup_asn(db2, address, &asn) != r
+			|| loc_database_lookup_country_code(db2, address, country_code) != r
+			|| loc_database_lookup_flags(db2, address, &flags) != r) {
+		fprintf(stderr, "Could not look up fields of %s\n", loc_address_str(address));
+		return 1;
+	}
+
+	if (asn != result.asn || strcmp(country_code, result.country_code) != 0
+			|| flags != result.flags) {
+		fprintf(stderr, "Fields of %s differ: AS%u/%s/%d != AS%u/%s/%d\n",
+			loc_address_str(address), asn, country_code, flags,
+			result.asn, result.country_code, result.flags);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int test_flags(struct loc_ctx* ctx, FILE* f, struct loc_database* db, int flags) {
+	struct loc_database* accelerated = NULL;
+	struct loc_database_lookup_result result;
+	struct in6_addr address;
+	int r;
+
+	r = loc_database_new_with_flags(ctx, &accelerated, f, flags);
+	if (r) {
+		fprintf(stderr, "Could not open database with flags %d: %m\n", flags);
+		return r;
+	}
+
+	// Look up random addresses
+	for (unsigned int i = 0; i < LOOKUPS; i++) {
+		random_address(&address);
+
+		r = compare(db, accelerated, &address);
+		if (r)
+			goto ERROR;
+
+		r = compare_fields(db, accelerated, &address);
+		if (r)
+			goto ERROR;
+
+		// Check the ranges on a small sample
+		if (i % RANGE_SAMPLE == 0) {
+			r = check_ranges(db, accelerated, &address);
+			if (r)
+				goto ERROR;
+		}
+
+		// Look up IPv4 addresses directly
+		if (IN6_IS_ADDR_V4MAPPED(&address)) {
+			r = compare4(db, accelerated, &address);
+			if (r)
+				goto ERROR;
+		}
+
+		// Check the edges of the network that we found
+		if (loc_database_lookup_result(db, &address, &result) == 0) {
+			r = compare(db, accelerated, &result.first_address);
+			if (r)
+				goto ERROR;
+
+			r = compare(db, accelerated, &result.last_address);
+			if (r)
+				goto ERROR;
+		}
+	}
+
+ERROR:
+	loc_database_unref(accelerated);
+
+	return r;
+}
+
+static int test_mlock(struct loc_ctx* ctx, FILE* f, struct loc_database* db) {
+	struct loc_database* locked = NULL;
+	int r;
+
+	r = loc_database_new_with_flags(ctx, &locked, f, LOC_DB_FLAGS_MLOCK);
+	if (r) {
+		switch (errno) {
+			case EAGAIN:
+			case ENOMEM:
+			case EPERM:
+				printf("Skipping locked database: %m\n");
+				return 0;
+
+			default:
+				fprintf(stderr, "Could not open locked database: %m\n");
+				return r;
+		}
+	}
+
+	loc_database_unref(locked);
+
+	return test_flags(ctx, f, db, LOC_DB_FLAGS_MLOCK|LOC_DB_FLAGS_COPY_TREE);
+}
+
+/*
+	Looks up addresses right next to the IPv4 part of the tree in a database
+	that has both IPv4 and IPv6 networks
+*/
+static int test_boundaries(struct loc_ctx* ctx) {
+	struct loc_database_lookup_result result1;
+	struct loc_database_lookup_result result2;
+	struct loc_lookup_cache* cache = NULL;
+	struct loc_writer* writer = NULL;
+	struct loc_network* network = NULL;
+	struct loc_database* reference = NULL;
+	struct loc_database* db = NULL;
+	struct in6_addr address;
+	FILE* files[2] = { NULL, NULL };
+	int r = 1;
+
+	const char* addresses[] = {
+		"::fffe:ffff:ffff",
+		"::fffe:0:1",
+		"::ffff:0:0",
+		"::ffff:1.2.3.4",
+		"::ffff:255.255.255.255",
+		"::1:0:0:0",
+		"::1:0:0:1",
+		NULL,
+	};
+
+	const int flags[] = {
+		0,
+		LOC_DB_FLAGS_POPTRIE,
+		LOC_DB_FLAGS_DIR24_8,
+		LOC_DB_FLAGS_POPTRIE|LOC_DB_FLAGS_DIR24_8,
+		LOC_DB_FLAGS_COPY_TREE|LOC_DB_FLAGS_VALIDATE,
+		-1,
+	};
+
+	if (loc_writer_new(ctx, &writer, NULL, NULL))
+		goto ERROR;
+
+	if (loc_writer_add_network(writer, &network, "1.0.0.0/8"))
+		goto ERROR;
+
+	loc_network_set_country_code(network, "DE");
+	loc_network_unref(network);
+	network = NULL;
+
+	if (loc_writer_add_network(writer, &network, "2001:db8::/32"))
+		goto ERROR;
+
+	loc_network_set_country_code(network, "FR");
+	loc_network_unref(network);
+	network = NULL;
+
+	// Networks right at the edges of the IPv4 part of the tree
+	if (loc_writer_add_network(writer, &network, "::/16"))
+		goto ERROR;
+
+	loc_network_unref(network);
+	network = NULL;
+
+	if (loc_writer_add_network(writer, &network, "255.0.0.0/8"))
+		goto ERROR;
+
+	loc_network_unref(network);
+	network = NULL;
+
+	if (loc_writer_add_network(writer, &network, "0.0.0.0/8"))
+		goto ERROR;
+
+	loc_network_unref(network);
+	network = NULL;
+
+	files[0] = write_database(writer, LOC_DATABASE_VERSION_1);
+	files[1] = write_database(writer, LOC_DATABASE_VERSION_2);
+	if (!files[0] || !files[1])
+		goto ERROR;
+
+	for (unsigned int i = 0; i < 2; i++) {
+		if (loc_database_new(ctx, &reference, files[i]))
+			goto ERROR;
+
+		// The ranges must not cross into or out of the IPv4 part
+		for (const char** a = addresses; *a; a++) {
+			if (loc_address_parse(&address, NULL, *a))
+				goto ERROR;
+
+			if (test_range(reference, &address)) {
+				fprintf(stderr, "  in version %u\n", i + 1);
+				goto ERROR;
+			}
+		}
+
+		for (const int* f = flags; *f >= 0; f++) {
+			if (loc_database_new_with_flags(ctx, &db, files[i], *f))
+				goto ERROR;
+
+			for (const char** a = addresses; *a; a++) {
+				if (loc_address_parse(&address, NULL, *a))
+					goto ERROR;
+
+				if (compare(reference, db, &address) || check_ranges(reference, db, &address)) {
+					fprintf(stderr, "  in version %u with flags %d\n", i + 1, *f);
+					goto ERROR;
+				}
+			}
+
+			// A miss right next to the IPv4 part must not hide any IPv4 networks in the cache
+			if (loc_lookup_cache_new(ctx, &cache, db, 16))
+				goto ERROR;
+
+			for (const char** a = addresses; *a; a++) {
+				if (loc_address_parse(&address, NULL, *a))
+					goto ERROR;
+
+				if (loc_database_lookup_result(db, &address, &result1) < 0
+						|| loc_lookup_cache_lookup(cache, &address, &result2) < 0)
+					goto ERROR;
+
+				if (memcmp(&result1, &result2, sizeof(result1)) != 0) {
+					fprintf(stderr, "Cached lookup results for %s differ in version %u with flags %d\n",
+						*a, i + 1, *f);
+					goto ERROR;
+				}
+			}
+
+			loc_lookup_cache_unref(cache);
+			cache = NULL;
+
+			loc_database_unref(db);
+			db = NULL;
+		}
+
+		loc_database_unref(reference);
+		reference = NULL;
+	}
+
+	r = 0;
+
+ERROR:
+	if (cache)
+		loc_lookup_cache_unref(cache);
+	if (db)
+		loc_database_unref(db);
+	if (reference)
+		loc_database_unref(reference);
+	if (network)
+		loc_network_unref(network);
+	if (writer)
+		loc_writer_unref(writer);
+
+	for (unsigned int i = 0; i < 2; i++) {
+		if (files[i])
+			fclose(files[i]);
+	}
+
+	return r;
+}
+
+static int test_cache(struct loc_ctx* ctx, struct loc_database* db) {
+	struct loc_database_lookup_result result1;
+	struct loc_database_lookup_result result2;
+	struct loc_lookup_cache* cache = NULL;
+	struct in6_addr addresses[64];
+	int r1, r2;
+	int r;
+
+	r = loc_lookup_cache_new(ctx, &cache, db, 1024);
+	if (r) {
+		fprintf(stderr, "Could not create lookup cache: %m\n");
+		return r;
+	}
+
+	// Look up a small set of addresses over and over again
+	for (unsigned int i = 0; i < sizeof(addresses) / sizeof(*addresses); i++)
+		random_address(&addresses[i]);
+
+	for (unsigned int i = 0; i < LOOKUPS; i++) {
+		struct in6_addr* address = &addresses[next_random() % 64];
+
+		// Sometimes look at a new address
+		if (i % 4 == 0)
+			random_address(address);
+
+		r1 = loc_database_lookup_result(db, address, &result1);
+		r2 = loc_lookup_cache_lookup(cache, address, &result2);
+
+		if (r1 < 0 || r2 < 0) {
+			fprintf(stderr, "Could not look up %s\n", loc_address_str(address));
+			r = 1;
+			goto ERROR;
+		}
+
+		if (r1 != r2 || memcmp(&result1, &result2, sizeof(result1)) != 0) {
+			fprintf(stderr, "Cached lookup results for %s differ: /%u != /%u\n",
+				loc_address_str(address), result1.prefix, result2.prefix);
+			r = 1;
+			goto ERROR;
+		}
+	}
+
+	if (loc_lookup_cache_get_hits(cache) + loc_lookup_cache_get_misses(cache) != LOOKUPS) {
+		fprintf(stderr, "Lookup cache statistics are wrong\n");
+		r = 1;
+		goto ERROR;
+	}
+
+	// We must have had a couple of hits
+	if (!loc_lookup_cache_get_hits(cache)) {
+		fprintf(stderr, "The lookup cache had no hits\n");
+		r = 1;
+		goto ERROR;
+	}
+
+	printf("Lookup cache: %" PRIu64 " hit(s), %" PRIu64 " miss(es)\n",
+		loc_lookup_cache_get_hits(cache), loc_lookup_cache_get_misses(cache));
+
+	loc_lookup_cache_clear(cache);
+
+	if (loc_lookup_cache_get_hits(cache) || loc_lookup_cache_get_misses(cache)) {
+		fprintf(stderr, "Lookup cache has not been cleared\n");
+		r = 1;
+		goto ERROR;
+	}
+
+ERROR:
+	loc_lookup_cache_unref(cache);
+
+	return r;
+}
+
+int main(int argc, char** argv) {
+	struct loc_database* db = NULL;
+	struct loc_ctx* ctx = NULL;
+	int r;
+
+	r = loc_new(&ctx);
+	if (r < 0)
+		exit(EXIT_FAILURE);
+
+	loc_set_log_priority(ctx, LOG_INFO);
+
+	struct loc_writer* writer = create_writer(ctx);
+	if (!writer) {
+		fprintf(stderr, "Could not create database: %m\n");
+		exit(EXIT_FAILURE);
+	}
+
+	FILE* f = write_database(writer, LOC_DATABASE_VERSION_1);
+	if (!f) {
+		fprintf(stderr, "Could not write database: %m\n");
+		exit(EXIT_FAILURE);
+	}
+
+	FILE* f2 = write_database(writer, LOC_DATABASE_VERSION_2);
+	if (!f2) {
+		fprintf(stderr, "Could not write database in version 2: %m\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Write both versions again with the tree clustered in subtrees
+	loc_writer_set_flags(writer, LOC_WRITER_FLAGS_CLUSTER_TREE);
+
+	FILE* f3 = write_database(writer, LOC_DATABASE_VERSION_1);
+	FILE* f4 = write_database(writer, LOC_DATABASE_VERSION_2);
+	if (!f3 || !f4) {
+		fprintf(stderr, "Could not write clustered database: %m\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Write the database again with all networks pushed into the leaves
+	loc_writer_set_flags(writer, LOC_WRITER_FLAGS_PUSH_LEAVES);
+
+	// Older readers cannot read leaf-pushed trees, so they must not be written in version 1
+	FILE* f5 = write_database(writer, LOC_DATABASE_VERSION_1);
+	if (f5) {
+		fprintf(stderr, "Wrote a leaf-pushed database in version 1\n");
+		exit(EXIT_FAILURE);
+	}
+
+	FILE* f6 = write_database(writer, LOC_DATABASE_VERSION_2);
+
+	// And once more clustered in subtrees
+	loc_writer_set_flags(writer, LOC_WRITER_FLAGS_PUSH_LEAVES|LOC_WRITER_FLAGS_CLUSTER_TREE);
+
+	f5 = write_database(writer, LOC_DATABASE_VERSION_2);
+	if (!f5 || !f6) {
+		fprintf(stderr, "Could not write leaf-pushed database: %m\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Write the database again with an index of all networks
+	loc_writer_set_flags(writer, LOC_WRITER_FLAGS_NETWORK_INDEX);
+
+	FILE* f7 = write_database(writer, LOC_DATABASE_VERSION_2);
+	if (!f7) {
+		fprintf(stderr, "Could not write database with network index: %m\n");
+		exit(EXIT_FAILURE);
+	}
+
+	loc_writer_unref(writer);
+
+	r = loc_database_new(ctx, &db, f);
+	if (r) {
+		fprintf(stderr, "Could not open database: %m\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Ranges
+	r = test_ranges(db);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	// Poptrie
+	r = test_flags(ctx, f, db, LOC_DB_FLAGS_POPTRIE);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	// DIR-24-8
+	r = test_flags(ctx, f, db, LOC_DB_FLAGS_DIR24_8);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	// Both
+	r = test_flags(ctx, f, db, LOC_DB_FLAGS_POPTRIE|LOC_DB_FLAGS_DIR24_8);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	// Validated databases must return the same results without checking
+	r = test_flags(ctx, f, db, LOC_DB_FLAGS_VALIDATE);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	// The path-compressed tree must return the same results
+	r = test_flags(ctx, f2, db, 0);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	// The accelerators must work with it, too
+	r = test_flags(ctx, f2, db, LOC_DB_FLAGS_POPTRIE|LOC_DB_FLAGS_DIR24_8);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	r = test_flags(ctx, f2, db, LOC_DB_FLAGS_VALIDATE);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	// A copy of the tree must return the same results
+	r = test_flags(ctx, f, db, LOC_DB_FLAGS_COPY_TREE);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	r = test_flags(ctx, f2, db, LOC_DB_FLAGS_COPY_TREE|LOC_DB_FLAGS_VALIDATE);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	// Advice and huge pages must not change anything
+	r = test_flags(ctx, f, db, LOC_DB_FLAGS_POPULATE|LOC_DB_FLAGS_HUGEPAGES);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	r = test_flags(ctx, f2, db, LOC_DB_FLAGS_SEQUENTIAL);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	// Locking memory might not be permitted
+	r = test_mlock(ctx, f2, db);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	// Clustered trees must return the same results
+	r = test_flags(ctx, f3, db, 0);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	r = test_flags(ctx, f4, db, LOC_DB_FLAGS_VALIDATE|LOC_DB_FLAGS_POPTRIE);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	// Leaf-pushed trees must return the same results
+	r = test_flags(ctx, f5, db, 0);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	r = test_flags(ctx, f5, db, LOC_DB_FLAGS_POPTRIE|LOC_DB_FLAGS_DIR24_8);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	r = test_flags(ctx, f6, db, LOC_DB_FLAGS_COPY_TREE|LOC_DB_FLAGS_VALIDATE);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	// Enumerate all networks of both versions
+	struct loc_database* db2 = NULL;
+	struct loc_database* db3 = NULL;
+
+	r = loc_database_new(ctx, &db2, f2);
+	if (r) {
+		fprintf(stderr, "Could not open database in version 2: %m\n");
+		exit(EXIT_FAILURE);
+	}
+
+	r = compare_networks(db, db2);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	r = test_ranges(db2);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	// Filters
+	r = test_filters(ctx, db);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	r = test_filters(ctx, db2);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	// Filters must return the same networks from the network index
+	r = loc_database_new(ctx, &db3, f7);
+	if (r) {
+		fprintf(stderr, "Could not open database with network index: %m\n");
+		exit(EXIT_FAILURE);
+	}
+
+	r = compare_networks(db, db3);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	r = test_filters(ctx, db3);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	loc_database_unref(db3);
+
+	// Enumerate all networks from a copy of the tree
+	r = loc_database_new_with_flags(ctx, &db3, f2, LOC_DB_FLAGS_COPY_TREE);
+	if (r) {
+		fprintf(stderr, "Could not open database with a copy of the tree: %m\n");
+		exit(EXIT_FAILURE);
+	}
+
+	r = compare_networks(db, db3);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	r = test_ranges(db3);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	loc_database_unref(db3);
+
+	// Enumerate all networks from clustered and leaf-pushed trees
+	FILE* files[] = { f3, f4, f5, f6 };
+
+	for (unsigned int i = 0; i < sizeof(files) / sizeof(*files); i++) {
+		r = loc_database_new(ctx, &db3, files[i]);
+		if (r) {
+			fprintf(stderr, "Could not open database: %m\n");
+			exit(EXIT_FAILURE);
+		}
+
+		r = compare_networks(db, db3);
+		if (r)
+			exit(EXIT_FAILURE);
+
+		r = test_ranges(db3);
+		if (r)
+			exit(EXIT_FAILURE);
+
+		loc_database_unref(db3);
+	}
+
+	// Addresses next to the IPv4 part of the tree
+	r = test_boundaries(ctx);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	// Lookup cache
+	r = test_cache(ctx, db);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	r = test_cache(ctx, db2);
+	if (r)
+		exit(EXIT_FAILURE);
+
+	loc_database_unref(db2);
+	fclose(f2);
+	fclose(f3);
+	fclose(f4);
+	fclose(f5);
+	fclose(f6);
+	fclose(f7);
+
+	loc_database_unref(db);
+	loc_unref(ctx);
+	fclose(f);
+
+	return EXIT_SUCCESS;
+}
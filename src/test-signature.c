@@ -28,6 +28,69 @@
 #include <libloc/database.h>
 #include <libloc/writer.h>
 
+/*
+	Opens the database from a copy in memory and verifies it
+*/
+static int verify_buffer(struct loc_ctx* ctx, FILE* public_key,
+		char* buffer, size_t length) {
+	struct loc_database* db = NULL;
+	int r;
+
+	r = loc_database_new_from_buffer(ctx, &db, buffer, length, 0, NULL);
+	if (r) {
+		fprintf(stderr, "Could not open database from memory: %m\n");
+		return -1;
+	}
+
+	rewind(public_key);
+
+	r = loc_database_verify(db, public_key);
+	loc_database_unref(db);
+
+	return r;
+}
+
+static int test_verify_buffer(struct loc_ctx* ctx, FILE* f, FILE* public_key) {
+	int r = 1;
+
+	if (fseek(f, 0, SEEK_END))
+		return 1;
+
+	const size_t length = ftell(f);
+	rewind(f);
+
+	char* buffer = malloc(length);
+	if (!buffer)
+		return 1;
+
+	if (fread(buffer, 1, length, f) != length)
+		goto ERROR;
+
+	r = verify_buffer(ctx, public_key, buffer, length);
+	if (r) {
+		fprintf(stderr, "Could not verify the database in memory: %d\n", r);
+		r = 1;
+		goto ERROR;
+	}
+
+	// Change the last byte which must break the signature
+	buffer[length - 1] ^= 0xff;
+
+	r = verify_buffer(ctx, public_key, buffer, length);
+	if (r <= 0) {
+		fprintf(stderr, "A modified database was verified: %d\n", r);
+		r = 1;
+		goto ERROR;
+	}
+
+	r = 0;
+
+ERROR:
+	free(buffer);
+
+	return r;
+}
+
 int main(int argc, char** argv) {
 	int err;
 
@@ -93,6 +156,11 @@ int main(int argc, char** argv) {
 		exit(EXIT_FAILURE);
 	}
 
+	// Verify the database from memory
+	err = test_verify_buffer(ctx, f, public_key);
+	if (err)
+		exit(EXIT_FAILURE);
+
 	// Open another public key
 	public_key = freopen(ABS_SRCDIR "/src/signing-key.pem", "r", public_key);
 	if (!public_key) {
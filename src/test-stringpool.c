@@ -100,19 +100,56 @@ int main(int argc, char** argv) {
 		exit(EXIT_FAILURE);
 	}
 
+	char* strings[10000];
+	off_t positions[10000];
+
 	// Add 10000 random strings
 	for (unsigned int i = 0; i < 10000; i++) {
-		char* string = random_string(3);
-
-		pos = loc_stringpool_add(pool, string);
-		free(string);
+		strings[i] = random_string(3);
 
-		if (pos < 0) {
+		positions[i] = loc_stringpool_add(pool, strings[i]);
+		if (positions[i] < 0) {
 			fprintf(stderr, "Could not add string %d: %m\n", i);
 			exit(EXIT_FAILURE);
 		}
 	}
 
+	// Adding them again must return the same positions
+	for (unsigned int i = 0; i < 10000; i++) {
+		pos = loc_stringpool_add(pool, strings[i]);
+		if (pos != positions[i]) {
+			fprintf(stderr, "String %s was added again at %jd instead of %jd\n",
+				strings[i], (intmax_t)pos, (intmax_t)positions[i]);
+			exit(EXIT_FAILURE);
+		}
+
+		s = loc_stringpool_get(pool, pos);
+		if (!s || strcmp(s, strings[i]) != 0) {
+			fprintf(stderr, "Got a different string at %jd\n", (intmax_t)pos);
+			exit(EXIT_FAILURE);
+		}
+
+		free(strings[i]);
+	}
+
+	// Empty strings must only be added once
+	pos = loc_stringpool_add(pool, "");
+	if (pos < 0 || loc_stringpool_add(pool, "") != pos) {
+		fprintf(stderr, "Empty string was added more than once\n");
+		exit(EXIT_FAILURE);
+	}
+
+	// Add a string that is larger than the pool grows at once
+	char* large = random_string(1024 * 1024);
+
+	pos = loc_stringpool_add(pool, large);
+	if (pos < 0 || strcmp(loc_stringpool_get(pool, pos), large) != 0) {
+		fprintf(stderr, "Could not add a large string: %m\n");
+		exit(EXIT_FAILURE);
+	}
+
+	free(large);
+
 	// Dump pool
 	loc_stringpool_dump(pool);
 
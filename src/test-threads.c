@@ -0,0 +1,453 @@
+/*
+	libloc - A library to determine the location of someone on the Internet
+
+	Copyright (C) 2017 IPFire Development Team <info@ipfire.org>
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+*/
+
+#include <arpa/inet.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <syslog.h>
+#include <unistd.h>
+
+#include <libloc/libloc.h>
+#include <libloc/address.h>
+#include <libloc/as.h>
+#include <libloc/country.h>
+#include <libloc/database.h>
+#include <libloc/network.h>
+#include <libloc/writer.h>
+
+/*
+	This test shares one database between as many threads as there are CPUs
+	and checks that every thread sees exactly the same results as a single
+	thread would. "make bench" measures how well lookups scale.
+
+	All networks and addresses are derived from their index, so that they
+	are spread over the address space, but there are no duplicates.
+*/
+
+// The number of networks of each family
+#define NETWORKS		4096
+#define ASES			1000
+#define LOOKUPS			50000
+#define MAX_THREADS		64
+
+static const char* countries[] = {
+	"AT", "CH", "DE", "FR", "GB", "NL", "US", NULL,
+};
+
+static void make_address(struct in6_addr* address, unsigned int i) {
+	memset(address, 0, sizeof(*address));
+
+	// Multiplying by a large prime scatters the addresses over the entire range
+	const uint32_t n = i * 2654435761u;
+
+	if (i % 2) {
+		address->s6_addr32[2] = htonl(0xffff);
+		address->s6_addr32[3] = htonl(n);
+	} else {
+		address->s6_addr32[0] = htonl(0x20010db8);
+		address->s6_addr32[1] = htonl(n & 0x00ffffff);
+	}
+}
+
+static FILE* create_database(struct loc_ctx* ctx) {
+	struct loc_writer* writer = NULL;
+	struct loc_network* network = NULL;
+	struct loc_country* country = NULL;
+	struct loc_as* as = NULL;
+	char name[32];
+	FILE* f = NULL;
+	int r;
+
+	r = loc_writer_new(ctx, &writer, NULL, NULL);
+	if (r)
+		return NULL;
+
+	for (unsigned int i = 1; i <= ASES; i++) {
+		r = loc_writer_add_as(writer, &as, i);
+		if (r)
+			goto ERROR;
+
+		snprintf(name, sizeof(name), "Autonomous System %u", i);
+
+		r = loc_as_set_name(as, name);
+		loc_as_unref(as);
+		if (r)
+			goto ERROR;
+	}
+
+	for (const char** code = countries; *code; code++) {
+		r = loc_writer_add_country(writer, &country, *code);
+		if (r)
+			goto ERROR;
+
+		loc_country_unref(country);
+	}
+
+	for (unsigned int i = 0; i < NETWORKS; i++) {
+		const char* country_code = countries[i % 7];
+		const uint32_t asn = 1 + i % ASES;
+
+		// Add one network of each family and a smaller one inside every third
+		const char* formats[] = {
+			"%u.%u.0.0/16",
+			"2001:db8:%x:%x00::/56",
+			(i % 3) ? NULL : "%u.%u.128.0/20",
+			NULL,
+		};
+
+		for (const char** format = formats; *format; format++) {
+			snprintf(name, sizeof(name), *format, i >> 4, i & 0xf);
+
+			r = loc_writer_add_network(writer, &network, name);
+			if (r)
+				goto ERROR;
+
+			loc_network_set_asn(network, asn);
+			loc_network_set_country_code(network, country_code);
+
+			loc_network_unref(network);
+		}
+	}
+
+	f = tmpfile();
+	if (!f)
+		goto ERROR;
+
+	r = loc_writer_write(writer, f, LOC_DATABASE_VERSION_UNSET);
+	if (r) {
+		fclose(f);
+		f = NULL;
+	}
+
+ERROR:
+	loc_writer_unref(writer);
+
+	return f;
+}
+
+struct worker {
+	pthread_t thread;
+	unsigned int id;
+
+	struct loc_database* db;
+	struct loc_network* shared;
+
+	const struct in6_addr* addresses;
+	const struct loc_database_lookup_result* expected;
+	size_t count;
+
+	int r;
+};
+
+static int check_address_str(const struct in6_addr* address) {
+	char buffer[INET6_ADDRSTRLEN];
+
+	const char* s = loc_address_str(address);
+	if (!s)
+		return 1;
+
+	if (!loc_address_format(address, buffer, sizeof(buffer)))
+		return 1;
+
+	if (strcmp(s, buffer) != 0) {
+		fprintf(stderr, "Formatted addresses differ: %s != %s\n", s, buffer);
+		return 1;
+	}
+
+	return 0;
+}
+
+static int check_objects(struct worker* worker, const struct in6_addr* address,
+		const struct loc_database_lookup_result* expected) {
+	struct loc_network* network = NULL;
+	struct loc_country* country = NULL;
+	struct loc_as* as = NULL;
+	char string[INET6_ADDRSTRLEN + 4];
+	int r;
+
+	// Take and release a reference of an object that every thread uses
+	loc_network_ref(worker->shared);
+	loc_database_ref(worker->db);
+
+	r = check_address_str(address);
+	if (r)
+		goto ERROR;
+
+	r = loc_database_lookup(worker->db, address, &network);
+	if (r)
+		goto ERROR;
+
+	r = check_address_str(&expected->first_address);
+	if (r)
+		goto ERROR;
+
+	snprintf(string, sizeof(string), "%s/%u",
+		loc_address_str(&expected->first_address), loc_network_prefix(network));
+
+	if (strcmp(loc_network_str(network), string) != 0) {
+		fprintf(stderr, "Networks differ: %s != %s\n", loc_network_str(network), string);
+		r = 1;
+		goto ERROR;
+	}
+
+	r = loc_database_get_as(worker->db, &as, expected->asn);
+	if (r)
+		goto ERROR;
+
+	if (loc_as_get_number(as) != expected->asn) {
+		fprintf(stderr, "Fetched the wrong AS: %u != %u\n",
+			loc_as_get_number(as), expected->asn);
+		r = 1;
+		goto ERROR;
+	}
+
+	r = loc_database_get_country(worker->db, &country, expected->country_code);
+	if (r)
+		goto ERROR;
+
+	if (strcmp(loc_country_get_code(country), expected->country_code) != 0) {
+		fprintf(stderr, "Fetched the wrong country: %s\n", loc_country_get_code(country));
+		r = 1;
+		goto ERROR;
+	}
+
+ERROR:
+	if (network)
+		loc_network_unref(network);
+	if (country)
+		loc_country_unref(country);
+	if (as)
+		loc_as_unref(as);
+
+	loc_database_unref(worker->db);
+	loc_network_unref(worker->shared);
+
+	return r;
+}
+
+static int enumerate_countries(struct loc_database* db) {
+	struct loc_database_enumerator* enumerator = NULL;
+	struct loc_country* country = NULL;
+	unsigned int count = 0;
+	int r;
+
+	r = loc_database_enumerator_new(&enumerator, db, LOC_DB_ENUMERATE_COUNTRIES, 0);
+	if (r)
+		return r;
+
+	while (1) {
+		r = loc_database_enumerator_next_country(enumerator, &country);
+		if (r)
+			goto ERROR;
+
+		if (!country)
+			break;
+
+		loc_country_unref(country);
+		count++;
+	}
+
+	if (count != sizeof(countries) / sizeof(*countries) - 1) {
+		fprintf(stderr, "Enumerated %u countries\n", count);
+		r = 1;
+	}
+
+ERROR:
+	loc_database_enumerator_unref(enumerator);
+
+	return r;
+}
+
+static void* run(void* data) {
+	struct worker* worker = data;
+	struct loc_database_lookup_result result;
+	int r;
+
+	for (size_t i = 0; i < worker->count; i++) {
+		// Every thread starts somewhere else
+		size_t j = (i + worker->id * 7919) % worker->count;
+
+		r = loc_database_lookup_result(worker->db, &worker->addresses[j], &result);
+		if (r < 0)
+			goto ERROR;
+
+		if (memcmp(&result, &worker->expected[j], sizeof(result)) != 0) {
+			fprintf(stderr, "Thread %u: Lookup results for %s differ\n",
+				worker->id, loc_address_str(&worker->addresses[j]));
+			r = 1;
+			goto ERROR;
+		}
+
+		if (r || (i % 16))
+			continue;
+
+		r = check_objects(worker, &worker->addresses[j], &result);
+		if (r)
+			goto ERROR;
+	}
+
+	r = enumerate_countries(worker->db);
+	if (r)
+		goto ERROR;
+
+	r = 0;
+
+ERROR:
+	worker->r = r;
+
+	return NULL;
+}
+
+static int run_threads(struct loc_database* db, unsigned int threads,
+		struct loc_network* shared, const struct in6_addr* addresses,
+		const struct loc_database_lookup_result* expected) {
+	struct worker workers[MAX_THREADS];
+	int r = 0;
+
+	for (unsigned int i = 0; i < threads; i++) {
+		struct worker* worker = &workers[i];
+
+		worker->id = i;
+		worker->db = db;
+		worker->shared = shared;
+		worker->addresses = addresses;
+		worker->expected = expected;
+		worker->count = LOOKUPS;
+		worker->r = 0;
+
+		r = pthread_create(&worker->thread, NULL, run, worker);
+		if (r) {
+			fprintf(stderr, "Could not create thread: %s\n", strerror(r));
+
+			// Wait for all threads that have been started
+			threads = i;
+			break;
+		}
+	}
+
+	for (unsigned int i = 0; i < threads; i++) {
+		pthread_join(workers[i].thread, NULL);
+
+		if (workers[i].r)
+			r = 1;
+	}
+
+	return r;
+}
+
+static int test(struct loc_ctx* ctx, FILE* f, int flags, unsigned int threads,
+		const struct in6_addr* addresses, struct loc_database_lookup_result* expected) {
+	struct loc_database* db = NULL;
+	struct loc_network* shared = NULL;
+	int r;
+
+	r = loc_database_new_with_flags(ctx, &db, f, flags);
+	if (r) {
+		fprintf(stderr, "Could not open database: %m\n");
+		return r;
+	}
+
+	// Compute all expected results in a single thread
+	for (unsigned int i = 0; i < LOOKUPS; i++) {
+		r = loc_database_lookup_result(db, &addresses[i], &expected[i]);
+		if (r < 0)
+			goto ERROR;
+	}
+
+	r = loc_network_new_from_string(ctx, &shared, "2001:db8::/32");
+	if (r)
+		goto ERROR;
+
+	// Check that all threads get the correct results
+	r = run_threads(db, threads, shared, addresses, expected);
+	if (r)
+		goto ERROR;
+
+	// All references that have been taken must have been released again
+	loc_network_ref(shared);
+
+	if (!loc_network_unref(shared)) {
+		fprintf(stderr, "The shared network has been freed\n");
+		r = 1;
+		goto ERROR;
+	}
+
+ERROR:
+	if (shared && loc_network_unref(shared)) {
+		fprintf(stderr, "The shared network has not been freed\n");
+		r = 1;
+	}
+	loc_database_unref(db);
+
+	return r;
+}
+
+int main(int argc, char** argv) {
+	struct loc_database_lookup_result* expected = NULL;
+	struct in6_addr* addresses = NULL;
+	struct loc_ctx* ctx = NULL;
+	FILE* f = NULL;
+	int r = EXIT_FAILURE;
+
+	if (loc_new(&ctx) < 0)
+		exit(EXIT_FAILURE);
+
+	loc_set_log_priority(ctx, LOG_INFO);
+
+	// Use one thread per CPU, but always at least two
+	long threads = sysconf(_SC_NPROCESSORS_ONLN);
+	if (threads < 2)
+		threads = 2;
+	else if (threads > MAX_THREADS)
+		threads = MAX_THREADS;
+
+	f = create_database(ctx);
+	if (!f) {
+		fprintf(stderr, "Could not create database: %m\n");
+		goto ERROR;
+	}
+
+	addresses = calloc(LOOKUPS, sizeof(*addresses));
+	expected = calloc(LOOKUPS, sizeof(*expected));
+	if (!addresses || !expected)
+		goto ERROR;
+
+	for (unsigned int i = 0; i < LOOKUPS; i++)
+		make_address(&addresses[i], i);
+
+	if (test(ctx, f, 0, threads, addresses, expected))
+		goto ERROR;
+
+	if (test(ctx, f, LOC_DB_FLAGS_POPTRIE|LOC_DB_FLAGS_DIR24_8, threads, addresses, expected))
+		goto ERROR;
+
+	r = EXIT_SUCCESS;
+
+ERROR:
+	if (f)
+		fclose(f);
+	if (addresses)
+		free(addresses);
+	if (expected)
+		free(expected);
+	loc_unref(ctx);
+
+	return r;
+}
@@ -66,6 +66,8 @@ struct loc_writer {
 
 	struct loc_as_list* as_list;
 	struct loc_country_list* country_list;
+
+	int flags;
 };
 
 static int parse_private_key(struct loc_writer* writer, EVP_PKEY** private_key, FILE* f) {
@@ -145,7 +147,7 @@ LOC_EXPORT int loc_writer_new(struct loc_ctx* ctx, struct loc_writer** writer,
 }
 
 LOC_EXPORT struct loc_writer* loc_writer_ref(struct loc_writer* writer) {
-	writer->refcount++;
+	loc_refcount_inc(&writer->refcount);
 
 	return writer;
 }
@@ -180,7 +182,7 @@ static void loc_writer_free(struct loc_writer* writer) {
 }
 
 LOC_EXPORT struct loc_writer* loc_writer_unref(struct loc_writer* writer) {
-	if (--writer->refcount > 0)
+	if (loc_refcount_dec(&writer->refcount) > 0)
 		return writer;
 
 	loc_writer_free(writer);
@@ -188,6 +190,16 @@ LOC_EXPORT struct loc_writer* loc_writer_unref(struct loc_writer* writer) {
 	return NULL;
 }
 
+LOC_EXPORT int loc_writer_get_flags(struct loc_writer* writer) {
+	return writer->flags;
+}
+
+LOC_EXPORT int loc_writer_set_flags(struct loc_writer* writer, int flags) {
+	writer->flags = flags;
+
+	return 0;
+}
+
 LOC_EXPORT const char* loc_writer_get_vendor(struct loc_writer* writer) {
 	return loc_stringpool_get(writer->pool, writer->vendor);
 }
@@ -336,9 +348,28 @@ struct node {
 
 	struct loc_network_tree_node* node;
 
+	// Child nodes
+	struct node* children[2];
+
+	// The node with the network that covers this node (if any)
+	struct node* origin;
+
+	// Index of this node
+	uint32_t index;
+
+	// Index of the network on this node
+	uint32_t network_index;
+
+	// The number of levels of the subtree below this node
+	unsigned int height;
+
 	// Indices of the child nodes
 	uint32_t index_zero;
 	uint32_t index_one;
+
+	// Any bits that have been skipped before this node
+	uint32_t bits;
+	uint8_t skip;
 };
 
 static struct node* make_node(struct loc_network_tree_node* node) {
@@ -346,14 +377,91 @@ static struct node* make_node(struct loc_network_tree_node* node) {
 	if (!n)
 		return NULL;
 
-	n->node  = loc_network_tree_node_ref(node);
+	n->node  = (node) ? loc_network_tree_node_ref(node) : NULL;
+	n->children[0] = n->children[1] = NULL;
+	n->origin = NULL;
+	n->index = 0;
+	n->network_index = 0xffffffff;
+	n->height = 1;
 	n->index_zero = n->index_one = 0;
+	n->bits = 0;
+	n->skip = 0;
+
+	return n;
+}
+
+/*
+	Skips any nodes that have only one child and no network and
+	returns the next node that we have to write.
+*/
+static struct node* make_compressed_node(struct loc_network_tree_node* node) {
+	struct loc_network_tree_node* child = NULL;
+	struct loc_network_tree_node* next = NULL;
+	uint32_t bits = 0;
+	uint8_t skip = 0;
+
+	node = loc_network_tree_node_ref(node);
+
+	while (skip < LOC_DATABASE_NODE_V2_MAX_SKIP && !loc_network_tree_node_is_leaf(node)) {
+		unsigned int bit = 0;
+
+		next = NULL;
+
+		for (unsigned int i = 0; i <= 1; i++) {
+			child = loc_network_tree_node_get(node, i);
+			if (!child)
+				continue;
+
+			// Stop if this node has two children
+			if (next) {
+				loc_network_tree_node_unref(child);
+				loc_network_tree_node_unref(next);
+				next = NULL;
+				break;
+			}
+
+			next = child;
+			bit = i;
+		}
+
+		if (!next)
+			break;
+
+		// Skip this node
+		loc_network_tree_node_unref(node);
+		node = next;
+
+		bits |= bit << (31 - skip++);
+	}
+
+	struct node* n = make_node(node);
+	loc_network_tree_node_unref(node);
+
+	if (!n)
+		return NULL;
+
+	n->bits = bits;
+	n->skip = skip;
+
+	return n;
+}
+
+/*
+	Makes a leaf that carries a copy of the network of origin
+*/
+static struct node* make_pushed_node(struct node* origin) {
+	struct node* n = make_node(NULL);
+	if (!n)
+		return NULL;
+
+	n->origin = origin;
 
 	return n;
 }
 
 static void free_node(struct node* node) {
-	loc_network_tree_node_unref(node->node);
+	if (node->node)
+		loc_network_tree_node_unref(node->node);
 
 	free(node);
 }
@@ -380,8 +488,197 @@ static void free_network(struct network* network) {
 	free(network);
 }
 
+/*
+	A network of a country or an AS that goes into the network index
+*/
+struct network_ref {
+	enum network_ref_type {
+		NETWORK_REF_COUNTRY = 0,
+		NETWORK_REF_AS      = 1,
+	} type;
+
+	// The country code (in the lower two bytes) or the ASN
+	uint32_t key;
+
+	// The address and prefix like they are stored in the tree
+	struct in6_addr address;
+	uint8_t prefix;
+
+	// The position of the network
+	uint32_t network;
+};
+
+struct network_refs {
+	struct network_ref* refs;
+	size_t count;
+	size_t size;
+};
+
+static int network_ref_cmp(const void* p1, const void* p2) {
+	const struct network_ref* ref1 = p1;
+	const struct network_ref* ref2 = p2;
+	int r;
+
+	if (ref1->type != ref2->type)
+		return (ref1->type < ref2->type) ? -1 : 1;
+
+	if (ref1->key != ref2->key)
+		return (ref1->key < ref2->key) ? -1 : 1;
+
+	// Sort networks in the same order as a depth-first search through the tree
+	r = memcmp(&ref1->address, &ref2->address, sizeof(ref1->address));
+	if (r)
+		return r;
+
+	return (ref1->prefix > ref2->prefix) - (ref1->prefix < ref2->prefix);
+}
+
+static int network_refs_add(struct network_refs* refs, enum network_ref_type type,
+		uint32_t key, struct loc_network* network, uint32_t pos) {
+	// Make space
+	if (refs->count == refs->size) {
+		size_t size = (refs->size) ? refs->size * 2 : 1024;
+
+		struct network_ref* r = reallocarray(refs->refs, size, sizeof(*r));
+		if (!r)
+			return 1;
+
+		refs->refs = r;
+		refs->size = size;
+	}
+
+	struct network_ref* ref = &refs->refs[refs->count++];
+
+	ref->type    = type;
+	ref->key     = key;
+	ref->address = *loc_network_get_first_address(network);
+	ref->prefix  = loc_network_prefix(network);
+	ref->network = pos;
+
+	// IPv4 networks are stored in the tree with a longer prefix
+	if (loc_network_address_family(network) == AF_INET)
+		ref->prefix += 96;
+
+	return 0;
+}
+
+/*
+	Adds the network at pos to the lists of its country and AS
+*/
+static int network_refs_add_network(struct network_refs* refs,
+		struct loc_network* network, uint32_t pos) {
+	int r;
+
+	const char* country_code = loc_network_get_country_code(network);
+
+	if (loc_country_code_is_valid(country_code)) {
+		r = network_refs_add(refs, NETWORK_REF_COUNTRY,
+			(country_code[0] << 8) | country_code[1], network, pos);
+		if (r)
+			return r;
+	}
+
+	const uint32_t asn = loc_network_get_asn(network);
+
+	if (asn) {
+		r = network_refs_add(refs, NETWORK_REF_AS, asn, network, pos);
+		if (r)
+			return r;
+	}
+
+	return 0;
+}
+
+static struct node* make_child_node(struct loc_network_tree_node* node,
+		enum loc_database_version version) {
+	switch (version) {
+		case LOC_DATABASE_VERSION_2:
+			return make_compressed_node(node);
+
+		default:
+			return make_node(node);
+	}
+}
+
+static size_t write_node(struct node* node, uint32_t network_index,
+		enum loc_database_version version, FILE* f) {
+	struct loc_database_network_node_v1 db_node_v1;
+	struct loc_database_network_node_v2 db_node_v2;
+
+	switch (version) {
+		case LOC_DATABASE_VERSION_1:
+			db_node_v1.zero    = htobe32(node->index_zero);
+			db_node_v1.one     = htobe32(node->index_one);
+			db_node_v1.network = htobe32(network_index);
+
+			return fwrite(&db_node_v1, 1, sizeof(db_node_v1), f);
+
+		case LOC_DATABASE_VERSION_2:
+			db_node_v2.zero    = htobe32(node->index_zero);
+			db_node_v2.one     = htobe32(node->index_one);
+			db_node_v2.network = htobe32(network_index);
+			db_node_v2.bits    = htobe32(node->bits);
+			db_node_v2.skip    = node->skip;
+
+			// Clear the padding
+			memset(db_node_v2.padding, '\0', sizeof(db_node_v2.padding));
+
+			return fwrite(&db_node_v2, 1, sizeof(db_node_v2), f);
+
+		default:
+			return 0;
+	}
+}
+
+/*
+	Lays out the subtree below node, but no deeper than levels, in van Emde Boas order:
+
+	The top half of the subtree is being laid out first, followed by all subtrees
+	hanging off its bottom, each of them recursively in the same way. Therefore,
+	a walk from the root to any leaf touches the smallest number of cache lines and
+	pages without knowing how large they are.
+*/
+static void layout_bottom(struct node* node, unsigned int depth, unsigned int levels,
+	struct node** order, uint32_t* index);
+
+static void layout_subtree(struct node* node, unsigned int levels,
+		struct node** order, uint32_t* index) {
+	if (levels > node->height)
+		levels = node->height;
+
+	// Place a single node
+	if (levels == 1) {
+		node->index = (*index)++;
+		order[node->index] = node;
+		return;
+	}
+
+	const unsigned int top = levels / 2;
+
+	// Place the top half
+	layout_subtree(node, top, order, index);
+
+	// Place all subtrees below it
+	layout_bottom(node, top, levels - top, order, index);
+}
+
+static void layout_bottom(struct node* node, unsigned int depth, unsigned int levels,
+		struct node** order, uint32_t* index) {
+	for (unsigned int i = 0; i <= 1; i++) {
+		struct node* child = node->children[i];
+		if (!child)
+			continue;
+
+		if (depth == 1)
+			layout_subtree(child, levels, order, index);
+		else
+			layout_bottom(child, depth - 1, levels, order, index);
+	}
+}
+
 static int loc_database_write_networks(struct loc_writer* writer,
-		struct loc_database_header_v1* header, off_t* offset, FILE* f) {
+		struct loc_database_header_v1* header, off_t* offset, FILE* f,
+		enum loc_database_version version, struct network_refs* refs) {
 	// Write the network tree
 	DEBUG(writer->ctx, "Network tree starts at %jd bytes\n", (intmax_t)*offset);
 	header->network_tree_offset = htobe32(*offset);
@@ -392,15 +689,22 @@ static int loc_database_write_networks(struct loc_writer* writer,
 	struct node* node;
 	struct node* child_node;
 
+	struct node** nodes = NULL;
+	struct node** order = NULL;
+	size_t count = 0;
+	size_t size = 0;
+
 	uint32_t index = 0;
 	uint32_t network_index = 0;
 
 	struct loc_database_network_v1 db_network;
-	struct loc_database_network_node_v1 db_node;
+	uint32_t db_node_network;
+	size_t bytes_written;
+	int r = 1;
 
 	// Initialize queue for nodes
-	TAILQ_HEAD(node_t, node) nodes;
-	TAILQ_INIT(&nodes);
+	TAILQ_HEAD(node_t, node) queue;
+	TAILQ_INIT(&queue);
 
 	// Initialize queue for networks
 	TAILQ_HEAD(network_t, network) networks;
@@ -409,72 +713,150 @@ static int loc_database_write_networks(struct loc_writer* writer,
 	// Add root
 	struct loc_network_tree_node* root = loc_network_tree_get_root(writer->networks);
 	node = make_node(root);
+	loc_network_tree_node_unref(root);
 	if (!node)
 		return 1;
 
-	TAILQ_INSERT_TAIL(&nodes, node, nodes);
+	TAILQ_INSERT_TAIL(&queue, node, nodes);
 
-	while (!TAILQ_EMPTY(&nodes)) {
+	// Collect all nodes in breadth-first order
+	while (!TAILQ_EMPTY(&queue)) {
 		// Pop first node in list
-		node = TAILQ_FIRST(&nodes);
-		TAILQ_REMOVE(&nodes, node, nodes);
+		node = TAILQ_FIRST(&queue);
+		TAILQ_REMOVE(&queue, node, nodes);
+
+		// Grow the array of nodes
+		if (count == size) {
+			size = (size) ? size * 2 : 1024;
+
+			struct node** n = reallocarray(nodes, size, sizeof(*nodes));
+			if (!n) {
+				free_node(node);
+				goto ERROR;
+			}
+
+			nodes = n;
+		}
+
+		nodes[count++] = node;
+
+		// Pushed leaves have no children
+		if (!node->node)
+			continue;
 
 		DEBUG(writer->ctx, "Processing node %p\n", node);
 
+		// A network covers everything below it
+		if (loc_network_tree_node_is_leaf(node->node))
+			node->origin = node;
+
 		// Get child nodes
-		struct loc_network_tree_node* node_zero = loc_network_tree_node_get(node->node, 0);
-		if (node_zero) {
-			node->index_zero = ++index;
+		for (unsigned int i = 0; i <= 1; i++) {
+			struct loc_network_tree_node* child = loc_network_tree_node_get(node->node, i);
+			if (!child)
+				continue;
 
-			child_node = make_node(node_zero);
-			loc_network_tree_node_unref(node_zero);
+			child_node = make_child_node(child, version);
+			loc_network_tree_node_unref(child);
+			if (!child_node)
+				goto ERROR;
 
-			TAILQ_INSERT_TAIL(&nodes, child_node, nodes);
+			child_node->origin = node->origin;
+			node->children[i] = child_node;
+
+			TAILQ_INSERT_TAIL(&queue, child_node, nodes);
 		}
 
-		struct loc_network_tree_node* node_one = loc_network_tree_node_get(node->node, 1);
-		if (node_one) {
-			node->index_one = ++index;
+		/*
+			Push the covering network into the empty child of any node that has
+			only one. Version 2 skips most of these nodes, so lookups that leave
+			a skipped path still end on a node without a network.
+		*/
+		if ((writer->flags & LOC_WRITER_FLAGS_PUSH_LEAVES) && node->origin
+				&& (node->children[0] || node->children[1])) {
+			for (unsigned int i = 0; i <= 1; i++) {
+				if (node->children[i])
+					continue;
+
+				child_node = make_pushed_node(node->origin);
+				if (!child_node)
+					goto ERROR;
 
-			child_node = make_node(node_one);
-			loc_network_tree_node_unref(node_one);
+				node->children[i] = child_node;
 
-			TAILQ_INSERT_TAIL(&nodes, child_node, nodes);
+				TAILQ_INSERT_TAIL(&queue, child_node, nodes);
+			}
 		}
+	}
 
-		// Prepare what we are writing to disk
-		db_node.zero = htobe32(node->index_zero);
-		db_node.one  = htobe32(node->index_one);
+	// Cluster the nodes in subtrees
+	if (writer->flags & LOC_WRITER_FLAGS_CLUSTER_TREE) {
+		// Compute the height of all subtrees (children always come after their parents)
+		for (size_t i = count; i-- > 0;) {
+			node = nodes[i];
+
+			for (unsigned int j = 0; j <= 1; j++) {
+				if (node->children[j] && node->children[j]->height >= node->height)
+					node->height = node->children[j]->height + 1;
+			}
+		}
+
+		order = calloc(count, sizeof(*order));
+		if (!order)
+			goto ERROR;
+
+		layout_subtree(nodes[0], nodes[0]->height, order, &index);
 
-		if (loc_network_tree_node_is_leaf(node->node)) {
+	// Otherwise keep the nodes in breadth-first order
+	} else {
+		for (size_t i = 0; i < count; i++)
+			nodes[i]->index = i;
+
+		order = nodes;
+	}
+
+	for (size_t i = 0; i < count; i++) {
+		node = order[i];
+
+		if (node->children[0])
+			node->index_zero = node->children[0]->index;
+
+		if (node->children[1])
+			node->index_one = node->children[1]->index;
+
+		// Pushed leaves refer to the network they have been copied from
+		// (which always has been written before any nodes below it)
+		if (!node->node) {
+			db_node_network = node->origin->network_index;
+
+		} else if (loc_network_tree_node_is_leaf(node->node)) {
 			struct loc_network* network = loc_network_tree_node_get_network(node->node);
 
 			// Append network to be written out later
 			struct network* nw = make_network(network);
-			if (!nw) {
-				free_node(node);
-				return 1;
-			}
+			loc_network_unref(network);
+			if (!nw)
+				goto ERROR;
+
 			TAILQ_INSERT_TAIL(&networks, nw, networks);
 
-			db_node.network = htobe32(network_index++);
-			loc_network_unref(network);
+			db_node_network = node->network_index = network_index++;
 		} else {
-			db_node.network = htobe32(0xffffffff);
+			db_node_network = 0xffffffff;
 		}
 
 		// Write the current node
-		DEBUG(writer->ctx, "Writing node %p (0 = %d, 1 = %d)\n",
-			node, node->index_zero, node->index_one);
+		DEBUG(writer->ctx, "Writing node %p (0 = %d, 1 = %d, skip = %u)\n",
+			node, node->index_zero, node->index_one, node->skip);
 
-		*offset += fwrite(&db_node, 1, sizeof(db_node), f);
-		network_tree_length += sizeof(db_node);
+		bytes_written = write_node(node, db_node_network, version, f);
+		if (!bytes_written)
+			goto ERROR;
 
-		free_node(node);
+		*offset += bytes_written;
+		network_tree_length += bytes_written;
 	}
 
-	loc_network_tree_node_unref(root);
-
 	header->network_tree_length = htobe32(network_tree_length);
 
 	align_page_boundary(offset, f);
@@ -484,26 +866,61 @@ static int loc_database_write_networks(struct loc_writer* writer,
 
 	// We have now written the entire tree and have all networks
 	// in a queue in order as they are indexed
-	while (!TAILQ_EMPTY(&networks)) {
+	for (uint32_t pos = 0; !TAILQ_EMPTY(&networks); pos++) {
 		struct network* nw = TAILQ_FIRST(&networks);
 		TAILQ_REMOVE(&networks, nw, networks);
 
+		// Remember the network for the index
+		if (refs) {
+			r = network_refs_add_network(refs, nw->network, pos);
+			if (r) {
+				free_network(nw);
+				goto ERROR;
+			}
+		}
+
 		// Prepare what we are writing to disk
-		int r = loc_network_to_database_v1(nw->network, &db_network);
+		r = loc_network_to_database_v1(nw->network, &db_network);
+		free_network(nw);
 		if (r)
-			return r;
+			goto ERROR;
 
 		*offset += fwrite(&db_network, 1, sizeof(db_network), f);
 		network_data_length += sizeof(db_network);
-
-		free_network(nw);
 	}
 
 	header->network_data_length = htobe32(network_data_length);
 
 	align_page_boundary(offset, f);
 
-	return 0;
+	r = 0;
+
+ERROR:
+	// Free any nodes that are still queued
+	while (!TAILQ_EMPTY(&queue)) {
+		node = TAILQ_FIRST(&queue);
+		TAILQ_REMOVE(&queue, node, nodes);
+
+		free_node(node);
+	}
+
+	for (size_t i = 0; i < count; i++)
+		free_node(nodes[i]);
+
+	// Free any networks that have not been written
+	while (!TAILQ_EMPTY(&networks)) {
+		struct network* nw = TAILQ_FIRST(&networks);
+		TAILQ_REMOVE(&networks, nw, networks);
+
+		free_network(nw);
+	}
+
+	if (order && order != nodes)
+		free(order);
+	if (nodes)
+		free(nodes);
+
+	return r;
 }
 
 static int loc_database_write_countries(struct loc_writer* writer,
@@ -535,6 +952,222 @@ static int loc_database_write_countries(struct loc_writer* writer,
 	return 0;
 }
 
+struct trigram {
+	// The three characters in the lower three bytes
+	uint32_t trigram;
+
+	// The position of the AS
+	uint32_t pos;
+};
+
+static int trigram_cmp(const void* p1, const void* p2) {
+	const struct trigram* t1 = p1;
+	const struct trigram* t2 = p2;
+
+	if (t1->trigram != t2->trigram)
+		return (t1->trigram < t2->trigram) ? -1 : 1;
+
+	if (t1->pos != t2->pos)
+		return (t1->pos < t2->pos) ? -1 : 1;
+
+	return 0;
+}
+
+static inline unsigned char trigram_lower(unsigned char c) {
+	if (c >= 'A' && c <= 'Z')
+		return c - 'A' + 'a';
+
+	return c;
+}
+
+static int loc_database_write_as_search_section(struct loc_writer* writer,
+		struct loc_database_header_v1* header, off_t* offset, FILE* f) {
+	struct trigram* trigrams = NULL;
+	size_t length = 0;
+	size_t size = 0;
+	int r = 1;
+
+	DEBUG(writer->ctx, "AS search section starts at %jd bytes\n", (intmax_t)*offset);
+	header->as_search_offset = htobe32(*offset);
+
+	// The AS list has been sorted when the ASes were written
+	const size_t as_count = loc_as_list_size(writer->as_list);
+
+	// Collect all trigrams of all names
+	for (unsigned int i = 0; i < as_count; i++) {
+		struct loc_as* as = loc_as_list_get(writer->as_list, i);
+		if (!as)
+			goto ERROR;
+
+		const unsigned char* name = (const unsigned char*)loc_as_get_name(as);
+		const size_t name_length = (name) ? strlen((const char*)name) : 0;
+
+		for (size_t j = 0; j + 3 <= name_length; j++) {
+			// Skip anything that isn't ASCII
+			if (name[j] >= 0x80 || name[j + 1] >= 0x80 || name[j + 2] >= 0x80)
+				continue;
+
+			// Make space
+			if (length == size) {
+				size = (size) ? size * 2 : 1024;
+
+				struct trigram* t = realloc(trigrams, size * sizeof(*trigrams));
+				if (!t) {
+					loc_as_unref(as);
+					goto ERROR;
+				}
+
+				trigrams = t;
+			}
+
+			trigrams[length].trigram = (trigram_lower(name[j]) << 16)
+				| (trigram_lower(name[j + 1]) << 8) | trigram_lower(name[j + 2]);
+			trigrams[length].pos = i;
+			length++;
+		}
+
+		loc_as_unref(as);
+	}
+
+	if (trigrams)
+		qsort(trigrams, length, sizeof(*trigrams), trigram_cmp);
+
+	// Remove any trigrams that occur more than once in the same name
+	size_t postings = 0;
+	uint32_t count = 0;
+
+	for (size_t i = 0; i < length; i++) {
+		if (postings && trigrams[postings - 1].trigram == trigrams[i].trigram
+				&& trigrams[postings - 1].pos == trigrams[i].pos)
+			continue;
+
+		// Count distinct trigrams
+		if (!postings || trigrams[postings - 1].trigram != trigrams[i].trigram)
+			count++;
+
+		trigrams[postings++] = trigrams[i];
+	}
+
+	// Write the header of the section
+	struct loc_database_as_search_v1 search = {
+		.trigrams = htobe32(count),
+	};
+
+	size_t block_length = fwrite(&search, 1, sizeof(search), f);
+
+	// Write all trigrams
+	struct loc_database_as_trigram_v1 block;
+	memset(&block, 0, sizeof(block));
+
+	for (size_t i = 0, first = 0; i < postings; i++) {
+		// Write the trigram once we have reached the last of its ASes
+		if (i + 1 < postings && trigrams[i + 1].trigram == trigrams[i].trigram)
+			continue;
+
+		block.trigram[0] = trigrams[i].trigram >> 16;
+		block.trigram[1] = trigrams[i].trigram >> 8;
+		block.trigram[2] = trigrams[i].trigram;
+		block.offset = htobe32(first);
+		block.count  = htobe32(i + 1 - first);
+
+		block_length += fwrite(&block, 1, sizeof(block), f);
+
+		first = i + 1;
+	}
+
+	// Write all AS positions
+	for (size_t i = 0; i < postings; i++) {
+		uint32_t pos = htobe32(trigrams[i].pos);
+
+		block_length += fwrite(&pos, 1, sizeof(pos), f);
+	}
+
+	*offset += block_length;
+
+	DEBUG(writer->ctx, "AS search section has %u trigram(s) and a length of %zu bytes\n",
+		count, block_length);
+	header->as_search_length = htobe32(block_length);
+
+	align_page_boundary(offset, f);
+
+	r = 0;
+
+ERROR:
+	if (trigrams)
+		free(trigrams);
+
+	return r;
+}
+
+static int loc_database_write_network_index(struct loc_writer* writer,
+		struct loc_database_header_v1* header, off_t* offset, FILE* f,
+		struct network_refs* refs) {
+	DEBUG(writer->ctx, "Network index starts at %jd bytes\n", (intmax_t)*offset);
+	header->network_index_offset = htobe32(*offset);
+
+	if (refs->refs)
+		qsort(refs->refs, refs->count, sizeof(*refs->refs), network_ref_cmp);
+
+	// Count all countries and ASes
+	uint32_t keys[2] = { 0, 0 };
+
+	for (size_t i = 0; i < refs->count; i++) {
+		if (i && refs->refs[i].type == refs->refs[i - 1].type
+				&& refs->refs[i].key == refs->refs[i - 1].key)
+			continue;
+
+		keys[refs->refs[i].type]++;
+	}
+
+	// Write the header of the section
+	struct loc_database_network_index_v1 index = {
+		.countries = htobe32(keys[NETWORK_REF_COUNTRY]),
+		.asns      = htobe32(keys[NETWORK_REF_AS]),
+	};
+
+	size_t block_length = fwrite(&index, 1, sizeof(index), f);
+
+	// Write all countries and ASes
+	struct loc_database_network_index_key_v1 key;
+
+	for (size_t i = 0, first = 0; i < refs->count; i++) {
+		// Write the key once we have reached its last network
+		if (i + 1 < refs->count && refs->refs[i + 1].type == refs->refs[i].type
+				&& refs->refs[i + 1].key == refs->refs[i].key)
+			continue;
+
+		key.key    = htobe32(refs->refs[i].key);
+		key.offset = htobe32(first);
+		key.count  = htobe32(i + 1 - first);
+
+		block_length += fwrite(&key, 1, sizeof(key), f);
+
+		first = i + 1;
+	}
+
+	// Write all networks
+	struct loc_database_network_index_ref_v1 ref;
+	memset(&ref, 0, sizeof(ref));
+
+	for (size_t i = 0; i < refs->count; i++) {
+		memcpy(ref.address, &refs->refs[i].address, sizeof(ref.address));
+		ref.prefix  = refs->refs[i].prefix;
+		ref.network = htobe32(refs->refs[i].network);
+
+		block_length += fwrite(&ref, 1, sizeof(ref), f);
+	}
+
+	*offset += block_length;
+
+	DEBUG(writer->ctx, "Network index has %u countries, %u ASes and a length of %zu bytes\n",
+		keys[NETWORK_REF_COUNTRY], keys[NETWORK_REF_AS], block_length);
+	header->network_index_length = htobe32(block_length);
+
+	align_page_boundary(offset, f);
+
+	return 0;
+}
+
 static int loc_writer_create_signature(struct loc_writer* writer,
 		struct loc_database_header_v1* header, FILE* f, EVP_PKEY* private_key,
 		char* signature, size_t* length) {
@@ -635,6 +1268,7 @@ LOC_EXPORT int loc_writer_write(struct loc_writer* writer, FILE* f, enum loc_dat
 			break;
 
 		case LOC_DATABASE_VERSION_1:
+		case LOC_DATABASE_VERSION_2:
 			break;
 
 		default:
@@ -642,6 +1276,14 @@ LOC_EXPORT int loc_writer_write(struct loc_writer* writer, FILE* f, enum loc_dat
 			return -1;
 	}
 
+	// Older readers would return the copies of pushed networks as networks of their
+	// own, so leaf-pushed trees can only be written in a version that they reject
+	if ((writer->flags & LOC_WRITER_FLAGS_PUSH_LEAVES) && version < LOC_DATABASE_VERSION_2) {
+		ERROR(writer->ctx, "Leaf-pushed trees require database version 2 or later\n");
+		errno = ENOTSUP;
+		return -1;
+	}
+
 	DEBUG(writer->ctx, "Writing database in version %d\n", version);
 
 	struct loc_database_magic magic;
@@ -662,6 +1304,20 @@ LOC_EXPORT int loc_writer_write(struct loc_writer* writer, FILE* f, enum loc_dat
 	memset(header.signature2, '\0', sizeof(header.signature2));
 	header.signature2_length = 0;
 
+	// Set flags
+	header.flags = 0;
+
+	if (writer->flags & LOC_WRITER_FLAGS_PUSH_LEAVES)
+		header.flags |= LOC_DATABASE_HEADER_FLAG_LEAF_PUSHED;
+
+	header.flags = htobe32(header.flags);
+
+	// There are no indices unless we write them
+	header.as_search_offset = 0;
+	header.as_search_length = 0;
+	header.network_index_offset = 0;
+	header.network_index_length = 0;
+
 	// Clear the padding
 	memset(header.padding, '\0', sizeof(header.padding));
 
@@ -691,8 +1347,19 @@ LOC_EXPORT int loc_writer_write(struct loc_writer* writer, FILE* f, enum loc_dat
 	if (r)
 		return r;
 
+	struct network_refs refs = {};
+
 	// Write all networks
-	r = loc_database_write_networks(writer, &header, &offset, f);
+	r = loc_database_write_networks(writer, &header, &offset, f, version,
+		(writer->flags & LOC_WRITER_FLAGS_NETWORK_INDEX) ? &refs : NULL);
+
+	// Write the network index
+	if (!r && (writer->flags & LOC_WRITER_FLAGS_NETWORK_INDEX))
+		r = loc_database_write_network_index(writer, &header, &offset, f, &refs);
+
+	if (refs.refs)
+		free(refs.refs);
+
 	if (r)
 		return r;
 
@@ -701,6 +1368,13 @@ LOC_EXPORT int loc_writer_write(struct loc_writer* writer, FILE* f, enum loc_dat
 	if (r)
 		return r;
 
+	// Write the AS search index
+	if (writer->flags & LOC_WRITER_FLAGS_SEARCH_INDEX) {
+		r = loc_database_write_as_search_section(writer, &header, &offset, f);
+		if (r)
+			return r;
+	}
+
 	// Write pool
 	r = loc_database_write_pool(writer, &header, &offset, f);
 	if (r)
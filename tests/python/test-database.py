@@ -67,6 +67,28 @@ class Test(unittest.TestCase):
 		n = self.db.lookup("255.255.255.255")
 		self.assertIsNone(n)
 
+	def test_fetch_fields(self):
+		"""
+			Fetch single fields and compare them with the whole network
+		"""
+		for address in ("81.3.27.38", "1.1.1.1", "8.8.8.8", "2a07:1c44:5800::1"):
+			n = self.db.lookup(address)
+
+			self.assertEqual(self.db.lookup_asn(address), n.asn)
+			self.assertEqual(self.db.lookup_country_code(address), n.country_code)
+
+			for flag in (location.NETWORK_FLAG_ANONYMOUS_PROXY, location.NETWORK_FLAG_ANYCAST,
+					location.NETWORK_FLAG_DROP):
+				self.assertEqual(bool(self.db.lookup_flags(address) & flag), n.has_flag(flag))
+
+		# Nothing should be found
+		self.assertIsNone(self.db.lookup_asn("255.255.255.255"))
+		self.assertIsNone(self.db.lookup_country_code("255.255.255.255"))
+		self.assertIsNone(self.db.lookup_flags("255.255.255.255"))
+
+		with self.assertRaises(ValueError):
+			self.db.lookup_asn("XXX")
+
 	def test_fetch_network_invalid(self):
 		"""
 			Feed some invalid inputs into the lookup function